@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# Bench: throughput of a Server in this process against Simulator devices
+#
+#-------------------------------------------------
+
+QT       += core network concurrent
+
+QT       -= gui
+
+CONFIG   += c++11
+
+TARGET = Bench
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../lib/common \
+        ../Server
+
+LIBS += -L../lib -lServer
+
+SOURCES += main.cpp \
+        planbench.cpp \
+        encodebench.cpp \
+        statusbench.cpp
+
+HEADERS += planbench.h \
+        encodebench.h \
+        statusbench.h
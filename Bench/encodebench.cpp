@@ -0,0 +1,73 @@
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include "encodebench.h"
+#include "planbench.h"
+#include "protocol.h"
+
+EncodeBench::EncodeBench() : m_repeatCount(5)
+{
+    m_plan.parameter.volt = VOLTAGE;
+    m_plan.parameter.totalTime = SONICATIONTIME_DEFAULT;
+    m_plan.parameter.period = SONICATIONPERIOD_DEFAULT;
+    m_plan.parameter.dutyCycle = DUTYCYCLE_DEFAULT;
+    m_plan.parameter.coolingTime = COOLINGTIME_DEFAULT;
+}
+
+void EncodeBench::setPlanSize(int layerCount, int spotCount)
+{
+    QHash<float, QList<Spot3DCoordinate> > spot3D;
+    QHash<float, QList<int> > spotOrder;
+    PlanBench::makePlan(layerCount, spotCount, spot3D, spotOrder);
+    m_plan.spot3D = LayerIndex<QList<Spot3DCoordinate> >(spot3D);
+    m_plan.spotOrder = LayerIndex<QList<int> >(spotOrder);
+}
+
+// One line per thread count, the speed-up against one thread in brackets
+void EncodeBench::run(int maxThreads)
+{
+    struct Format
+    {
+        const char *name;
+        int peerVersion;
+        quint32 capabilities;
+        bool scatter;
+    };
+    const Format formats[] =
+    {
+        { "legacy", PROTOCOL_LEGACY, 0, false },
+        { "v2", PROTOCOL_VERSION, CAP_COMPRESSION | CAP_CHECKSUM, false },
+        { "soa", PROTOCOL_VERSION, CAP_COMPRESSION | CAP_CHECKSUM | CAP_SOA_PLAN, false },
+        { "scatter", PROTOCOL_VERSION, CAP_COMPRESSION | CAP_CHECKSUM | CAP_SOA_PLAN, true }
+    };
+    const int formatCount = sizeof(formats) / sizeof(formats[0]);
+
+    qCDebug(BENCH()) << BENCH().categoryName() << m_plan.spot3D.size() << "layers, 1 to" << maxThreads << "threads,"
+                     << m_repeatCount << "encodes per format.";
+    double serialTime[formatCount];
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        m_pool.setMaxThreadCount(threads);
+        for (int i = 0; i < formatCount; i++)
+        {
+            qint64 frameBytes = 0;
+            double time = encodeTime(formats[i].peerVersion, formats[i].capabilities, formats[i].scatter, frameBytes);
+            if (threads == 1)
+                serialTime[i] = time;
+            qCDebug(BENCH()) << BENCH().categoryName() << threads << "threads," << formats[i].name << ":"
+                             << time << "ms (x" << serialTime[i] / time << ")," << frameBytes << "bytes.";
+        }
+    }
+}
+
+double EncodeBench::encodeTime(int peerVersion, quint32 capabilities, bool scatter, qint64 &frameBytes)
+{
+//  The first encode warms the pool's threads and the allocator, it is not timed
+    frameBytes = PlanEncoder::encode(m_plan, "bench", peerVersion, capabilities, &m_pool, scatter).size();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < m_repeatCount; i++)
+        PlanEncoder::encode(m_plan, "bench", peerVersion, capabilities, &m_pool, scatter);
+    return timer.nsecsElapsed() / 1e6 / m_repeatCount;
+}
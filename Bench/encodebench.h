@@ -0,0 +1,29 @@
+#ifndef ENCODEBENCH_H
+#define ENCODEBENCH_H
+
+#include <QThreadPool>
+
+#include "planencoder.h"
+
+//  Time of PlanEncoder::encode() on one plan with 1 to maxThreads threads,
+//  for every frame format a peer may negotiate. Runs without a network or
+//  an event loop.
+class EncodeBench
+{
+public:
+    EncodeBench();
+
+    void setPlanSize(int layerCount, int spotCount);    // spotCount spots in every layer
+    inline void setRepeatCount(int repeatCount) { m_repeatCount = repeatCount; }    // Encodes timed per format
+
+    void run(int maxThreads);
+
+private:
+    TreatmentPlan m_plan;
+    int m_repeatCount;
+    QThreadPool m_pool;
+
+    double encodeTime(int peerVersion, quint32 capabilities, bool scatter, qint64 &frameBytes);    // ms per encode
+};
+
+#endif // ENCODEBENCH_H
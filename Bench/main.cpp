@@ -0,0 +1,129 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QThread>
+
+#include "planbench.h"
+#include "encodebench.h"
+#include "statusbench.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure the Server library in this process, against running Simulator devices "
+                                     "where plans are sent.\n"
+                                     "peers: plans/s, MB/s and CPU s per GB with every peer sent plans at once, "
+                                     "e.g. against Simulator -n 32; with --multicast one send to the group "
+                                     "for all, against Simulator -n 32 -m group:port.\n"
+                                     "encode: ms per plan encoded with 1 to --threads threads in every format, "
+                                     "e.g. with --layers 400.\n"
+                                     "status: status frames/s decoded with 1 to --workers listener workers, "
+                                     "loaded by --peers sender threads, with the fan-out to Observer -n 100 "
+                                     "when [Observers] is enabled.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("mode", "peers, encode or status");
+    QCommandLineOption countOption(QStringList() << "n" << "peers",
+                                   "Devices of the Simulator to send to, or status senders.", "count", "32");
+    QCommandLineOption addressOption(QStringList() << "a" << "address",
+                                     "Address of the Simulator, or of this Server for the senders.", "ip",
+                                     "127.0.0.1");
+    QCommandLineOption portOption(QStringList() << "p" << "base-port",
+                                  "Plan port of the first device, as given to the Simulator.", "port", "7000");
+    QCommandLineOption layerOption("layers", "Layers of every plan.", "count", "20");
+    QCommandLineOption spotOption("spots", "Spots of every layer.", "count", "500");
+    QCommandLineOption planOption("plans", "Plans per peer and round.", "count", "1");
+    QCommandLineOption roundOption(QStringList() << "r" << "rounds", "Rounds to run.", "count", "5");
+    QCommandLineOption multicastOption(QStringList() << "m" << "multicast",
+                                       "Send every plan once to the [Multicast] group of config.ini.");
+    QCommandLineOption copyOption("copy", "Copy every plan frame into one buffer instead of scatter-gather.");
+    QCommandLineOption receiveOption("receive-port", "Status port of this Server, as in [Receive] of config.ini.",
+                                     "port", "6667");
+    QCommandLineOption workerOption(QStringList() << "w" << "workers", "Most listener workers to measure.", "count",
+                                    QString::number(QThread::idealThreadCount()));
+    QCommandLineOption stepOption("step", "Seconds at every worker count.", "seconds", "10");
+    QCommandLineOption threadOption(QStringList() << "t" << "threads", "Most encoding threads to measure.", "count",
+                                    QString::number(QThread::idealThreadCount()));
+    QCommandLineOption repeatOption("repeat", "Encodes timed per format and thread count.", "count", "5");
+    parser.addOption(countOption);
+    parser.addOption(addressOption);
+    parser.addOption(portOption);
+    parser.addOption(layerOption);
+    parser.addOption(spotOption);
+    parser.addOption(planOption);
+    parser.addOption(roundOption);
+    parser.addOption(multicastOption);
+    parser.addOption(copyOption);
+    parser.addOption(receiveOption);
+    parser.addOption(workerOption);
+    parser.addOption(stepOption);
+    parser.addOption(threadOption);
+    parser.addOption(repeatOption);
+    parser.process(a);
+
+    QStringList mode = parser.positionalArguments();
+    int count = parser.value(countOption).toInt();
+    if (mode.size() != 1 || count <= 0)
+        parser.showHelp(1);
+
+    if (mode.at(0) == "status")
+    {
+        int workers = parser.value(workerOption).toInt();
+        int step = parser.value(stepOption).toInt();
+        if (workers <= 0 || step <= 0)
+            parser.showHelp(1);
+
+//  A debug line per status would measure the console
+        QLoggingCategory::setFilterRules("SERVER.debug=false");
+
+        StatusBench bench;
+        bench.createSenders(count, parser.value(addressOption), parser.value(receiveOption).toUShort());
+        bench.setMaxWorkers(workers);
+        bench.setStepDuration(step);
+
+        QObject::connect(&bench, SIGNAL(finished()), &a, SLOT(quit()));
+        QMetaObject::invokeMethod(&bench, "start", Qt::QueuedConnection);
+        return a.exec();
+    }
+
+    int layers = parser.value(layerOption).toInt();
+    int spots = parser.value(spotOption).toInt();
+    if (layers <= 0 || spots <= 0)
+        parser.showHelp(1);
+
+    if (mode.at(0) == "encode")
+    {
+        int threads = parser.value(threadOption).toInt();
+        int repeats = parser.value(repeatOption).toInt();
+        if (threads <= 0 || repeats <= 0)
+            parser.showHelp(1);
+
+        QLoggingCategory::setFilterRules("SERVER.debug=false");
+
+        EncodeBench bench;
+        bench.setPlanSize(layers, spots);
+        bench.setRepeatCount(repeats);
+        bench.run(threads);
+        return 0;
+    }
+
+    int plans = parser.value(planOption).toInt();
+    int rounds = parser.value(roundOption).toInt();
+    if (mode.at(0) != "peers" || plans <= 0 || rounds <= 0)
+        parser.showHelp(1);
+
+    PlanBench bench;
+    bench.createPeers(count, parser.value(addressOption), parser.value(portOption).toUShort());
+    bench.setPlanSize(layers, spots);
+    bench.setPlanCount(plans);
+    bench.setRoundCount(rounds);
+    bench.setMulticast(parser.isSet(multicastOption));
+    bench.setScatterGather(!parser.isSet(copyOption));
+
+    QObject::connect(&bench, SIGNAL(finished()), &a, SLOT(quit()));
+    QMetaObject::invokeMethod(&bench, "start", Qt::QueuedConnection);
+
+    return a.exec();
+}
@@ -0,0 +1,184 @@
+#include <QDebug>
+#include <QTimer>
+#include <QtMath>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#include "planbench.h"
+
+Q_LOGGING_CATEGORY(BENCH, "BENCH")
+
+PlanBench::PlanBench(QObject *parent) : QObject(parent),
+    m_planBytes(0), m_planCount(1), m_roundCount(1), m_multicast(false), m_round(0), m_pending(0), m_failed(0),
+    m_cpuAtStart(0)
+{
+    m_parameter.volt = VOLTAGE;
+    m_parameter.totalTime = SONICATIONTIME_DEFAULT;
+    m_parameter.period = SONICATIONPERIOD_DEFAULT;
+    m_parameter.dutyCycle = DUTYCYCLE_DEFAULT;
+    m_parameter.coolingTime = COOLINGTIME_DEFAULT;
+
+    connect(&m_server, SIGNAL(planCompleted(int)), this, SLOT(planCompleted(int)));
+    connect(&m_server, SIGNAL(planFailed(int,QString)), this, SLOT(planFailed(int,QString)));
+}
+
+void PlanBench::createPeers(int count, QString ipAddress, quint16 basePort)
+{
+    for (int i = 0; i < m_peers.size(); i++)
+        m_server.removePeer(m_peers.at(i));
+    m_peers.clear();
+
+    for (int i = 0; i < count; i++)
+    {
+        QString name = QString("sim%1").arg(i);
+        m_server.addPeer(name, ipAddress, quint16(basePort + i));
+        m_peers.append(name);
+    }
+}
+
+void PlanBench::setPlanSize(int layerCount, int spotCount)
+{
+    makePlan(layerCount, spotCount, m_spot3D, m_spotOrder);
+    m_planBytes = qint64(layerCount) * spotCount * (sizeof(Spot3DCoordinate) + sizeof(int));
+}
+
+// Layers 1 mm apart, spots on a 1 mm grid, sonicated in the order they are listed
+void PlanBench::makePlan(int layerCount, int spotCount, QHash<float, QList<Spot3DCoordinate> > &spot3D,
+                         QHash<float, QList<int> > &spotOrder)
+{
+    spot3D.clear();
+    spotOrder.clear();
+    int side = qMax(int(qSqrt(spotCount)), 1);
+    for (int i = 0; i < layerCount; i++)
+    {
+        float depth = float(i);
+        QList<Spot3DCoordinate> spots;
+        QList<int> order;
+        spots.reserve(spotCount);
+        order.reserve(spotCount);
+        for (int j = 0; j < spotCount; j++)
+        {
+            Spot3DCoordinate spot;
+            spot.x = j % side;
+            spot.y = j / side;
+            spot.z = depth;
+            spots.append(spot);
+            order.append(j);
+        }
+        spot3D.insert(depth, spots);
+        spotOrder.insert(depth, order);
+    }
+}
+
+void PlanBench::start()
+{
+    m_server.listen();    // The devices stream their status here as they would to a real Server
+    if (m_multicast && !m_server.isMulticastEnabled())
+        qCWarning(BENCH()) << BENCH().categoryName() << "[Multicast] is not enabled in config.ini, plans go by unicast.";
+
+    qCDebug(BENCH()) << BENCH().categoryName() << m_peers.size() << "peers," << m_planCount << "plans each per round,"
+                     << m_spot3D.size() << "layers," << m_planBytes / (1024 * 1024.0) << "MB per plan.";
+    m_round = 0;
+    startRound();
+}
+
+void PlanBench::startRound()
+{
+    m_round += 1;
+    m_pending = m_peers.size() * m_planCount;
+    m_failed = 0;
+    m_clock.start();
+    m_cpuAtStart = processTime();
+
+//  Queued all at once, so the peers' pipelines run side by side
+    for (int i = 0; i < m_planCount; i++)
+    {
+        QList<int> planIds;
+        if (m_multicast)
+        {
+            planIds = m_server.multicastPlan(m_peers, m_spot3D, m_spotOrder, m_parameter);
+        }
+        else
+        {
+            for (int j = 0; j < m_peers.size(); j++)
+                planIds.append(m_server.queuePlan(m_peers.at(j), m_spot3D, m_spotOrder, m_parameter));
+        }
+        for (int j = 0; j < planIds.size(); j++)
+        {
+            if (planIds.at(j) < 0)
+            {
+                m_failed += 1;
+                finishPlan();
+            }
+        }
+    }
+}
+
+void PlanBench::planCompleted(int planId)
+{
+    Q_UNUSED(planId);
+    finishPlan();
+}
+
+void PlanBench::planFailed(int planId, QString errorString)
+{
+    qCWarning(BENCH()) << BENCH().categoryName() << "Plan" << planId << "failed:" << errorString;
+    m_failed += 1;
+    finishPlan();
+}
+
+void PlanBench::finishPlan()
+{
+    if (m_pending <= 0 || --m_pending > 0)
+        return;
+
+    double seconds = m_clock.nsecsElapsed() / 1e9;
+    double cpu = processTime() - m_cpuAtStart;
+    int plans = m_peers.size() * m_planCount - m_failed;
+    double gigabytes = plans * m_planBytes / (1024 * 1024 * 1024.0);
+    qCDebug(BENCH()) << BENCH().categoryName() << "Round" << m_round << ":" << plans << "plans in" << seconds << "s,"
+                     << plans / seconds << "plans/s," << gigabytes * 1024 / seconds << "MB/s,"
+                     << (gigabytes > 0 ? cpu / gigabytes : 0) << "CPU s per GB," << m_failed << "failed.";
+    if (m_multicast)
+        reportMulticast();
+
+    if (m_round < m_roundCount)
+        QTimer::singleShot(0, this, SLOT(startRound()));
+    else
+        emit finished();
+}
+
+// Since start, against what the same plans would have cost by unicast
+void PlanBench::reportMulticast()
+{
+    MulticastStats stats = m_server.getMulticastStats();
+    double sent = (stats.bytesSent + stats.fallbackBytes) / (1024 * 1024.0);
+    double unicast = stats.unicastBytes / (1024 * 1024.0);
+    qCDebug(BENCH()) << BENCH().categoryName() << stats.transfers << "transfers:" << sent << "MB sent with"
+                     << stats.repairDatagrams << "repairs and" << stats.fallbacks << "fallbacks," << unicast
+                     << "MB by unicast (x" << (sent > 0 ? unicast / sent : 0) << ")," << stats.failedTransfers
+                     << "transfers failed.";
+}
+
+// User and system time of this process in s, every thread included; -1 where unknown
+double PlanBench::processTime()
+{
+#if defined(Q_OS_WIN)
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        quint64 kernelTime = (quint64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+        quint64 userTime = (quint64(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+        return (kernelTime + userTime) / 1e7;    // 100 ns units
+    }
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+    return -1;
+}
@@ -0,0 +1,70 @@
+#ifndef PLANBENCH_H
+#define PLANBENCH_H
+
+#include <QObject>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+#include "server.h"
+
+Q_DECLARE_LOGGING_CATEGORY(BENCH)
+
+//  Plan throughput of a Server in this process against the devices of a
+//  Simulator: every round queues the plans of all peers at once and is
+//  reported, when the last receipt or failure is in, as plans and raw plan
+//  megabytes per second, with the CPU time of this process per gigabyte.
+//  The first round also pays for the negotiation.
+//  With multicast every plan goes once to the [Multicast] group for all
+//  peers, and the bytes on the wire are reported against N unicasts.
+class PlanBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    PlanBench(QObject *parent = 0);
+
+    // count peers named like the devices of Simulator, sim0 on basePort, sim1 on basePort + 1, ...
+    void createPeers(int count, QString ipAddress, quint16 basePort);
+    void setPlanSize(int layerCount, int spotCount);    // spotCount spots in every layer
+    inline void setPlanCount(int planCount) { m_planCount = planCount; }    // Per peer and round
+    inline void setRoundCount(int roundCount) { m_roundCount = roundCount; }
+    inline void setMulticast(bool enabled) { m_multicast = enabled; }    // Needs [Multicast] enabled in config.ini
+    inline void setScatterGather(bool enabled) { m_server.setScatterGather(enabled); }    // Off copies every frame
+
+    static void makePlan(int layerCount, int spotCount, QHash<float, QList<Spot3DCoordinate> > &spot3D,
+                         QHash<float, QList<int> > &spotOrder);
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void startRound();
+    void planCompleted(int planId);
+    void planFailed(int planId, QString errorString);
+
+private:
+    Server m_server;
+    QStringList m_peers;
+
+    QHash<float, QList<Spot3DCoordinate> > m_spot3D;
+    QHash<float, QList<int> > m_spotOrder;
+    SpotSonicationParameter m_parameter;
+    qint64 m_planBytes;    // Coordinates and order of one plan, as the caller holds them
+
+    int m_planCount, m_roundCount;
+    bool m_multicast;
+    int m_round;
+    int m_pending, m_failed;    // Of the current round
+    QElapsedTimer m_clock;
+    double m_cpuAtStart;    // s of the process when the round started
+
+    void finishPlan();
+    void reportMulticast();
+    static double processTime();
+};
+
+#endif // PLANBENCH_H
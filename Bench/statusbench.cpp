@@ -0,0 +1,151 @@
+#include <QDebug>
+#include <QDateTime>
+
+#include "statusbench.h"
+#include "planbench.h"
+
+StatusSender::StatusSender(QString name, QString ipAddress, quint16 port, QObject *parent) : QThread(parent),
+    m_name(name), m_ipAddress(ipAddress), m_port(port), m_stopping(0), m_sent(0), m_errors(0)
+{
+    m_session = quint32(QDateTime::currentMSecsSinceEpoch()) ^ qHash(name);
+}
+
+// Runs on the sender's own thread until stop()
+void StatusSender::run()
+{
+    quint32 sequence = 0;
+    QHash<QString, QVariant> status;
+    status.insert("name", m_name);
+    status.insert("state", 1);
+    status.insert("temperature", 37.0);
+
+    while (!m_stopping.load())
+    {
+        status.insert("spot", int(sequence));
+
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << m_name << m_session << ++sequence << status;
+        QByteArray frame = encodeFrame(STATUS, payload, FRAME_SEQUENCE, 0);
+
+        QTcpSocket socket;
+        socket.connectToHost(m_ipAddress, m_port);
+        if (!socket.waitForConnected(SENDER_TIMEOUT))
+        {
+            m_errors.ref();
+            msleep(10);    // Listener restarting, or the backlog full
+            continue;
+        }
+        socket.write(frame);
+        if (!socket.waitForBytesWritten(SENDER_TIMEOUT))
+        {
+            m_errors.ref();
+            continue;
+        }
+        socket.disconnectFromHost();
+        if (socket.state() != QAbstractSocket::UnconnectedState)
+            socket.waitForDisconnected(SENDER_TIMEOUT);
+        m_sent.ref();
+    }
+}
+
+StatusBench::StatusBench(QObject *parent) : QObject(parent),
+    m_workerCount(0), m_maxWorkers(1), m_sentAtStart(0), m_errorsAtStart(0)
+{
+    m_stepTimer.setSingleShot(true);
+    m_stepTimer.setInterval(10000);
+    connect(&m_stepTimer, SIGNAL(timeout()), this, SLOT(finishStep()));
+}
+
+StatusBench::~StatusBench()
+{
+    for (int i = 0; i < m_senders.size(); i++)
+        m_senders.at(i)->stop();
+    for (int i = 0; i < m_senders.size(); i++)
+        m_senders.at(i)->wait();
+    qDeleteAll(m_senders);
+}
+
+// The senders' names are peers of the Server, so their statuses are applied and not dropped
+void StatusBench::createSenders(int count, QString ipAddress, quint16 port)
+{
+    for (int i = 0; i < count; i++)
+    {
+        QString name = QString("sender%1").arg(i);
+        m_server.addPeer(name, ipAddress, 0);
+        m_senders.append(new StatusSender(name, ipAddress, port));
+    }
+}
+
+void StatusBench::start()
+{
+    m_server.listen();
+    for (int i = 0; i < m_senders.size(); i++)
+        m_senders.at(i)->start();
+
+    qCDebug(BENCH()) << BENCH().categoryName() << m_senders.size() << "senders, 1 to" << m_maxWorkers << "workers,"
+                     << m_stepTimer.interval() / 1000 << "s each.";
+    m_workerCount = 1;
+    startStep();
+}
+
+void StatusBench::startStep()
+{
+//  The worker counters start from 0 with the new workers
+    m_server.setWorkerCount(m_workerCount);
+    m_sentAtStart = sentCount();
+    m_errorsAtStart = errorCount();
+    m_observersAtStart = m_server.getObserverStats();
+    m_clock.start();
+    m_stepTimer.start();
+}
+
+void StatusBench::finishStep()
+{
+    double seconds = m_clock.nsecsElapsed() / 1e9;
+    int frames = m_server.getStatusFrameCount();
+    int sent = sentCount() - m_sentAtStart;
+    qCDebug(BENCH()) << BENCH().categoryName() << m_workerCount << "workers:" << frames / seconds << "frames/s decoded,"
+                     << sent / seconds << "sent," << errorCount() - m_errorsAtStart << "send errors.";
+    if (m_server.isPublishingStatus())
+        reportObservers();
+
+    if (m_workerCount < m_maxWorkers)
+    {
+        m_workerCount += 1;
+        startStep();
+    }
+    else
+    {
+        emit finished();
+    }
+}
+
+// Of the step: fan-out cost per status, and what the observers got or lost
+void StatusBench::reportObservers()
+{
+    PublisherStats stats = m_server.getObserverStats();
+    qint64 published = stats.published - m_observersAtStart.published;
+    double fanout = published > 0 ? double(stats.fanoutTime - m_observersAtStart.fanoutTime) / published : 0;
+    qCDebug(BENCH()) << BENCH().categoryName() << stats.subscribers << "observers:" << fanout << "us fan-out per status,"
+                     << stats.delivered - m_observersAtStart.delivered << "frames delivered,"
+                     << stats.dropped - m_observersAtStart.dropped << "dropped,"
+                     << stats.overruns - m_observersAtStart.overruns << "statuses overrun.";
+}
+
+int StatusBench::sentCount() const
+{
+    int sent = 0;
+    for (int i = 0; i < m_senders.size(); i++)
+        sent += m_senders.at(i)->getSentCount();
+    return sent;
+}
+
+int StatusBench::errorCount() const
+{
+    int errors = 0;
+    for (int i = 0; i < m_senders.size(); i++)
+        errors += m_senders.at(i)->getErrorCount();
+    return errors;
+}
@@ -0,0 +1,82 @@
+#ifndef STATUSBENCH_H
+#define STATUSBENCH_H
+
+#include <QObject>
+#include <QThread>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "server.h"
+
+#define SENDER_TIMEOUT 1000    // ms to connect or write before a status counts as an error
+
+//  Sends sequenced full statuses as fast as it can, each on its own
+//  connection like a Client does.
+class StatusSender : public QThread
+{
+    Q_OBJECT
+
+public:
+    StatusSender(QString name, QString ipAddress, quint16 port, QObject *parent = 0);
+
+    inline void stop() { m_stopping.store(1); }
+    inline int getSentCount() const { return m_sent.load(); }
+    inline int getErrorCount() const { return m_errors.load(); }
+
+protected:
+    void run();
+
+private:
+    QString m_name;
+    QString m_ipAddress;
+    quint16 m_port;
+    quint32 m_session;
+    QAtomicInt m_stopping;
+    QAtomicInt m_sent;
+    QAtomicInt m_errors;
+};
+
+//  Status frames per second a Server in this process decodes with 1 to
+//  maxWorkers listener workers, loaded by the senders for a fixed time at
+//  every worker count. With [Observers] enabled the fan-out of every step
+//  to the subscribed observers is reported too.
+class StatusBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    StatusBench(QObject *parent = 0);
+    ~StatusBench();
+
+    // count senders to the Server's [Receive] port, each a peer of its own
+    void createSenders(int count, QString ipAddress, quint16 port);
+    inline void setMaxWorkers(int workerCount) { m_maxWorkers = workerCount; }
+    inline void setStepDuration(int seconds) { m_stepTimer.setInterval(seconds * 1000); }
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void finishStep();
+
+private:
+    Server m_server;
+    QList<StatusSender *> m_senders;
+
+    int m_workerCount, m_maxWorkers;
+    QTimer m_stepTimer;
+    QElapsedTimer m_clock;
+    int m_sentAtStart, m_errorsAtStart;    // Over all senders when the step started
+    PublisherStats m_observersAtStart;
+
+    void startStep();
+    void reportObservers();
+    int sentCount() const;
+    int errorCount() const;
+};
+
+#endif // STATUSBENCH_H
@@ -8,6 +8,8 @@ QT       += network
 
 QT       -= gui
 
+CONFIG   += c++11
+
 TARGET = Client
 TEMPLATE = lib
 
@@ -15,10 +17,22 @@ DEFINES += CLIENT_LIBRARY
 
 INCLUDEPATH += ../lib/common
 
-SOURCES += client.cpp
+SOURCES += client.cpp \
+        planarena.cpp \
+        statusrate.cpp \
+        schedulerunner.cpp \
+        timeline.cpp \
+        planvalidator.cpp \
+        multicastreceiver.cpp
 
 HEADERS += client.h\
-        client_global.h
+        client_global.h \
+        planarena.h \
+        statusrate.h \
+        schedulerunner.h \
+        timeline.h \
+        planvalidator.h \
+        multicastreceiver.h
 
 unix {
     target.path = /usr/lib
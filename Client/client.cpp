@@ -1,17 +1,49 @@
 #include <QDebug>
 #include <QHostInfo>
+#include <QElapsedTimer>
+
+#include <algorithm>
 
 #include "client.h"
+#include "parallel.h"
 
 Q_LOGGING_CATEGORY(CLIENT, "CLIENT")
 
-Client::Client(QObject *parent): QObject(parent), m_totalBytes(0)
+Client::Client(QObject *parent): QObject(parent), m_totalBytes(0),
+    m_spot3DBuilt(false), m_spotOrderBuilt(false), m_layers(0), m_layerCount(0),
+    m_statusCount(0), m_statusSequence(0), m_peerVersion(0), m_peerCapabilities(0),
+    m_planSequence(0), m_coordinateLimit(0), m_arrivalTime(0), m_lastLatency(NO_TIMESTAMP),
+    m_multicastPort(0), m_announcedTransfer(0), m_nackRounds(0), m_lastRemaining(-1), m_commandSession(0),
+    m_recorder(TRACE_CLIENT)
 {
 // Initialize variables and connections
+    m_planStats.plans = 0;
+    m_planStats.spots = 0;
+    m_planStats.decodeTime = 0;
+    m_planStats.allocations = 0;
+    m_planStats.arenaBytes = 0;
+    m_planStats.validateTime = 0;
+    m_statusSession = quint32(QDateTime::currentMSecsSinceEpoch()) ^ quint32(QCoreApplication::applicationPid());
     m_sendSocket = new QTcpSocket(this);
     m_receiveSocket = new QTcpSocket(this);
+    connect(m_sendSocket, SIGNAL(connected()), this, SLOT(statusConnected()));
+    connect(&m_schedule, SIGNAL(fire(int)), this, SLOT(runCommand(int)));
+
+    m_statusTimer.setSingleShot(true);
+    connect(&m_statusTimer, SIGNAL(timeout()), this, SLOT(statusTick()));
+
+    connect(&m_multicast, SIGNAL(transferComplete(quint32)), this, SLOT(multicastComplete(quint32)));
+    m_nackTimer.setSingleShot(true);
+    m_nackTimer.setInterval(MULTICAST_NACK_DELAY);
+    connect(&m_nackTimer, SIGNAL(timeout()), this, SLOT(nackTimeout()));
+
+    m_session.spotIndex = 0;
+    m_session.periodIndex = 0;
+    m_recorder.registerPeer("server");
 
     readSettings();
+    if (m_store.isOpen())
+        restorePlan();
 }
 
 Client::~Client()
@@ -37,6 +69,9 @@ void Client::listen()
     }
     qDebug() << "Listen OK";
 
+    if (!m_multicastGroup.isEmpty())
+        m_multicast.join(m_multicastGroup, m_multicastPort);
+
     connect(&m_server, SIGNAL(newConnection()) ,
             this, SLOT(acceptConnection()));    // Send newConnection() signal when a new connection is detected
 }
@@ -48,7 +83,23 @@ void Client::readSettings()
     m_receivePort = settings->value("Receive/Port").toString().toUShort(0,10);
     m_sendIpAddress = settings->value("Send/IpAddress").toString();
     m_sendPort = settings->value("Send/Port").toString().toUShort(0,10);
+    QString captureFile = settings->value("Capture/File").toString();
+    m_coordinateLimit = settings->value("Validation/CoordinateLimit", 0).toDouble();
+    m_statusRate.setBounds(settings->value("Status/MinInterval", 50).toInt(),
+                           settings->value("Status/MaxInterval", 1000).toInt());
+    QString storeDirectory = settings->value("Store/Directory").toString();
+    int storeCapacity = settings->value("Store/Capacity", 4).toInt();
+    m_recorder.setCapacity(settings->value("Recorder/Capacity", FLIGHT_CAPACITY).toInt());
+    m_flightDirectory = settings->value("Recorder/Directory", "..").toString();
+    m_multicastGroup = settings->value("Multicast/Group").toString();
+    m_multicastPort = settings->value("Multicast/Port", 6668).toString().toUShort(0,10);
     delete settings;
+
+    if (!storeDirectory.isEmpty() && !m_store.open(storeDirectory, storeCapacity))
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Plan store" << storeDirectory << "could not be opened";
+
+    if (!captureFile.isEmpty())
+        startCapture(captureFile);
 }
 
 void Client::updateSettings()
@@ -65,9 +116,13 @@ void Client::updateSettings()
 void Client::acceptConnection()
 {
     m_receiveSocket = m_server.nextPendingConnection();
+    m_recorder.record(FLIGHT_CONNECT, 0, 0, 0, m_receiveSocket->peerPort());
     connect(m_receiveSocket, SIGNAL(readyRead()), this, SLOT(readHeader()));
     connect(m_receiveSocket, SIGNAL(error(QAbstractSocket::SocketError)),
             this, SLOT(displayError(QAbstractSocket::SocketError)));
+//  Every hello, sync and command opens a connection, none may outlive it.
+//  Deferred, so the frame being handled can still close its socket.
+    connect(m_receiveSocket, SIGNAL(disconnected()), m_receiveSocket, SLOT(deleteLater()));
 
     qDebug() << "Accept connection OK";
 }
@@ -93,21 +148,95 @@ QString Client::getLocalIP()
 // Error display
 void Client::displayError(QAbstractSocket::SocketError)
 {
-    qCWarning(CLIENT()) << CLIENT().categoryName() << ":" << m_server.errorString();
+    QAbstractSocket *socket = qobject_cast<QAbstractSocket *>(sender());
+    QString errorString = socket ? socket->errorString() : m_server.errorString();
+    m_recorder.record(FLIGHT_SOCKET_ERROR, socket ? socket->error() : m_server.serverError(), 0);
+    qCWarning(CLIENT()) << CLIENT().categoryName() << ":" << errorString;
+    emit networkError(errorString);
+}
+
+// Bytes of the frame at the head of buffer, 0 while more are needed, -1 when it is no frame
+static qint64 frameLength(const QByteArray &buffer)
+{
+    QDataStream in(buffer);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    qint64 header, totalBytes;
+    in >> header;
+    if (in.status() != QDataStream::Ok)
+        return 0;
+    if ((header & HEADER_V2) || header == PLAN)
+    {
+        in >> totalBytes;    // Covers the whole frame
+        if (in.status() != QDataStream::Ok)
+            return 0;
+        if (totalBytes < 2 * qint64(sizeof(qint64)))
+            return -1;
+        return buffer.size() >= totalBytes ? totalBytes : 0;
+    }
+    if (header == COMMAND)
+        return buffer.size() >= 2 * qint64(sizeof(qint64)) ? 2 * qint64(sizeof(qint64)) : 0;
+    if (header == HELLO)
+    {
+        Hello hello;
+        decodeHello(in, hello);
+        return in.status() == QDataStream::ReadPastEnd ? 0 : in.device()->pos();
+    }
+    return -1;
 }
 
 void Client::readHeader()
 {
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (socket)
+        m_receiveSocket = socket;    // Answer on the connection that spoke, another may have opened since
+
+//  Pipelined commands arrive back to back on one connection
+    while (m_receiveSocket->isOpen() && readFrame())
+        ;
+}
+
+// Decode the frame at the head of the socket, false while it is not complete
+bool Client::readFrame()
+{
+//  Nothing is decoded before the whole frame is in, a slow link delivers it in pieces
+    if (!m_receiveSocket->property("arrivalTime").isValid())
+        m_receiveSocket->setProperty("arrivalTime", sessionTime());
+    QByteArray baFrame = m_receiveSocket->peek(m_receiveSocket->bytesAvailable());
+    qint64 length = frameLength(baFrame);
+    if (length == 0)
+        return false;
+    m_arrivalTime = m_receiveSocket->property("arrivalTime").toLongLong();
+    m_receiveSocket->setProperty("arrivalTime", QVariant());
+    if (length < 0)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Unknown frame dropped.";
+        recordError(PLAN_MALFORMED, -1);
+        m_receiveSocket->abort();
+        return false;
+    }
+
     QDataStream in(m_receiveSocket);
     in.setVersion(QDataStream::Qt_4_6);
 
-//  test the signal of readyRead
-//    qDebug() << "Ready read...";
     qint64 header;
     qCDebug(CLIENT()) << CLIENT().categoryName() << "Reading header...";
 
+    QDataStream peekIn(baFrame);
+    peekIn.setVersion(QDataStream::Qt_4_6);
+    peekIn >> header;
+    m_recorder.record(FLIGHT_FRAME_IN, int(header & HEADER_MASK), 0, length);
+    if (m_trace.isOpen())
+        m_trace.write(TRACE_IN, int(header & HEADER_MASK), baFrame.left(int(length)));
+
     in >> header;
 
+    if (header & HEADER_V2)
+    {
+        receiveFrame(int(header & HEADER_MASK), length);
+        return true;
+    }
+
     switch (header) {
     case COMMAND:
         receiveCommand();
@@ -115,9 +244,13 @@ void Client::readHeader()
     case PLAN:
         receivePlan();
         break;
+    case HELLO:
+        receiveHello();
+        break;
     default:
         break;
     }
+    return true;
 }
 
 // Variables initialization
@@ -128,6 +261,15 @@ void Client::initVar()
     m_hashZ.clear();
     m_spot3D.clear();
     m_spotOrder.clear();
+    m_spot3DBuilt = false;
+    m_spotOrderBuilt = false;
+    m_layers = 0;
+    m_layerCount = 0;
+    m_store.unmap();
+    m_planSequence = 0;
+    m_session.spotIndex = 0;
+    m_session.periodIndex = 0;
+    m_timeline.clear();
     m_parameter.volt = 0;
     m_parameter.totalTime = 0;
     m_parameter.period = 0;
@@ -149,17 +291,8 @@ void Client::receivePlan()
     qCDebug(CLIENT()) << CLIENT().categoryName() << "Receiving plan...";
     QString receipt;
 
-    in >> m_totalBytes
-       >> m_hashX
-       >> m_hashY
-       >> m_hashZ
-       >> m_spotOrder
-       >> m_parameter.volt
-       >> m_parameter.totalTime
-       >> m_parameter.period
-       >> m_parameter.dutyCycle
-       >> m_parameter.coolingTime
-       >> receipt;
+    in >> m_totalBytes;
+    readPlan(in, receipt);
 
     qDebug() << "m_totalBytes:" << m_totalBytes;
     qDebug() << "m_hashX:" << m_hashX;
@@ -172,12 +305,188 @@ void Client::receivePlan()
 
     qCDebug(CLIENT()) << CLIENT().categoryName() << "Receiving plan finished.";
 
+    PlanError error;
+    bool decoded = readHashes(in, error);
+    finishPlan(receipt, decoded, error);
+}
+
+// Legacy hashes are checked before they are converted, a mismatch would index past a list
+bool Client::readHashes(QDataStream &in, PlanError &error)
+{
+    if (in.status() != QDataStream::Ok)
+    {
+        error.code = PLAN_MALFORMED;
+        error.layer = -1;
+        error.index = -1;
+        error.message = "Plan could not be decoded.";
+        return false;
+    }
+    LayerIndex<QList<Coordinate> > layersX(m_hashX), layersY(m_hashY), layersZ(m_hashZ);
+    if (!PlanValidator::checkLayers(layersX, layersY, layersZ, error))
+        return false;
+    convertSpot(layersX, layersY, layersZ, LayerIndex<QList<int> >(m_spotOrder));
+    return true;
+}
+
+// Validate the decoded plan, then answer with the receipt or with the reason it was refused
+void Client::finishPlan(const QString &receipt, bool decoded, PlanError error)
+{
+    if (decoded)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        decoded = PlanValidator::check(m_layers, m_layerCount, m_parameter, m_coordinateLimit, &m_pool, error);
+
+        qint64 validateTime = timer.nsecsElapsed() / 1000;
+        m_planStats.validateTime += validateTime;
+
+        qint64 spotCount = 0;
+        for (int i = 0; i < m_layerCount; i++)
+            spotCount += m_layers[i].spotCount;
+        qCDebug(CLIENT()) << CLIENT().categoryName() << "Validated" << spotCount << "spots in" << validateTime << "us";
+    }
+
+    if (!decoded)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Plan rejected:" << error.message;
+        recordError(error.code, error.layer);
+        replyReject(receipt, error);
+        initVar();
+        emit planRejected(error.message);
+        return;
+    }
+
+    replyReceipt(receipt);
+    compileTimeline();
+    storePlan();
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "RECEIVING TREATMENT PLAN SUCCEEDED.";
+    qDebug() << SEPERATOR;
+    emit receivingCompleted();
+}
+
+// Plan body shared by the legacy format and version 2 frames without SoA
+void Client::readPlan(QDataStream &in, QString &receipt)
+{
+    in >> m_hashX
+       >> m_hashY
+       >> m_hashZ
+       >> m_spotOrder
+       >> m_parameter
+       >> receipt;
+}
+
+// Pointer to the next size bytes of the buffer behind the stream, which are skipped
+static const char *rawData(QDataStream &in, const QByteArray &payload, qint64 size)
+{
+    qint64 position = in.device()->pos();
+    if (in.status() != QDataStream::Ok || position + size > payload.size())
+        return 0;
+    in.skipRawData(int(size));
+    return payload.constData() + position;
+}
+
+static inline bool layerBefore(const PlanLayer &a, const PlanLayer &b)
+{
+    return a.depth < b.depth;
+}
+
+// Structure-of-arrays plan, decoded from the received buffer straight into the arena
+bool Client::readPlanSoA(QDataStream &in, const QByteArray &payload, QString &receipt)
+{
+    QElapsedTimer timer;
+    timer.start();
+    int allocationCount = m_arena.allocationCount();
+
+    quint32 layerCount;
+    in >> layerCount;
+    if (in.status() != QDataStream::Ok || layerCount > quint32(payload.size()))
+        return false;
+
+//  The payload carries every coordinate and order index, so it bounds the decoded plan
+    m_arena.reset(payload.size() + qint64(layerCount) * (sizeof(PlanLayer) + 4 * sizeof(const char *) + 16) + 64);
+    PlanLayer *layers = m_arena.allocate<PlanLayer>(layerCount);
+    const char **sources = m_arena.allocate<const char *>(qint64(layerCount) * 4);
+
+    for (quint32 i = 0; i < layerCount; i++)
+    {
+        PlanLayer &layer = layers[i];
+        quint32 count[4];
+        in >> layer.depth;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            in >> count[axis];
+            sources[4 * i + axis] = rawData(in, payload, qint64(count[axis]) * sizeof(Coordinate));
+            if (!sources[4 * i + axis])
+                return false;
+        }
+        in >> count[3];
+        sources[4 * i + 3] = rawData(in, payload, qint64(count[3]) * sizeof(qint32));
+        if (!sources[4 * i + 3] || count[0] != count[1] || count[0] != count[2])
+            return false;
+
+        layer.spotCount = int(count[0]);
+        layer.spots = m_arena.allocate<Spot3DCoordinate>(layer.spotCount);
+        layer.orderCount = int(count[3]);
+        layer.order = m_arena.allocate<int>(layer.orderCount);
+    }
+
+    parallelFor(&m_pool, int(layerCount), [&](int i) {
+        PlanLayer &layer = layers[i];
+        const char *x = sources[4 * i];
+        const char *y = sources[4 * i + 1];
+        const char *z = sources[4 * i + 2];
+        for (int j = 0; j < layer.spotCount; j++)
+        {
+            layer.spots[j].x = coordinateAt(x, j);
+            layer.spots[j].y = coordinateAt(y, j);
+            layer.spots[j].z = coordinateAt(z, j);
+        }
+        for (int j = 0; j < layer.orderCount; j++)
+            layer.order[j] = orderAt(sources[4 * i + 3], j);
+    });
+
+    in >> m_parameter
+       >> receipt;
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+//  Servers send the layers in depth order, anything else is sorted once here
+    if (!std::is_sorted(layers, layers + layerCount, layerBefore))
+        std::sort(layers, layers + layerCount, layerBefore);
+
+    m_layers = layers;
+    m_layerCount = int(layerCount);
+    countDecode(timer.nsecsElapsed() / 1000, m_arena.allocationCount() - allocationCount);
+    return true;
+}
+
+// Every decode path ends here once the layers are in the arena
+void Client::countDecode(qint64 decodeTime, int allocations)
+{
+    qint64 spotCount = 0;
+    for (int i = 0; i < m_layerCount; i++)
+        spotCount += m_layers[i].spotCount;
+    m_planStats.plans += 1;
+    m_planStats.spots += spotCount;
+    m_planStats.decodeTime += decodeTime;
+    m_planStats.allocations += allocations;
+    m_planStats.arenaBytes += m_arena.used();
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Decoded" << m_layerCount << "layers," << spotCount << "spots into"
+                      << m_arena.used() << "arena bytes with" << allocations << "heap allocations in" << decodeTime << "us";
+}
+
+// Send the receipt back and close the session
+void Client::replyReceipt(const QString &receipt)
+{
     QDataStream out(&m_baOut, QIODevice::WriteOnly);
     out.setVersion(QDataStream::Qt_4_6);
 
     qCDebug(CLIENT()) << CLIENT().categoryName() << "Sending receipt...";
 
     out << receipt;
+    traceFrame(TRACE_OUT, TRACE_RECEIPT, m_baOut);
 
 //  If need to print bytesWritten information, un-comment the line below
 //    connect(m_tcpClientConnection, SIGNAL(bytesWritten(qint64)), this, SLOT(bytes(qint64)));
@@ -187,46 +496,578 @@ void Client::receivePlan()
 
     qDebug() << "Send receipt finished.";
     qDebug() << SEPERATOR;
+}
 
-    convertSpot();
+// Refusal instead of the receipt; a legacy server only sees a receipt that does not match
+void Client::replyReject(const QString &receipt, const PlanError &error)
+{
+    if (m_peerVersion >= PROTOCOL_VERSION)
+    {
+        m_baOut = encodeReject(receipt, error, m_peerCapabilities);
+    }
+    else
+    {
+        QDataStream out(&m_baOut, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << QString();
+    }
+    traceFrame(TRACE_OUT, REJECT, m_baOut);
+    m_receiveSocket->write(m_baOut);
+    m_receiveSocket->close();
+}
 
-    qCDebug(CLIENT()) << CLIENT().categoryName() << "RECEIVING TREATMENT PLAN SUCCEEDED.";
-    qDebug() << SEPERATOR;
-    emit receivingCompleted();
+// Version 2 frame of length bytes, the header has already been read
+void Client::receiveFrame(int type, qint64 length)
+{
+    handleFrame(type, m_receiveSocket->read(length - sizeof(qint64)));
 }
 
-// Convert the spots information to standard form
-void Client::convertSpot()
+// Frame without its header, from the socket or collected from the multicast group
+void Client::handleFrame(int type, const QByteArray &baBuffer)
 {
-    QHash<float, QList<Coordinate> >::iterator i;
-    for (i = m_hashX.begin(); i != m_hashX.end(); ++i)
+    QDataStream in(baBuffer);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    quint32 flags;
+    QByteArray payload;
+    qint64 timestamp;
+    if (!decodeFrame(in, m_totalBytes, flags, payload, &timestamp))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Corrupted frame dropped.";
+        recordError(PLAN_MALFORMED, -1);
+        m_receiveSocket->close();
+        return;
+    }
+
+//  Stamps are server time, ours is turned into server time with the last estimate
+    if (timestamp != NO_TIMESTAMP && m_clock.isValid())
+    {
+        m_lastLatency = m_clock.remoteTime(m_arrivalTime) - timestamp;
+        emit frameLatency(type, m_lastLatency);
+    }
+
+    QDataStream payloadIn(payload);
+    payloadIn.setVersion(QDataStream::Qt_4_6);
+
+    switch (type) {
+    case PLAN:
+    {
+        qCDebug(CLIENT()) << CLIENT().categoryName() << "Receiving plan...";
+        initVar();
+        QString receipt;
+        PlanError error;
+        bool decoded;
+        if (flags & FRAME_SOA)
+        {
+            decoded = readPlanSoA(payloadIn, payload, receipt);
+            if (!decoded)
+            {
+                error.code = PLAN_MALFORMED;
+                error.layer = -1;
+                error.index = -1;
+                error.message = "Malformed SoA plan.";
+            }
+        }
+        else
+        {
+            readPlan(payloadIn, receipt);
+            decoded = readHashes(payloadIn, error);
+        }
+        finishPlan(receipt, decoded, error);
+        break;
+    }
+    case COMMAND:
+    {
+        if (payload.size() > int(sizeof(qint64)))
+        {
+            receiveAckedCommand(payloadIn);
+            break;
+        }
+        qint64 command;
+        payloadIn >> command;
+        m_receiveSocket->close();
+        runCommand(int(command));
+        break;
+    }
+    case SYNC:
+        replySync(payloadIn);
+        break;
+    case SCHEDULE:
     {
-        float currentKey = i.key();
-        QList<Coordinate> currentListX = i.value();
-        QList<Coordinate> currentListY = m_hashY[currentKey];
-        QList<Coordinate> currentListZ = m_hashZ[currentKey];
-        int currentlistSize = currentListX.size();
-        for (int x = 0; x < currentlistSize; x++)
+        qint64 startDelay;
+        QVector<ScheduledCommand> schedule;
+        payloadIn >> startDelay >> schedule;
+        PlanError error;
+        if (payloadIn.status() != QDataStream::Ok)
         {
-            Spot3DCoordinate currentSpot;
-            currentSpot.x = currentListX.at(x);
-            currentSpot.y = currentListY.at(x);
-            currentSpot.z = currentListZ.at(x);
-            m_spot3D[currentKey].append(currentSpot);
+            qCWarning(CLIENT()) << CLIENT().categoryName() << "Malformed schedule dropped.";
+            error.code = PLAN_SCHEDULE;
+            error.layer = -1;
+            error.index = -1;
+            error.message = "Malformed schedule.";
+            replyReject(QString(), error);
+            return;
         }
+        if (!m_schedule.start(startDelay, schedule, &error))
+        {
+            replyReject(QString(), error);
+            return;
+        }
+        m_receiveSocket->close();
+        break;
+    }
+    case ANNOUNCE:
+        receiveAnnounce(payloadIn);
+        break;
+    default:
+        m_receiveSocket->close();
+        break;
     }
+}
+
+// Run a sequenced command once and answer on its connection, which stays open for the next.
+// A retransmission is answered from the history without running the command again.
+void Client::receiveAckedCommand(QDataStream &in)
+{
+    CommandAck ack;
+    qint64 command;
+    in >> ack.session >> ack.sequence >> command;
+    if (in.status() != QDataStream::Ok)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Malformed command dropped.";
+        m_receiveSocket->close();
+        return;
+    }
+
+    if (ack.session != m_commandSession)
+    {
+        m_commandSession = ack.session;
+        m_commandResults.clear();
+        m_commandHistory.clear();
+    }
+
+    QHash<quint32, qint32>::const_iterator done = m_commandResults.constFind(ack.sequence);
+    ack.duplicate = (done != m_commandResults.constEnd());
+    if (ack.duplicate)
+    {
+        ack.result = done.value();
+        qCDebug(CLIENT()) << CLIENT().categoryName() << "Command" << ack.sequence << "repeated, not run again.";
+    }
+    else
+    {
+        ack.result = runCommand(int(command));
+        m_commandResults.insert(ack.sequence, ack.result);
+        m_commandHistory.enqueue(ack.sequence);
+        if (m_commandHistory.size() > COMMAND_HISTORY)
+            m_commandResults.remove(m_commandHistory.dequeue());
+    }
+
+    m_recorder.record(FLIGHT_ACK, ack.result, 0, 0, ack.sequence);
+    QByteArray baBlock = encodeAck(ack, m_peerCapabilities);
+    if (m_clock.isValid())
+        stampFrame(baBlock, m_clock.remoteTime(sessionTime()));
+    traceFrame(TRACE_OUT, ACK, baBlock);
+    m_receiveSocket->write(baBlock);
+}
+
+// The plan comes by the multicast group, the connection stays open for the NACKs and the receipt
+void Client::receiveAnnounce(QDataStream &in)
+{
+    quint32 transfer, count, frameBytes;
+    in >> transfer >> count >> frameBytes;
+    if (in.status() != QDataStream::Ok)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Malformed announce dropped.";
+        m_receiveSocket->close();
+        return;
+    }
+
+    m_nackTimer.stop();
+    m_announceSocket = m_receiveSocket;
+    if (!m_multicast.isJoined() || frameBytes > MULTICAST_MAX_FRAME || count != quint32(chunkCount(frameBytes)))
+    {
+        sendNack(transfer, QVector<quint32>());    // The frame follows on this connection
+        return;
+    }
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Collecting transfer" << transfer << "of" << count << "chunks...";
+    m_announcedTransfer = transfer;
+    m_nackRounds = 0;
+    if (m_multicast.announce(transfer, count, frameBytes))
+    {
+        multicastComplete(transfer);
+        return;
+    }
+    m_lastRemaining = m_multicast.remaining(transfer);
+    m_nackTimer.start();
+}
+
+// Transfers not announced yet stay buffered for their announce
+void Client::multicastComplete(quint32 transfer)
+{
+    if (m_announcedTransfer == 0 || transfer != m_announcedTransfer)
+        return;
+    m_nackTimer.stop();
+    m_announcedTransfer = 0;
+
+    QByteArray baFrame = m_multicast.take(transfer);
+    if (!m_announceSocket || m_announceSocket->state() != QAbstractSocket::ConnectedState)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Connection of transfer" << transfer << "closed.";
+        return;
+    }
+    m_receiveSocket = m_announceSocket;
+    m_arrivalTime = sessionTime();
+
+    qint64 header = qFromBigEndian<qint64>(reinterpret_cast<const uchar *>(baFrame.constData()));
+    m_recorder.record(FLIGHT_FRAME_IN, int(header & HEADER_MASK), 0, baFrame.size());
+    if (m_trace.isOpen())
+        m_trace.write(TRACE_IN, int(header & HEADER_MASK), baFrame);
+    if (baFrame.size() < 2 * int(sizeof(qint64)) || header != (PLAN | HEADER_V2))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Transfer" << transfer << "is no plan.";
+        recordError(PLAN_MALFORMED, -1);
+        m_receiveSocket->close();
+        return;
+    }
+    handleFrame(PLAN, baFrame.mid(sizeof(qint64)));
+}
+
+// Ask again for the chunks still missing once they stop coming, after MULTICAST_NACK_ROUNDS for the whole frame
+void Client::nackTimeout()
+{
+    quint32 transfer = m_announcedTransfer;
+    if (transfer == 0)
+        return;
+    if (!m_announceSocket || m_announceSocket->state() != QAbstractSocket::ConnectedState)
+    {
+        m_multicast.drop(transfer);
+        m_announcedTransfer = 0;
+        return;
+    }
+
+    int remaining = m_multicast.remaining(transfer);
+    if (remaining > 0 && remaining < m_lastRemaining)
+    {
+        m_lastRemaining = remaining;    // Still coming
+        m_nackTimer.start();
+        return;
+    }
+
+    if (remaining < 0 || m_nackRounds >= MULTICAST_NACK_ROUNDS)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Transfer" << transfer << "incomplete, taken by unicast.";
+        m_multicast.drop(transfer);
+        m_announcedTransfer = 0;
+        sendNack(transfer, QVector<quint32>());
+        return;
+    }
+
+    m_nackRounds += 1;
+    m_lastRemaining = remaining;
+    sendNack(transfer, m_multicast.missing(transfer));
+    m_nackTimer.start();
+}
+
+void Client::sendNack(quint32 transfer, const QVector<quint32> &missing)
+{
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "NACK of transfer" << transfer << "," << missing.size() << "chunks.";
+    QByteArray baBlock = encodeNack(transfer, missing, m_peerCapabilities);
+    traceFrame(TRACE_OUT, NACK, baBlock);
+    m_announceSocket->write(baBlock);
+}
+
+// The request carries t1 and the server's estimate of our offset, the reply t1, t2 and t3
+void Client::replySync(QDataStream &in)
+{
+    qint64 t1, offset, delay;
+    double drift;
+    in >> t1 >> offset >> drift >> delay;
+    if (in.status() != QDataStream::Ok)
+    {
+        m_receiveSocket->close();
+        return;
+    }
+    if (offset != NO_TIMESTAMP)
+        m_clock.setEstimate(-offset, -drift, m_arrivalTime, delay);
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << t1
+        << m_arrivalTime
+        << sessionTime();
+
+    QByteArray baBlock = encodeFrame(SYNC, payload, 0, 0);
+    traceFrame(TRACE_OUT, SYNC, baBlock);
+    m_receiveSocket->write(baBlock);
+    m_receiveSocket->close();
+}
+
+// Answer the server's hello with our version and capabilities
+void Client::receiveHello()
+{
+    QDataStream in(m_receiveSocket);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    Hello hello;
+    if (decodeHello(in, hello))
+    {
+        m_peerVersion = qMin(int(hello.version), PROTOCOL_VERSION);
+        m_peerCapabilities = negotiateCapabilities(hello);
+        m_peerName = hello.name;
+        m_statusRate.setServerInterval(hello.statusInterval);
+    }
+    else
+    {
+        m_peerVersion = PROTOCOL_LEGACY;
+        m_peerCapabilities = 0;
+        m_peerName.clear();
+        m_statusRate.setServerInterval(0);
+    }
+    m_lastStatus.clear();
+    m_statusCount = 0;
+
+//  Multicast plans only reach us once we are in the group
+    QByteArray baHello = encodeHello(m_multicast.isJoined() ? CAP_SUPPORTED : (CAP_SUPPORTED & ~CAP_MULTICAST));
+    traceFrame(TRACE_OUT, HELLO, baHello);
+    m_receiveSocket->write(baHello);
+    m_receiveSocket->close();
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Protocol version" << m_peerVersion
+                      << "capabilities" << m_peerCapabilities;
+}
+
+// Keep the accepted plan on disk, the receipt has already gone out
+void Client::storePlan()
+{
+    if (!m_store.isOpen())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 spotCount = 0, orderCount = 0;
+    for (int i = 0; i < m_layerCount; i++)
+    {
+        spotCount += m_layers[i].spotCount;
+        orderCount += m_layers[i].orderCount;
+    }
+
+    PlanImageWriter writer(m_layerCount, spotCount, orderCount, m_parameter);
+    for (int i = 0; i < m_layerCount; i++)
+    {
+        const PlanLayer &layer = m_layers[i];
+        Spot3DCoordinate *spots;
+        qint32 *order;
+        writer.addLayer(layer.depth, layer.spotCount, layer.orderCount, spots, order);
+        memcpy(spots, layer.spots, layer.spotCount * sizeof(Spot3DCoordinate));
+        memcpy(order, layer.order, layer.orderCount * sizeof(qint32));
+    }
+
+    m_planSequence = m_store.save(writer.image(), 0);
+    if (m_planSequence == 0)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Plan could not be stored";
+        return;
+    }
+    m_store.journal(m_planSequence, m_session);
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Stored plan" << m_planSequence << "in"
+                      << timer.nsecsElapsed() / 1000 << "us";
+}
+
+// The layers are used in place in the mapping, only the layer table is built
+bool Client::restorePlan()
+{
+    initVar();
+
+    qint64 size, sequence, tag;
+    uchar *image = m_store.mapLatest(size, sequence, tag);
+    PlanImageReader reader;
+    if (!reader.open(image, size))
+    {
+        m_store.unmap();
+        return false;
+    }
+
+    m_arena.reset(qint64(reader.layerCount()) * sizeof(PlanLayer) + 64);
+    PlanLayer *layers = m_arena.allocate<PlanLayer>(reader.layerCount());
+    for (int i = 0; i < reader.layerCount(); i++)
+        reader.layer(i, layers[i].depth, layers[i].spots, layers[i].spotCount, layers[i].order, layers[i].orderCount);
+    m_layers = layers;
+    m_layerCount = reader.layerCount();
+    m_parameter = reader.parameter();
+
+//  The file was checked when it arrived, a damaged one must still not reach the timeline
+    PlanError error;
+    if (!PlanValidator::check(m_layers, m_layerCount, m_parameter, m_coordinateLimit, &m_pool, error))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Stored plan" << sequence << "dropped:" << error.message;
+        initVar();
+        return false;
+    }
+    m_planSequence = sequence;
+
+    qint64 journalSequence;
+    SessionRecorder recorder;
+    if (m_store.readJournal(journalSequence, recorder) && journalSequence == sequence)
+        m_session = recorder;
+
+    compileTimeline();
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Restored plan" << sequence << "of" << m_layerCount
+                      << "layers at spot" << m_session.spotIndex << "period" << m_session.periodIndex;
+    return true;
+}
+
+void Client::recordProgress(int spotIndex, int periodIndex)
+{
+    m_session.spotIndex = spotIndex;
+    m_session.periodIndex = periodIndex;
+    if (m_planSequence > 0)
+        m_store.journal(m_planSequence, m_session);
+}
+
+// Pulses of the plan in execution order, checked against the sonication limits once here
+void Client::compileTimeline()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!m_timeline.compile(m_layers, m_layerCount, m_parameter))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Plan rejected:" << m_timeline.errorString();
+        return;
+    }
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Timeline of" << m_timeline.size() << "pulses,"
+                      << m_timeline.duration() / MS_UNIT << "ms, compiled in" << timer.nsecsElapsed() / 1000 << "us";
+}
+
+// Convert the spots information of the legacy hashes into the arena, one layer per task.
+// The indices are in depth order and already checked to pair up layer by layer.
+void Client::convertSpot(const LayerIndex<QList<Coordinate> > &layersX, const LayerIndex<QList<Coordinate> > &layersY,
+                         const LayerIndex<QList<Coordinate> > &layersZ, const LayerIndex<QList<int> > &spotOrder)
+{
+    QElapsedTimer timer;
+    timer.start();
+    int allocationCount = m_arena.allocationCount();
+
+    int layerCount = layersX.size();
+    QVector<const QList<int> *> orders(layerCount);
+    qint64 spotCount = 0, orderCount = 0;
+    for (int i = 0; i < layerCount; i++)
+    {
+        orders[i] = spotOrder.find(layersX.depthAt(i));
+        spotCount += layersX.at(i).size();
+        orderCount += orders.at(i) ? orders.at(i)->size() : 0;
+    }
+    m_arena.reset(layerCount * qint64(sizeof(PlanLayer) + 16) + spotCount * qint64(sizeof(Spot3DCoordinate))
+                  + orderCount * qint64(sizeof(int)) + 64);
+
+    PlanLayer *layers = m_arena.allocate<PlanLayer>(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        layers[i].depth = layersX.depthAt(i);
+        layers[i].spotCount = layersX.at(i).size();
+        layers[i].spots = m_arena.allocate<Spot3DCoordinate>(layers[i].spotCount);
+        layers[i].orderCount = orders.at(i) ? orders.at(i)->size() : 0;
+        layers[i].order = m_arena.allocate<int>(layers[i].orderCount);
+    }
+
+    parallelFor(&m_pool, layerCount, [&](int i) {
+        PlanLayer &layer = layers[i];
+        const QList<Coordinate> &currentListX = layersX.at(i);
+        const QList<Coordinate> &currentListY = layersY.at(i);
+        const QList<Coordinate> &currentListZ = layersZ.at(i);
+        for (int x = 0; x < layer.spotCount; x++)
+        {
+            layer.spots[x].x = currentListX.at(x);
+            layer.spots[x].y = currentListY.at(x);
+            layer.spots[x].z = currentListZ.at(x);
+        }
+        for (int j = 0; j < layer.orderCount; j++)
+            layer.order[j] = orders.at(i)->at(j);
+    });
+
+    m_layers = layers;
+    m_layerCount = layerCount;
+    m_spotOrderBuilt = true;
+    countDecode(timer.nsecsElapsed() / 1000, m_arena.allocationCount() - allocationCount);
 
     // Print to check
-    QHash<float, QList<Spot3DCoordinate> >::iterator j;
-    for (j = m_spot3D.begin(); j != m_spot3D.end(); ++j)
+    for (int j = 0; j < m_layerCount; j++)
+    {
+        if (m_layers[j].spotCount == 0)
+            continue;
+        qDebug() << m_layers[j].depth << ":"
+                 << "First spot:" << "(" << m_layers[j].spots[0].x << ","
+                 << m_layers[j].spots[0].y << ","
+                 << m_layers[j].spots[0].z << ")";
+        qDebug() << "Size:" << m_layers[j].spotCount;
+    }
+}
+
+// Nearest layer at depth within LAYER_TOLERANCE, 0 when the plan has none
+const PlanLayer *Client::findLayer(float depth)
+{
+    int first;
+    int count = findLayers(depth, depth, first);
+    const PlanLayer *nearest = 0;
+    for (int i = first; i < first + count; i++)
+    {
+        if (!nearest || qAbs(m_layers[i].depth - depth) < qAbs(nearest->depth - depth))
+            nearest = &m_layers[i];
+    }
+    return nearest;
+}
+
+// Layers with a depth in [low, high], starting at m_layers[first]
+int Client::findLayers(float low, float high, int &first)
+{
+    const PlanLayer *begin = m_layers, *end = m_layers + m_layerCount;
+    const PlanLayer *lower = std::lower_bound(begin, end, low - LAYER_TOLERANCE,
+                                              [](const PlanLayer &layer, float depth) { return layer.depth < depth; });
+    const PlanLayer *upper = std::upper_bound(lower, end, high + LAYER_TOLERANCE,
+                                              [](float depth, const PlanLayer &layer) { return depth < layer.depth; });
+    first = int(lower - begin);
+    return int(upper - lower);
+}
+
+// Coordinates in the hash form, built from the arena the first time they are asked for
+QHash<float, QList<Spot3DCoordinate> > Client::getCoordinate()
+{
+    if (!m_spot3DBuilt)
     {
-        QList<Spot3DCoordinate> currentList = j.value();
-        qDebug() << j.key() << ":"
-                 << "First spot:" << "(" << currentList.at(0).x << ","
-                 << currentList.at(0).y << ","
-                 << currentList.at(0).z << ")";
-        qDebug() << "Size:" << currentList.size();
+        m_spot3D.clear();
+        for (int i = 0; i < m_layerCount; i++)
+        {
+            const PlanLayer &layer = m_layers[i];
+            QList<Spot3DCoordinate> &currentList = m_spot3D[layer.depth];
+            currentList.reserve(layer.spotCount);
+            for (int j = 0; j < layer.spotCount; j++)
+                currentList.append(layer.spots[j]);
+        }
+        m_spot3DBuilt = true;
+    }
+    return m_spot3D;
+}
+
+QHash<float, QList<int> > Client::getSpotOrder()
+{
+    if (!m_spotOrderBuilt)
+    {
+        m_spotOrder.clear();
+        for (int i = 0; i < m_layerCount; i++)
+        {
+            const PlanLayer &layer = m_layers[i];
+            if (layer.orderCount == 0)
+                continue;
+            QList<int> &currentOrder = m_spotOrder[layer.depth];
+            currentOrder.reserve(layer.orderCount);
+            for (int j = 0; j < layer.orderCount; j++)
+                currentOrder.append(layer.order[j]);
+        }
+        m_spotOrderBuilt = true;
     }
+    return m_spotOrder;
 }
 
 void Client::receiveCommand()
@@ -240,9 +1081,21 @@ void Client::receiveCommand()
     in >> command;
     qDebug() << command;
 
-//  TODO
-//  Refactor the following codes.
-//  Don't use the command
+    runCommand(int(command));
+
+    m_receiveSocket->close();
+    qDebug() << "Receive command finished.";
+    qDebug() << SEPERATOR;
+}
+
+int Client::runCommand(int command)
+{
+//  The operator took over: a schedule left running would START or RESUME against a PAUSE or STOP
+    if (sender() != &m_schedule && m_schedule.isRunning())
+    {
+        qCDebug(CLIENT()) << CLIENT().categoryName() << "Command" << command << "from the server cancels the schedule.";
+        m_schedule.cancel();
+    }
 
     switch (command) {
     case START:        
@@ -262,12 +1115,9 @@ void Client::receiveCommand()
         emit commandResume();
         break;
     default:
-        break;
+        return COMMAND_UNKNOWN;
     }
-
-    m_receiveSocket->close();
-    qDebug() << "Receive command finished.";
-    qDebug() << SEPERATOR;
+    return COMMAND_DONE;
 }
 
 // Check whether the send-back data is right, not necessary
@@ -279,6 +1129,7 @@ void Client::bytes(qint64 bytesWritten)
 void Client::connectServer()
 {
     QHostAddress ipAddress(m_sendIpAddress);    // Set the IP address of another computer
+    m_recorder.record(FLIGHT_CONNECT, STATUS, 0, 0, m_sendPort);
     m_sendSocket->connectToHost(ipAddress, m_sendPort);    // Connect
 
     connect(m_sendSocket, SIGNAL(error(QAbstractSocket::SocketError)),
@@ -287,30 +1138,182 @@ void Client::connectServer()
 
 void Client::send()
 {
+    m_connectTimer.start();
     connectServer();
     m_baOut.clear();
 
-    QDataStream out(&m_baOut, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_4_6);
-
     qCDebug(CLIENT()) << CLIENT().categoryName() << "Sending ...";
 
+    encodeStatus(&m_baOut);
+    if (m_clock.isValid())
+        stampFrame(m_baOut, m_clock.remoteTime(sessionTime()));
+
+    traceFrame(TRACE_OUT, STATUS, m_baOut);
+    m_sendSocket->write(m_baOut);
+    m_sendSocket->close();
+
+//    qDebug() << "Progress information send finished.";
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "SEND PROGRESS UPDATE FINISHED.";
+//    qDebug() << "-------------------";
+}
+
+void Client::startStatusUpdates()
+{
+    m_statusTimer.start(m_statusRate.interval());
+}
+
+void Client::stopStatusUpdates()
+{
+    m_statusTimer.stop();
+}
+
+// A status still connecting or flushing means the link is not keeping up, skip this one
+void Client::statusTick()
+{
+    bool sent = (m_sendSocket->state() == QAbstractSocket::UnconnectedState);
+    qint64 queuedBytes = m_sendSocket->bytesToWrite();
+    if (sent)
+        send();
+
+    int interval = m_statusRate.interval();
+    if (m_statusRate.update(queuedBytes, sent) != interval)
+    {
+        StatusRateMetrics metrics = m_statusRate.metrics();
+        qCDebug(CLIENT()) << CLIENT().categoryName() << "Status interval" << metrics.interval << "ms, RTT"
+                          << metrics.smoothedRtt << "ms, queued" << metrics.queuedBytes << "bytes";
+        emit statusIntervalChanged(metrics.interval);
+    }
+    m_statusTimer.start(m_statusRate.interval());
+}
+
+void Client::statusConnected()
+{
+    m_statusRate.addRttSample(m_connectTimer.elapsed());
+}
+
+// Start recording every frame in and out with high-resolution timestamps
+void Client::startCapture(QString fileName)
+{
+    if (!m_trace.open(fileName, TRACE_CLIENT))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Failed to open capture file" << fileName;
+        return;
+    }
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Capturing frames to" << fileName;
+}
+
+void Client::stopCapture()
+{
+    m_trace.close();
+}
+
+bool Client::dumpFlightRecorder(QString fileName)
+{
+    if (!m_recorder.dump(fileName))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Failed to write flight recorder" << fileName;
+        return false;
+    }
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Flight recorder written to" << fileName;
+    return true;
+}
+
+// Every frame goes into the flight recorder, and into the capture file when one is open
+void Client::traceFrame(TraceDirection direction, int type, const QByteArray &frame)
+{
+    m_recorder.record(direction == TRACE_IN ? FLIGHT_FRAME_IN : FLIGHT_FRAME_OUT, type, 0, frame.size());
+    m_trace.write(direction, type, frame);
+}
+
+// The events that led to an error are written out at once, at most one file per FLIGHT_DUMP_INTERVAL
+void Client::recordError(int errorCode, qint64 detail)
+{
+    m_recorder.record(FLIGHT_ERROR, errorCode, 0, 0, detail);
+    if (m_flightDirectory.isEmpty())
+        return;
+    if (m_lastFlightDump.isValid() && m_lastFlightDump.elapsed() < FLIGHT_DUMP_INTERVAL)
+        return;
+    m_lastFlightDump.start();
+    QString fileName = "flight " + QDateTime::currentDateTime().toString("yyyy-MM-dd hh-mm-ss-zzz") + ".bin";
+    dumpFlightRecorder(QDir(m_flightDirectory).filePath(fileName));
+}
+
+void Client::encodeStatus(QByteArray *baBlock)
+{
+    if (m_peerVersion >= PROTOCOL_VERSION)
+    {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+
+//  The name the server gave us, so it can tell its clients apart
+        out << m_peerName;
+
+//  The server reads statuses on several threads, the sequence puts them back in order
+        quint32 flags = 0;
+        if (m_peerCapabilities & CAP_STATUS_SEQUENCE)
+        {
+            out << m_statusSession << ++m_statusSequence;
+            flags |= FRAME_SEQUENCE;
+        }
+        if (m_peerCapabilities & CAP_DELTA_STATUS)
+        {
+//  Only the keys changed since the last status, with a full refresh now and then
+            bool full = (m_statusCount % DELTA_STATUS_REFRESH == 0);
+            QHash<QString, QVariant> changed;
+            QStringList removed;
+            if (full)
+            {
+                changed = m_status;
+            }
+            else
+            {
+                QHash<QString, QVariant>::const_iterator i;
+                for (i = m_status.constBegin(); i != m_status.constEnd(); ++i)
+                {
+                    QHash<QString, QVariant>::const_iterator last = m_lastStatus.constFind(i.key());
+                    if (last == m_lastStatus.constEnd() || last.value() != i.value())
+                        changed.insert(i.key(), i.value());
+                }
+                for (i = m_lastStatus.constBegin(); i != m_lastStatus.constEnd(); ++i)
+                {
+                    if (!m_status.contains(i.key()))
+                        removed << i.key();
+                }
+            }
+            out << full << changed << removed;
+            flags |= FRAME_DELTA;
+            m_lastStatus = m_status;
+            m_statusCount += 1;
+        }
+        else
+        {
+            out << m_status;
+        }
+        *baBlock = encodeFrame(STATUS, payload, flags, m_peerCapabilities);
+        m_totalBytes = baBlock->size();
+        qDebug() << "m_totalBytes:" << m_totalBytes;
+        return;
+    }
+
+    QDataStream out(baBlock, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+
     out << qint64(0)
         << qint64(0)
         << m_status;
 
-    m_totalBytes = m_baOut.size();
+    m_totalBytes = baBlock->size();
 
     qDebug() << "m_totalBytes:" << m_totalBytes;
     qDebug() << "m_status:" << m_status;
 
     out.device()->seek(0);
     out << qint64(STATUS) << m_totalBytes;    // Find the head of array and write the haed information
+}
 
-    m_sendSocket->write(m_baOut);
-    m_sendSocket->close();
-
-//    qDebug() << "Progress information send finished.";
-    qCDebug(CLIENT()) << CLIENT().categoryName() << "SEND PROGRESS UPDATE FINISHED.";
-//    qDebug() << "-------------------";
+// Threads used to decode a plan layer by layer, 1 decodes serially
+void Client::setThreadCount(int threadCount)
+{
+    m_pool.setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
 }
@@ -5,14 +5,40 @@
 #include <QtNetwork>
 #include <QHash>
 #include <QVariant>
+#include <QThreadPool>
+#include <QQueue>
 #include <QLoggingCategory>
 
 #include "variable.h"
 #include "constant.h"
+#include "tracefile.h"
+#include "flightrecorder.h"
+#include "protocol.h"
+#include "planarena.h"
+#include "statusrate.h"
+#include "schedulerunner.h"
+#include "timeline.h"
+#include "clocksync.h"
+#include "planvalidator.h"
+#include "layerindex.h"
+#include "planstore.h"
+#include "multicastreceiver.h"
 #include "client_global.h"
 
 Q_DECLARE_LOGGING_CATEGORY(CLIENT)
 
+//  Plans decoded since start: the time spent and the heap blocks the arena took for them,
+//  and the time spent validating them
+struct PlanStats
+{
+    int plans;
+    qint64 spots;
+    qint64 decodeTime;    // us
+    int allocations;
+    qint64 arenaBytes;
+    qint64 validateTime;    // us
+};
+
 class CLIENTSHARED_EXPORT Client : public QObject
 {
     Q_OBJECT
@@ -22,14 +48,47 @@ public:
     ~Client();
 
     inline void setStatus(QHash<QString, QVariant> status) { m_status = status; }
+    // Override config.ini for this instance, before listen()
+    inline void setReceiveAddress(QString ipAddress, quint16 port) { m_receiveIpAddress = ipAddress; m_receivePort = port; }
+    inline void setSendAddress(QString ipAddress, quint16 port) { m_sendIpAddress = ipAddress; m_sendPort = port; }
+    inline void setStatusBounds(int minInterval, int maxInterval) { m_statusRate.setBounds(minInterval, maxInterval); }
+    // Group the server multicasts plans to, empty takes every plan by unicast
+    inline void setMulticastGroup(QString group, quint16 port) { m_multicastGroup = group; m_multicastPort = port; }
+    void setThreadCount(int threadCount);    // 0 uses one thread per core
     void send();
+    inline StatusRateMetrics getStatusRateMetrics() { return m_statusRate.metrics(); }
+    // Server clock - our clock, and one-way latency of the last stamped frame, in us
+    inline qint64 getClockOffset() { return m_clock.isValid() ? m_clock.offsetAt(sessionTime()) : 0; }
+    inline qint64 getLastLatency() { return m_lastLatency; }
+    inline ScheduleStats getScheduleStats() { return m_schedule.stats(); }    // Lateness of scheduled commands
+    inline PlanStats getPlanStats() { return m_planStats; }
+    // Progress of the current plan, from the journal when the plan was restored at start
+    inline SessionRecorder getSessionRecorder() { return m_session; }
+    inline qint64 getPlanSequence() { return m_planSequence; }    // Store sequence of the current plan, 0 if not stored
 
 public slots:
     void listen();    // Start to listen port    
-
-    inline QHash<float, QList<Spot3DCoordinate> > getCoordinate(){ return m_spot3D; }
-    inline QHash<float, QList<int> > getSpotOrder(){ return m_spotOrder; }
+    void startStatusUpdates();    // Send the status on an interval adapted to the link
+    void stopStatusUpdates();
+    inline void cancelSchedule() { m_schedule.cancel(); }
+
+    void startCapture(QString fileName);    // Record every frame into a binary trace file
+    void stopCapture();
+    bool dumpFlightRecorder(QString fileName);    // Write the recent network events, see flightrecorder.h
+
+    bool restorePlan();    // Map the newest stored plan back and resume from the journal
+    void recordProgress(int spotIndex, int periodIndex);    // Journal the session position
+
+    QHash<float, QList<Spot3DCoordinate> > getCoordinate();
+    QHash<float, QList<int> > getSpotOrder();
+    inline const PlanLayer *getLayers(){ return m_layers; }    // Decoded plan in depth order, valid until the next plan
+    inline int getLayerCount(){ return m_layerCount; }
+    const PlanLayer *findLayer(float depth);    // Layer at depth within LAYER_TOLERANCE, 0 if none
+    int findLayers(float low, float high, int &first);    // Count of layers in [low, high] from getLayers()[first]
     inline SpotSonicationParameter getParameter(){ return m_parameter; }
+    inline const Timeline &getTimeline(){ return m_timeline; }    // Compiled plan, invalid when the plan broke a limit
+    inline int getPeerVersion(){ return m_peerVersion; }
+    inline quint32 getPeerCapabilities(){ return m_peerCapabilities; }
 
 signals:
     commandStart();
@@ -37,6 +96,10 @@ signals:
     commandPause();
     commandResume();
     receivingCompleted();
+    void statusIntervalChanged(int interval);
+    void frameLatency(int type, qint64 latency);
+    void planRejected(QString errorString);
+    void networkError(QString errorString);
 
 private slots:
     void acceptConnection();    // Build connection
@@ -44,13 +107,18 @@ private slots:
     QString getLocalIP();
     void initVar();
 
-    void convertSpot();
     void readHeader();
     void receivePlan();
     void receiveCommand();
+    int runCommand(int command);    // CommandResult
+    void receiveHello();
     void bytes(qint64 bytesWritten);
+    void multicastComplete(quint32 transfer);
+    void nackTimeout();
 
     void connectServer();
+    void statusTick();
+    void statusConnected();
 
 private:
     QTcpServer m_server;
@@ -62,12 +130,83 @@ private:
 
     QByteArray m_baOut;    // Data buffer for write
     qint64 m_totalBytes;    // Total bytes of data to send or receive
-    QHash<float, QList<Spot3DCoordinate> > m_spot3D;    // Save spot coordinates data
+    QHash<float, QList<Spot3DCoordinate> > m_spot3D;    // Built from the arena on first request
     QHash<float, QList<Coordinate> > m_hashX, m_hashY, m_hashZ;
     QHash<float, QList<int> > m_spotOrder;
+    bool m_spot3DBuilt, m_spotOrderBuilt;
     SpotSonicationParameter m_parameter;
 
+    PlanArena m_arena;    // Backs the decoded plan, released at once by the next plan
+    PlanStats m_planStats;
+    void countDecode(qint64 decodeTime, int allocations);
+    PlanLayer *m_layers;
+    int m_layerCount;
+    Timeline m_timeline;
+    void compileTimeline();
+
+    PlanStore m_store;    // Last plans on disk, the restored plan's layers point into its mapping
+    qint64 m_planSequence;
+    SessionRecorder m_session;
+    void storePlan();
+
+    QThreadPool m_pool;    // Layer-parallel plan decoding
+
     QHash<QString, QVariant> m_status;
+    QHash<QString, QVariant> m_lastStatus;    // Last status sent, base of the next delta
+    int m_statusCount;
+    quint32 m_statusSession;    // New on every start, with m_statusSequence orders our statuses at the server
+    quint32 m_statusSequence;
+    void encodeStatus(QByteArray *baBlock);
+
+    StatusRateController m_statusRate;
+    QTimer m_statusTimer;
+    QElapsedTimer m_connectTimer;    // Connect time of a status is the RTT sample
+
+    int m_peerVersion;    // 0 until the server said hello
+    quint32 m_peerCapabilities;
+    QString m_peerName;    // Assigned by the server in its hello
+    bool readFrame();
+    void receiveFrame(int type, qint64 length);
+    void handleFrame(int type, const QByteArray &baBuffer);
+    void receiveAckedCommand(QDataStream &in);
+    void replySync(QDataStream &in);
+    void readPlan(QDataStream &in, QString &receipt);
+    bool readPlanSoA(QDataStream &in, const QByteArray &payload, QString &receipt);
+    void replyReceipt(const QString &receipt);
+    void replyReject(const QString &receipt, const PlanError &error);
+    bool readHashes(QDataStream &in, PlanError &error);
+    void convertSpot(const LayerIndex<QList<Coordinate> > &layersX, const LayerIndex<QList<Coordinate> > &layersY,
+                     const LayerIndex<QList<Coordinate> > &layersZ, const LayerIndex<QList<int> > &spotOrder);
+    void finishPlan(const QString &receipt, bool decoded, PlanError error);
+    Coordinate m_coordinateLimit;    // |x|, |y| and |z| of an accepted plan, 0 for no limit
+
+    ClockSync m_clock;    // Estimate of the server clock, kept by the server's sync requests
+    qint64 m_arrivalTime;    // Session time the frame being read arrived
+    qint64 m_lastLatency;
+
+    ScheduleRunner m_schedule;    // Commands timed by the local clock
+
+    MulticastReceiver m_multicast;
+    QString m_multicastGroup;
+    quint16 m_multicastPort;
+    QPointer<QTcpSocket> m_announceSocket;    // Plan connection the transfer was announced on, answered there
+    quint32 m_announcedTransfer;    // 0 when none is being collected
+    int m_nackRounds;
+    int m_lastRemaining;    // Chunks missing at the previous check
+    QTimer m_nackTimer;
+    void receiveAnnounce(QDataStream &in);
+    void sendNack(quint32 transfer, const QVector<quint32> &missing);
+
+    quint32 m_commandSession;    // Server session the history belongs to
+    QHash<quint32, qint32> m_commandResults;    // Result by sequence, to answer a retransmission without running it
+    QQueue<quint32> m_commandHistory;    // Sequences in m_commandResults, oldest first
+
+    TraceWriter m_trace;
+    FlightRecorder m_recorder;    // Always on, dumped into m_flightDirectory on errors
+    QString m_flightDirectory;    // Empty for no automatic dumps
+    QElapsedTimer m_lastFlightDump;
+    void traceFrame(TraceDirection direction, int type, const QByteArray &frame);
+    void recordError(int errorCode, qint64 detail);
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,135 @@
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <cstring>
+
+#include "multicastreceiver.h"
+
+Q_DECLARE_LOGGING_CATEGORY(CLIENT)
+
+MulticastReceiver::MulticastReceiver(QObject *parent) : QObject(parent),
+    m_datagrams(0), m_duplicates(0)
+{
+    connect(&m_socket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+}
+
+// Several clients on one host share the port, each gets every datagram
+bool MulticastReceiver::join(const QString &group, quint16 port)
+{
+    QHostAddress address(group);
+    if (!address.isMulticast() || port == 0)
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Not a multicast group:" << group << port;
+        return false;
+    }
+
+    m_socket.abort();
+    if (!m_socket.bind(QHostAddress(QHostAddress::AnyIPv4), port,
+                       QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)
+            || !m_socket.joinMulticastGroup(address))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << m_socket.errorString();
+        m_socket.abort();
+        return false;
+    }
+    m_socket.setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 4 * 1024 * 1024);
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Joined multicast group" << group << port;
+    return true;
+}
+
+MulticastReceiver::Transfer &MulticastReceiver::addTransfer(quint32 transfer, quint32 count, quint32 frameBytes)
+{
+    if (m_transfers.size() >= MULTICAST_TRANSFERS)
+        m_transfers.remove(m_order.dequeue());
+
+    Transfer &added = m_transfers[transfer];
+    added.count = count;
+    added.frame = QByteArray(int(frameBytes), Qt::Uninitialized);
+    added.received = QBitArray(int(count));
+    added.remaining = int(count);
+    m_order.enqueue(transfer);
+    return added;
+}
+
+bool MulticastReceiver::announce(quint32 transfer, quint32 count, quint32 frameBytes)
+{
+    QHash<quint32, Transfer>::iterator i = m_transfers.find(transfer);
+    if (i == m_transfers.end() || i.value().count != count || i.value().frame.size() != int(frameBytes))
+    {
+        drop(transfer);
+        return addTransfer(transfer, count, frameBytes).remaining == 0;
+    }
+    return i.value().remaining == 0;
+}
+
+QVector<quint32> MulticastReceiver::missing(quint32 transfer) const
+{
+    QVector<quint32> chunks;
+    QHash<quint32, Transfer>::const_iterator i = m_transfers.constFind(transfer);
+    if (i == m_transfers.constEnd())
+        return chunks;
+    for (int j = 0; j < i.value().received.size(); j++)
+    {
+        if (!i.value().received.testBit(j))
+            chunks.append(quint32(j));
+    }
+    return chunks;
+}
+
+int MulticastReceiver::remaining(quint32 transfer) const
+{
+    QHash<quint32, Transfer>::const_iterator i = m_transfers.constFind(transfer);
+    return i == m_transfers.constEnd() ? -1 : i.value().remaining;
+}
+
+QByteArray MulticastReceiver::take(quint32 transfer)
+{
+    QByteArray frame = m_transfers.value(transfer).frame;
+    drop(transfer);
+    return frame;
+}
+
+void MulticastReceiver::drop(quint32 transfer)
+{
+    if (m_transfers.remove(transfer) > 0)
+        m_order.removeAll(transfer);
+}
+
+void MulticastReceiver::readDatagrams()
+{
+    QByteArray datagram;
+    while (m_socket.hasPendingDatagrams())
+    {
+        datagram.resize(int(m_socket.pendingDatagramSize()));
+        if (m_socket.readDatagram(datagram.data(), datagram.size()) < 0)
+            break;
+
+        ChunkHeader chunk;
+        if (!decodeChunk(datagram, chunk))
+            continue;
+        m_datagrams += 1;
+
+        QHash<quint32, Transfer>::iterator i = m_transfers.find(chunk.transfer);
+        if (i == m_transfers.end())
+        {
+            addTransfer(chunk.transfer, chunk.count, chunk.frameBytes);
+            i = m_transfers.find(chunk.transfer);
+        }
+        Transfer &transfer = i.value();
+        if (transfer.count != chunk.count || transfer.frame.size() != int(chunk.frameBytes))
+            continue;    // Not what was announced
+        if (transfer.received.testBit(int(chunk.index)))
+        {
+            m_duplicates += 1;
+            continue;
+        }
+
+        memcpy(transfer.frame.data() + qint64(chunk.index) * MULTICAST_CHUNK,
+               datagram.constData() + MULTICAST_HEADER, datagram.size() - MULTICAST_HEADER);
+        transfer.received.setBit(int(chunk.index));
+        transfer.remaining -= 1;
+        if (transfer.remaining == 0)
+            emit transferComplete(chunk.transfer);
+    }
+}
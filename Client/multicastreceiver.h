@@ -0,0 +1,62 @@
+#ifndef MULTICASTRECEIVER_H
+#define MULTICASTRECEIVER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QBitArray>
+#include <QByteArray>
+#include <QHash>
+#include <QQueue>
+#include <QVector>
+
+#include "protocol.h"
+
+//  Collects the chunks of multicast plan frames from the group. Chunks may
+//  come before the server announced their transfer, so the last
+//  MULTICAST_TRANSFERS transfers seen are buffered whether announced or not,
+//  none of more than MULTICAST_MAX_FRAME bytes.
+class MulticastReceiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    MulticastReceiver(QObject *parent = 0);
+
+    bool join(const QString &group, quint16 port);
+    inline bool isJoined() const { return m_socket.state() == QAbstractSocket::BoundState; }
+
+    // Make room for a transfer announced on the plan connection, true when it is complete already
+    bool announce(quint32 transfer, quint32 count, quint32 frameBytes);
+    QVector<quint32> missing(quint32 transfer) const;    // Chunks not in yet, none for an unknown transfer
+    int remaining(quint32 transfer) const;    // -1 for an unknown transfer
+    QByteArray take(quint32 transfer);    // The complete frame, the transfer is forgotten
+    void drop(quint32 transfer);
+
+    inline qint64 getDatagramCount() const { return m_datagrams; }
+    inline qint64 getDuplicateCount() const { return m_duplicates; }    // Repairs another receiver asked for
+
+signals:
+    void transferComplete(quint32 transfer);
+
+private slots:
+    void readDatagrams();
+
+private:
+    QUdpSocket m_socket;
+
+    struct Transfer
+    {
+        quint32 count;
+        QByteArray frame;
+        QBitArray received;
+        int remaining;
+    };
+    QHash<quint32, Transfer> m_transfers;
+    QQueue<quint32> m_order;    // Oldest first
+
+    qint64 m_datagrams, m_duplicates;
+
+    Transfer &addTransfer(quint32 transfer, quint32 count, quint32 frameBytes);
+};
+
+#endif // MULTICASTRECEIVER_H
@@ -0,0 +1,59 @@
+#include <cstdlib>
+
+#include "planarena.h"
+
+PlanArena::PlanArena() :
+    m_block(0), m_capacity(0), m_used(0), m_overflowUsed(0), m_allocationCount(0)
+{
+}
+
+PlanArena::~PlanArena()
+{
+    releaseOverflow();
+    free(m_block);
+}
+
+void PlanArena::releaseOverflow()
+{
+    for (int i = 0; i < m_overflow.size(); i++)
+        free(m_overflow.at(i));
+    m_overflow.clear();
+    m_overflowUsed = 0;
+}
+
+void PlanArena::reset(qint64 capacity)
+{
+    releaseOverflow();
+    m_used = 0;
+
+//  Keep the previous block when it is big enough
+    if (capacity <= m_capacity)
+        return;
+
+    free(m_block);
+    m_block = static_cast<char *>(malloc(size_t(capacity)));
+    m_capacity = m_block ? capacity : 0;
+    m_allocationCount += 1;
+}
+
+void *PlanArena::allocate(qint64 size, qint64 alignment)
+{
+    if (size <= 0)
+        return 0;
+
+    qint64 offset = (m_used + alignment - 1) & ~(alignment - 1);
+    if (m_block && offset + size <= m_capacity)
+    {
+        m_used = offset + size;
+        return m_block + offset;
+    }
+
+//  Estimate exceeded, fall back to a dedicated block released with the plan
+    char *block = static_cast<char *>(malloc(size_t(size)));
+    if (!block)
+        return 0;
+    m_overflow.append(block);
+    m_overflowUsed += size;
+    m_allocationCount += 1;
+    return block;
+}
@@ -0,0 +1,53 @@
+#ifndef PLANARENA_H
+#define PLANARENA_H
+
+#include <QtGlobal>
+#include <QList>
+
+#include "variable.h"
+
+//  One layer of a decoded plan, spots and order both live in the arena
+struct PlanLayer
+{
+    float depth;
+    int spotCount;
+    Spot3DCoordinate *spots;
+    int orderCount;
+    int *order;
+};
+
+//  Bump allocator backing a decoded plan. The block is sized from the frame
+//  length before decoding, so a whole plan normally costs a single heap
+//  allocation, and reset() releases it at once when the next plan arrives.
+class PlanArena
+{
+public:
+    PlanArena();
+    ~PlanArena();
+
+    void reset(qint64 capacity);    // Drop everything and make room for at least capacity bytes
+    void *allocate(qint64 size, qint64 alignment = 8);
+
+    template <typename T>
+    inline T *allocate(qint64 count) { return static_cast<T *>(allocate(count * qint64(sizeof(T)), Q_ALIGNOF(T))); }
+
+    inline qint64 used() const { return m_used + m_overflowUsed; }
+    inline qint64 capacity() const { return m_capacity; }
+    inline int allocationCount() const { return m_allocationCount; }    // Heap blocks since construction
+    inline int overflowCount() const { return m_overflow.size(); }    // Blocks beyond the first for this plan
+
+private:
+    Q_DISABLE_COPY(PlanArena)
+
+    char *m_block;
+    qint64 m_capacity;
+    qint64 m_used;
+
+    QList<char *> m_overflow;    // Only when the size estimate was too small
+    qint64 m_overflowUsed;
+
+    int m_allocationCount;
+    void releaseOverflow();
+};
+
+#endif // PLANARENA_H
@@ -0,0 +1,202 @@
+#include <QVector>
+#include <QtNumeric>
+
+#include "planvalidator.h"
+#include "constant.h"
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PLAN_SSE2
+#endif
+
+//  The spots are scanned as one flat array of doubles
+Q_STATIC_ASSERT(sizeof(Coordinate) == sizeof(double));
+Q_STATIC_ASSERT(sizeof(Spot3DCoordinate) == 3 * sizeof(Coordinate));
+
+void PlanValidator::setError(PlanError &error, quint32 code, int layer, int index, const QString &message)
+{
+    error.code = code;
+    error.layer = layer;
+    error.index = index;
+    error.message = message;
+}
+
+bool PlanValidator::checkLayers(const LayerIndex<QList<Coordinate> > &layersX, const LayerIndex<QList<Coordinate> > &layersY,
+                                const LayerIndex<QList<Coordinate> > &layersZ, PlanError &error)
+{
+    if (layersY.size() != layersX.size() || layersZ.size() != layersX.size())
+    {
+        setError(error, PLAN_LENGTH_MISMATCH, -1, -1,
+                 QString("Layer counts differ: X %1, Y %2, Z %3.").arg(layersX.size()).arg(layersY.size()).arg(layersZ.size()));
+        return false;
+    }
+
+//  Same count and all in depth order, so the layers pair up by position
+    for (int i = 0; i < layersX.size(); i++)
+    {
+        float depth = layersX.depthAt(i);
+        if (qAbs(layersY.depthAt(i) - depth) > layersX.tolerance() || qAbs(layersZ.depthAt(i) - depth) > layersX.tolerance() ||
+                layersY.at(i).size() != layersX.at(i).size() || layersZ.at(i).size() != layersX.at(i).size())
+        {
+            setError(error, PLAN_LENGTH_MISMATCH, i, -1,
+                     QString("Coordinates of layer %1 do not line up.").arg(depth));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Total time in s, period and cooling time in ms, duty cycle in percent
+bool PlanValidator::checkParameter(const SpotSonicationParameter &parameter, PlanError &error)
+{
+    QString message;
+    if (!(parameter.volt >= 0 && parameter.volt <= VOLT_MAX))
+        message = QString("Voltage %1 out of [0, %2].").arg(parameter.volt).arg(VOLT_MAX);
+    else if (parameter.totalTime < SONICATIONTIME_LL || parameter.totalTime > SONICATIONTIME_UL)
+        message = QString("Sonication time %1 out of [%2, %3].").arg(parameter.totalTime)
+                .arg(SONICATIONTIME_LL).arg(SONICATIONTIME_UL);
+    else if (parameter.period < SONICATIONPERIOD_LL || parameter.period > SONICATIONPERIOD_UL)
+        message = QString("Sonication period %1 out of [%2, %3].").arg(parameter.period)
+                .arg(SONICATIONPERIOD_LL).arg(SONICATIONPERIOD_UL);
+    else if (parameter.dutyCycle < DUTYCYCLE_LL || parameter.dutyCycle > DUTYCYCLE_UL)
+        message = QString("Duty cycle %1 out of [%2, %3].").arg(parameter.dutyCycle)
+                .arg(DUTYCYCLE_LL).arg(DUTYCYCLE_UL);
+    else if (parameter.coolingTime < COOLINGTIME_LL || parameter.coolingTime > COOLINGTIME_UL)
+        message = QString("Cooling time %1 out of [%2, %3].").arg(parameter.coolingTime)
+                .arg(COOLINGTIME_LL).arg(COOLINGTIME_UL);
+
+    if (message.isEmpty())
+        return true;
+    setError(error, PLAN_PARAMETER_RANGE, -1, -1, message);
+    return false;
+}
+
+static inline bool coordinateOk(Coordinate value, Coordinate limit)
+{
+    return qIsFinite(value) && (limit <= 0 || (value >= -limit && value <= limit));
+}
+
+// Min/max reduction over every x, y and z; only a failing layer is scanned again for the culprit
+bool PlanValidator::checkCoordinates(const Spot3DCoordinate *spots, int count, Coordinate limit, int &badIndex)
+{
+    const double *values = reinterpret_cast<const double *>(spots);
+    qint64 valueCount = qint64(count) * 3;
+    if (valueCount == 0)
+        return true;
+
+    double low = values[0], high = values[0];
+    bool unordered = false;
+    qint64 i = 0;
+#ifdef PLAN_SSE2
+    if (valueCount >= 4)
+    {
+        __m128d minimum0 = _mm_loadu_pd(values), maximum0 = minimum0;
+        __m128d minimum1 = minimum0, maximum1 = minimum0;
+        __m128d nan = _mm_setzero_pd();
+        for (; i + 4 <= valueCount; i += 4)
+        {
+            __m128d value0 = _mm_loadu_pd(values + i);
+            __m128d value1 = _mm_loadu_pd(values + i + 2);
+            minimum0 = _mm_min_pd(minimum0, value0);
+            maximum0 = _mm_max_pd(maximum0, value0);
+            minimum1 = _mm_min_pd(minimum1, value1);
+            maximum1 = _mm_max_pd(maximum1, value1);
+            nan = _mm_or_pd(nan, _mm_or_pd(_mm_cmpunord_pd(value0, value0), _mm_cmpunord_pd(value1, value1)));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_min_pd(minimum0, minimum1));
+        low = qMin(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, _mm_max_pd(maximum0, maximum1));
+        high = qMax(lanes[0], lanes[1]);
+        unordered = _mm_movemask_pd(nan) != 0;
+    }
+#endif
+    for (; i < valueCount; i++)
+    {
+        low = qMin(low, values[i]);
+        high = qMax(high, values[i]);
+        unordered = unordered || qIsNaN(values[i]);
+    }
+
+    if (!unordered && coordinateOk(low, limit) && coordinateOk(high, limit))
+        return true;
+
+    for (int j = 0; j < count; j++)
+    {
+        if (!coordinateOk(spots[j].x, limit) || !coordinateOk(spots[j].y, limit) || !coordinateOk(spots[j].z, limit))
+        {
+            badIndex = j;
+            break;
+        }
+    }
+    return false;
+}
+
+bool PlanValidator::checkOrder(const int *order, int count, int spotCount, int &badIndex)
+{
+    int i = 0;
+    bool bad = false;
+#ifdef PLAN_SSE2
+    __m128i below = _mm_set1_epi32(0);
+    __m128i last = _mm_set1_epi32(spotCount - 1);
+    __m128i outside = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(order + i));
+        outside = _mm_or_si128(outside, _mm_or_si128(_mm_cmplt_epi32(value, below), _mm_cmpgt_epi32(value, last)));
+    }
+    bad = _mm_movemask_epi8(outside) != 0;
+#endif
+    for (; i < count && !bad; i++)
+        bad = order[i] < 0 || order[i] >= spotCount;
+    if (!bad)
+        return true;
+
+    for (int j = 0; j < count; j++)
+    {
+        if (order[j] < 0 || order[j] >= spotCount)
+        {
+            badIndex = j;
+            break;
+        }
+    }
+    return false;
+}
+
+bool PlanValidator::check(const PlanLayer *layers, int layerCount, const SpotSonicationParameter &parameter,
+                          Coordinate coordinateLimit, QThreadPool *pool, PlanError &error)
+{
+    if (!checkParameter(parameter, error))
+        return false;
+
+//  Layers are checked in parallel, the first failing layer in depth order is reported
+    QVector<int> badSpot(layerCount, -1), badOrder(layerCount, -1);
+    QVector<char> spotsOk(layerCount), orderOk(layerCount);
+    parallelFor(pool, layerCount, [&](int i) {
+        spotsOk[i] = checkCoordinates(layers[i].spots, layers[i].spotCount, coordinateLimit, badSpot[i]);
+        orderOk[i] = checkOrder(layers[i].order, layers[i].orderCount, layers[i].spotCount, badOrder[i]);
+    });
+
+    for (int i = 0; i < layerCount; i++)
+    {
+        if (!spotsOk.at(i))
+        {
+            const Spot3DCoordinate &spot = layers[i].spots[badSpot.at(i)];
+            setError(error, PLAN_COORDINATE_RANGE, i, badSpot.at(i),
+                     QString("Spot %1 of layer %2 at (%3, %4, %5) is out of range.").arg(badSpot.at(i))
+                     .arg(layers[i].depth).arg(spot.x).arg(spot.y).arg(spot.z));
+            return false;
+        }
+        if (!orderOk.at(i))
+        {
+            setError(error, PLAN_ORDER_RANGE, i, badOrder.at(i),
+                     QString("Order entry %1 of layer %2 names spot %3 of %4.").arg(badOrder.at(i))
+                     .arg(layers[i].depth).arg(layers[i].order[badOrder.at(i)]).arg(layers[i].spotCount));
+            return false;
+        }
+    }
+
+    setError(error, PLAN_OK, -1, -1, QString());
+    return true;
+}
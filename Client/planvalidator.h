@@ -0,0 +1,35 @@
+#ifndef PLANVALIDATOR_H
+#define PLANVALIDATOR_H
+
+#include <QList>
+#include <QThreadPool>
+
+#include "variable.h"
+#include "protocol.h"
+#include "planarena.h"
+#include "layerindex.h"
+
+//  Checks a received plan before anything runs it: the legacy coordinate
+//  hashes line up, every order index names a spot of its layer, every
+//  coordinate is finite and within the limit, and the parameters respect the
+//  limits of constant.h. The scans are vectorized and run layer-parallel.
+class PlanValidator
+{
+public:
+    // X, Y and Z hold the same layers with the same number of spots
+    static bool checkLayers(const LayerIndex<QList<Coordinate> > &layersX, const LayerIndex<QList<Coordinate> > &layersY,
+                            const LayerIndex<QList<Coordinate> > &layersZ, PlanError &error);
+
+    static bool checkParameter(const SpotSonicationParameter &parameter, PlanError &error);
+
+    // coordinateLimit bounds |x|, |y| and |z|, 0 only rejects NaN and infinity
+    static bool check(const PlanLayer *layers, int layerCount, const SpotSonicationParameter &parameter,
+                      Coordinate coordinateLimit, QThreadPool *pool, PlanError &error);
+
+private:
+    static void setError(PlanError &error, quint32 code, int layer, int index, const QString &message);
+    static bool checkOrder(const int *order, int count, int spotCount, int &badIndex);
+    static bool checkCoordinates(const Spot3DCoordinate *spots, int count, Coordinate limit, int &badIndex);
+};
+
+#endif // PLANVALIDATOR_H
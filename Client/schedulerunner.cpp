@@ -0,0 +1,154 @@
+#include <QtMath>
+#include <QLoggingCategory>
+
+#include "schedulerunner.h"
+
+Q_DECLARE_LOGGING_CATEGORY(CLIENT)
+
+#define SPIN_WINDOW 2000000    // ns spun on the clock before a due time, covers the timer slack
+
+ScheduleRunner::ScheduleRunner(QObject *parent) : QObject(parent),
+    m_next(0), m_start(0)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(wake()));
+
+    m_clock.start();
+    resetStats();
+}
+
+// A new schedule replaces the one still running
+bool ScheduleRunner::start(qint64 startDelay, const QVector<ScheduledCommand> &schedule, PlanError *error)
+{
+    PlanError checked;
+    if (!check(startDelay, schedule, checked))
+    {
+        qCWarning(CLIENT()) << CLIENT().categoryName() << "Schedule refused:" << checked.message;
+        if (error)
+            *error = checked;
+        return false;
+    }
+
+    m_schedule = schedule;
+    m_next = 0;
+    m_start = m_clock.nsecsElapsed() + startDelay * 1000;
+
+    qCDebug(CLIENT()) << CLIENT().categoryName() << "Schedule of" << schedule.size()
+                      << "commands starts in" << startDelay << "us";
+    arm();
+    return true;
+}
+
+// wake() walks the schedule in order, so offsets may never go back; only known commands are fired
+bool ScheduleRunner::check(qint64 startDelay, const QVector<ScheduledCommand> &schedule, PlanError &error)
+{
+    error.code = PLAN_SCHEDULE;
+    error.layer = -1;
+    error.index = -1;
+    if (startDelay < 0 || startDelay > SCHEDULE_MAX_SPAN)
+    {
+        error.message = QString("Start delay %1 us out of [0, %2].").arg(startDelay).arg(SCHEDULE_MAX_SPAN);
+        return false;
+    }
+    for (int i = 0; i < schedule.size(); i++)
+    {
+        const ScheduledCommand &command = schedule.at(i);
+        error.index = i;
+        if (command.offset < 0 || command.offset > SCHEDULE_MAX_SPAN)
+        {
+            error.message = QString("Offset %1 us out of [0, %2].").arg(command.offset).arg(SCHEDULE_MAX_SPAN);
+            return false;
+        }
+        if (i > 0 && command.offset < schedule.at(i - 1).offset)
+        {
+            error.message = QString("Offset %1 us comes before the previous one.").arg(command.offset);
+            return false;
+        }
+        if (command.command < START || command.command > RESUME)
+        {
+            error.message = QString("Unknown command %1.").arg(command.command);
+            return false;
+        }
+    }
+    error.code = PLAN_OK;
+    error.index = -1;
+    return true;
+}
+
+void ScheduleRunner::cancel()
+{
+    m_timer.stop();
+    m_schedule.clear();
+    m_next = 0;
+}
+
+void ScheduleRunner::arm()
+{
+    if (!isRunning())
+    {
+        m_schedule.clear();
+        m_next = 0;
+        emit finished();
+        return;
+    }
+
+    qint64 due = m_start + m_schedule.at(m_next).offset * 1000;
+    qint64 wait = due - SPIN_WINDOW - m_clock.nsecsElapsed();
+    m_timer.start(wait > 0 ? int(wait / 1000000) : 0);
+}
+
+void ScheduleRunner::wake()
+{
+    if (!isRunning())
+        return;
+
+    qint64 now = m_clock.nsecsElapsed();
+    qint64 due = m_start + m_schedule.at(m_next).offset * 1000;
+    if (due - now > SPIN_WINDOW)
+    {
+        arm();    // Woke up too early
+        return;
+    }
+    while (now < due)
+        now = m_clock.nsecsElapsed();
+
+//  Everything due by now fires together, in schedule order
+    while (isRunning() && m_start + m_schedule.at(m_next).offset * 1000 <= now)
+    {
+        const ScheduledCommand &command = m_schedule.at(m_next);
+        m_next += 1;
+        record((m_clock.nsecsElapsed() - (m_start + command.offset * 1000)) / 1000.0);
+        emit fire(command.command);
+        if (m_schedule.isEmpty())
+            return;    // Cancelled by a receiver of fire()
+    }
+    arm();
+}
+
+void ScheduleRunner::record(double lateness)
+{
+    m_count += 1;
+    double delta = lateness - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (lateness - m_mean);
+    m_max = qMax(m_max, lateness);
+}
+
+ScheduleStats ScheduleRunner::stats() const
+{
+    ScheduleStats stats;
+    stats.count = m_count;
+    stats.meanLateness = m_mean;
+    stats.maxLateness = m_max;
+    stats.jitter = m_count > 1 ? qSqrt(m_m2 / (m_count - 1)) : 0;
+    return stats;
+}
+
+void ScheduleRunner::resetStats()
+{
+    m_count = 0;
+    m_mean = 0;
+    m_m2 = 0;
+    m_max = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef SCHEDULERUNNER_H
+#define SCHEDULERUNNER_H
+
+#include <QObject>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "protocol.h"
+
+//  Lateness of the fired commands against their due time, in microseconds
+struct ScheduleStats
+{
+    int count;
+    double meanLateness;
+    double maxLateness;
+    double jitter;    // Standard deviation of the lateness
+};
+
+//  Fires the commands of a received schedule from the local clock, so the
+//  phase timing no longer depends on the network. A precise timer wakes up
+//  shortly before each due time and the last stretch is spun on the clock.
+class ScheduleRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    ScheduleRunner(QObject *parent = 0);
+
+    // A schedule that fails check() is refused and the one running is left alone
+    bool start(qint64 startDelay, const QVector<ScheduledCommand> &schedule, PlanError *error = 0);
+    static bool check(qint64 startDelay, const QVector<ScheduledCommand> &schedule, PlanError &error);
+    void cancel();
+    inline bool isRunning() const { return m_next < m_schedule.size(); }
+    ScheduleStats stats() const;
+    void resetStats();
+
+signals:
+    void fire(int command);
+    void finished();
+
+private slots:
+    void wake();
+
+private:
+    QVector<ScheduledCommand> m_schedule;
+    int m_next;
+    QElapsedTimer m_clock;
+    qint64 m_start;    // Clock time of offset 0 in ns
+    QTimer m_timer;
+
+    int m_count;
+    double m_mean, m_m2, m_max;    // Running lateness statistics
+    void arm();
+    void record(double lateness);
+};
+
+#endif // SCHEDULERUNNER_H
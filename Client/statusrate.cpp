@@ -0,0 +1,76 @@
+#include "statusrate.h"
+
+#define RTT_GAIN 0.125    // Weight of a new sample in the smoothed RTT
+#define RTT_CONGESTED 2.0    // RTT above this many times the best one counts as congestion
+
+StatusRateController::StatusRateController() :
+    m_minInterval(50), m_maxInterval(1000), m_serverInterval(0), m_lastRtt(0)
+{
+    m_metrics.interval = m_maxInterval;
+    m_metrics.floor = m_minInterval;
+    m_metrics.smoothedRtt = 0;
+    m_metrics.minRtt = 0;
+    m_metrics.queuedBytes = 0;
+    m_metrics.sentCount = 0;
+    m_metrics.skippedCount = 0;
+    m_metrics.backoffCount = 0;
+    m_metrics.speedupCount = 0;
+}
+
+void StatusRateController::setBounds(int minInterval, int maxInterval)
+{
+    m_minInterval = qMax(minInterval, 1);
+    m_maxInterval = qMax(maxInterval, m_minInterval);
+    m_metrics.floor = floor();
+    m_metrics.interval = qBound(m_metrics.floor, m_metrics.interval, m_maxInterval);
+}
+
+void StatusRateController::setServerInterval(int serverInterval)
+{
+    m_serverInterval = serverInterval;
+    m_metrics.floor = floor();
+    m_metrics.interval = qBound(m_metrics.floor, m_metrics.interval, m_maxInterval);
+}
+
+void StatusRateController::addRttSample(qint64 rtt)
+{
+    m_lastRtt = rtt;
+    if (m_metrics.smoothedRtt == 0)
+        m_metrics.smoothedRtt = rtt;
+    else
+        m_metrics.smoothedRtt += RTT_GAIN * (rtt - m_metrics.smoothedRtt);
+    if (m_metrics.minRtt == 0 || rtt < m_metrics.minRtt)
+        m_metrics.minRtt = rtt;
+}
+
+int StatusRateController::floor() const
+{
+    int lowest = qMax(m_minInterval, m_serverInterval);
+    return qMin(qMax(lowest, int(2 * m_metrics.smoothedRtt)), m_maxInterval);
+}
+
+int StatusRateController::update(qint64 queuedBytes, bool sent)
+{
+    m_metrics.queuedBytes = queuedBytes;
+    if (sent)
+        m_metrics.sentCount += 1;
+    else
+        m_metrics.skippedCount += 1;
+
+    bool congested = !sent || queuedBytes > 0 ||
+            (m_metrics.minRtt > 0 && m_lastRtt > RTT_CONGESTED * m_metrics.minRtt);
+    int interval = m_metrics.interval;
+    if (congested)
+        interval *= 2;
+    else
+        interval -= qMax(interval / 8, 1);
+
+    m_metrics.floor = floor();
+    interval = qBound(m_metrics.floor, interval, m_maxInterval);
+    if (interval > m_metrics.interval)
+        m_metrics.backoffCount += 1;
+    else if (interval < m_metrics.interval)
+        m_metrics.speedupCount += 1;
+    m_metrics.interval = interval;
+    return interval;
+}
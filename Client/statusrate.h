@@ -0,0 +1,47 @@
+#ifndef STATUSRATE_H
+#define STATUSRATE_H
+
+#include <QtGlobal>
+
+//  What the controller saw and decided, for display or logging
+struct StatusRateMetrics
+{
+    int interval;    // Current status interval in ms
+    int floor;    // Lowest interval allowed right now
+    double smoothedRtt;    // ms, 0 until the first sample
+    double minRtt;
+    qint64 queuedBytes;    // Status bytes still waiting to leave at the last tick
+    int sentCount;
+    int skippedCount;    // Ticks dropped because the previous status was still on its way
+    int backoffCount;
+    int speedupCount;
+};
+
+//  Chooses the interval between status frames. Congestion (status still
+//  queued, or RTT well above the best seen) doubles the interval, a clear
+//  link shortens it by an eighth, always within [floor, maximum] where the
+//  floor is the configured minimum, the server's limit and two RTTs.
+class StatusRateController
+{
+public:
+    StatusRateController();
+
+    void setBounds(int minInterval, int maxInterval);
+    void setServerInterval(int serverInterval);    // From the hello, 0 for no limit
+    void addRttSample(qint64 rtt);
+
+    int update(qint64 queuedBytes, bool sent);    // Once per tick, returns the next interval
+
+    inline int interval() const { return m_metrics.interval; }
+    inline StatusRateMetrics metrics() const { return m_metrics; }
+
+private:
+    int m_minInterval, m_maxInterval;
+    int m_serverInterval;
+    double m_lastRtt;
+    StatusRateMetrics m_metrics;
+
+    int floor() const;
+};
+
+#endif // STATUSRATE_H
@@ -0,0 +1,86 @@
+#include "timeline.h"
+#include "constant.h"
+#include "planvalidator.h"
+
+Timeline::Timeline() : m_duration(0), m_valid(false)
+{
+    m_session.spotCount = 0;
+    m_session.periodCount = 0;
+    m_session.dutyOn = 0;
+    m_session.dutyOff = 0;
+    m_session.coolingTime = 0;
+}
+
+void Timeline::clear()
+{
+    m_steps.clear();
+    m_duration = 0;
+    m_valid = false;
+    m_errorString.clear();
+}
+
+bool Timeline::compile(const PlanLayer *layers, int layerCount, const SpotSonicationParameter &parameter)
+{
+    clear();
+    PlanError error;
+    if (!PlanValidator::checkParameter(parameter, error))
+    {
+        m_errorString = error.message;
+        return false;
+    }
+
+    qint64 period = qint64(parameter.period) * MS_UNIT;
+    qint64 dutyOn = period * parameter.dutyCycle / PERCENT_UNIT;
+    qint64 cooling = qint64(parameter.coolingTime) * MS_UNIT;
+
+    m_session.spotCount = 0;
+    for (int i = 0; i < layerCount; i++)
+        m_session.spotCount += layers[i].orderCount > 0 ? layers[i].orderCount : layers[i].spotCount;
+    m_session.periodCount = int(qint64(parameter.totalTime) * MS_UNIT / parameter.period);
+    m_session.dutyOn = int(dutyOn / MS_UNIT);
+    m_session.dutyOff = parameter.period - m_session.dutyOn;
+    m_session.coolingTime = parameter.coolingTime;
+
+//  A full duty cycle is one pulse per spot
+    int pulseCount = (dutyOn < period) ? m_session.periodCount : 1;
+    qint64 pulseLength = (dutyOn < period) ? dutyOn : m_session.periodCount * period;
+    qint64 pulseStride = (dutyOn < period) ? period : pulseLength;
+    m_steps.reserve(m_session.spotCount * pulseCount);
+
+    qint64 time = 0;
+    for (int i = 0; i < layerCount; i++)
+    {
+        const PlanLayer &layer = layers[i];
+        int count = layer.orderCount > 0 ? layer.orderCount : layer.spotCount;
+        for (int j = 0; j < count; j++)
+        {
+            int spot = layer.orderCount > 0 ? layer.order[j] : j;
+            const Spot3DCoordinate &coordinate = layer.spots[spot];
+            for (int k = 0; k < pulseCount; k++)
+            {
+                TimelineStep step;
+                step.x = coordinate.x;
+                step.y = coordinate.y;
+                step.z = coordinate.z;
+                step.onTime = time + k * pulseStride;
+                step.offTime = step.onTime + pulseLength;
+                step.layer = i;
+                step.spot = spot;
+                m_steps.append(step);
+            }
+            time += m_session.periodCount * period + cooling;
+        }
+    }
+    m_duration = time > 0 ? time - cooling : 0;
+    m_valid = true;
+    return true;
+}
+
+const TimelineStep *Timeline::stepAt(qint64 time, int &cursor) const
+{
+    while (cursor < m_steps.size() && m_steps.at(cursor).offTime <= time)
+        cursor += 1;
+    if (cursor < m_steps.size() && m_steps.at(cursor).onTime <= time)
+        return &m_steps.at(cursor);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <QVector>
+#include <QString>
+
+#include "variable.h"
+#include "planarena.h"
+
+//  One sonication pulse of a spot, times in us from the start of the plan
+struct TimelineStep
+{
+    Coordinate x, y, z;
+    qint64 onTime;
+    qint64 offTime;
+    int layer;    // Index into the plan layers, in depth order
+    int spot;    // Index of the spot in its layer
+};
+
+//  The received plan compiled into its pulses in execution order: layers by
+//  depth, spots in the spot order, every period of every spot. The plan is
+//  checked by PlanValidator once before it is compiled, so the control loop
+//  only reads the array front to back.
+class Timeline
+{
+public:
+    Timeline();
+
+    // The order indices must already have passed PlanValidator::check()
+    bool compile(const PlanLayer *layers, int layerCount, const SpotSonicationParameter &parameter);
+    void clear();
+
+    inline bool isValid() const { return m_valid; }
+    inline QString errorString() const { return m_errorString; }
+    inline SessionParam getSessionParam() const { return m_session; }
+
+    inline int size() const { return m_steps.size(); }
+    inline const TimelineStep *steps() const { return m_steps.constData(); }
+    inline const TimelineStep &at(int index) const { return m_steps.at(index); }
+    inline qint64 duration() const { return m_duration; }
+
+    // Step to run at time, or 0 between pulses. The cursor only moves forward,
+    // so a control loop polling with increasing times reads each step once.
+    const TimelineStep *stepAt(qint64 time, int &cursor) const;
+
+private:
+    QVector<TimelineStep> m_steps;
+    SessionParam m_session;
+    qint64 m_duration;
+    bool m_valid;
+    QString m_errorString;
+};
+
+#endif // TIMELINE_H
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Flight tool: prints the timeline of a flight recorder dump
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+TARGET = Flight
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../lib/common
+
+SOURCES += main.cpp \
+        flightprinter.cpp
+
+HEADERS += flightprinter.h
@@ -0,0 +1,176 @@
+#include <QAbstractSocket>
+#include <QDateTime>
+#include <QMetaEnum>
+#include <QVector>
+
+#include "flightprinter.h"
+#include "variable.h"
+#include "protocol.h"
+#include "tracefile.h"
+
+//  In the order of Server::Error
+static const char *const serverErrors[] = {
+    "NoError", "ErrorSend", "ErrorReadReceipt", "ErrorReceive", "ErrorNegotiate", "ErrorRejected", "ErrorCommand"
+};
+
+//  In the order of PlanErrorCode
+static const char *const planErrors[] = {
+    "PLAN_OK", "PLAN_MALFORMED", "PLAN_LENGTH_MISMATCH", "PLAN_ORDER_RANGE", "PLAN_COORDINATE_RANGE",
+    "PLAN_PARAMETER_RANGE"
+};
+
+FlightPrinter::FlightPrinter(const FlightReader &reader) :
+    m_reader(reader), m_context(-1), m_csv(false)
+{
+}
+
+void FlightPrinter::print(QTextStream &out)
+{
+    const QVector<FlightEvent> &events = m_reader.events();
+
+//  With a context only the events leading to an error are kept
+    QVector<bool> shown(events.size(), m_context < 0);
+    if (m_context >= 0)
+    {
+        for (int i = 0; i < events.size(); i++)
+        {
+            if (events.at(i).kind != FLIGHT_ERROR && events.at(i).kind != FLIGHT_SOCKET_ERROR)
+                continue;
+            for (int j = qMax(0, i - m_context); j <= i; j++)
+                shown[j] = true;
+        }
+    }
+
+    if (m_csv)
+    {
+        out << "time_ns,peer,event,type,size,detail\n";
+    }
+    else
+    {
+        out << "Flight recorder of the " << (m_reader.side() == TRACE_SERVER ? "server" : "client")
+            << ", started " << QDateTime::fromMSecsSinceEpoch(m_reader.startTime()).toString(Qt::ISODate)
+            << ", " << events.size() << " events\n";
+        out << qSetFieldWidth(14) << "time ms" << qSetFieldWidth(12) << "delta us" << qSetFieldWidth(0) << "  "
+            << qSetFieldWidth(12) << left << "peer" << "event" << "type" << qSetFieldWidth(10) << right << "size"
+            << qSetFieldWidth(12) << "detail" << qSetFieldWidth(0) << "\n";
+    }
+
+    qint64 previous = -1;
+    for (int i = 0; i < events.size(); i++)
+    {
+        const FlightEvent &event = events.at(i);
+        if (!shown.at(i) || !selected(event))
+            continue;
+
+        if (m_csv)
+        {
+            out << event.time << ',' << peerName(event) << ',' << kindName(event) << ','
+                << typeName(event) << ',' << event.size << ',' << event.detail << '\n';
+            continue;
+        }
+
+        double delta = previous < 0 ? 0 : (event.time - previous) / 1e3;
+        previous = event.time;
+        out << qSetFieldWidth(14) << fixed << qSetRealNumberPrecision(3) << event.time / 1e6
+            << qSetFieldWidth(12) << qSetRealNumberPrecision(1) << delta << qSetFieldWidth(0) << "  "
+            << qSetFieldWidth(12) << left << peerName(event) << kindName(event) << typeName(event)
+            << qSetFieldWidth(10) << right << event.size << qSetFieldWidth(12) << event.detail
+            << qSetFieldWidth(0) << "\n";
+    }
+    out.flush();
+}
+
+bool FlightPrinter::selected(const FlightEvent &event) const
+{
+    return m_peer.isEmpty() || peerName(event) == m_peer;
+}
+
+QString FlightPrinter::peerName(const FlightEvent &event) const
+{
+    if (event.peer < m_reader.peers().size())
+        return m_reader.peers().at(event.peer);
+    return QString::number(event.peer);
+}
+
+QString FlightPrinter::kindName(const FlightEvent &event) const
+{
+    switch (event.kind) {
+    case FLIGHT_CONNECT:
+        return "CONNECT";
+    case FLIGHT_FRAME_IN:
+        return "IN";
+    case FLIGHT_FRAME_OUT:
+        return "OUT";
+    case FLIGHT_RECEIPT:
+        return "RECEIPT";
+    case FLIGHT_ACK:
+        return "ACK";
+    case FLIGHT_ERROR:
+        return "ERROR";
+    case FLIGHT_SOCKET_ERROR:
+        return "SOCKET_ERROR";
+    case FLIGHT_MARK:
+        return "MARK";
+    default:
+        return QString::number(event.kind);
+    }
+}
+
+QString FlightPrinter::typeName(const FlightEvent &event) const
+{
+    switch (event.kind) {
+    case FLIGHT_CONNECT:
+    case FLIGHT_FRAME_IN:
+    case FLIGHT_FRAME_OUT:
+        return frameName(event.type);
+    case FLIGHT_RECEIPT:
+        return event.type ? "match" : "mismatch";
+    case FLIGHT_ACK:
+        return event.type == COMMAND_DONE ? "done" : "unknown";
+    case FLIGHT_ERROR:
+        if (m_reader.side() == TRACE_SERVER && event.type < sizeof(serverErrors) / sizeof(serverErrors[0]))
+            return serverErrors[event.type];
+        if (m_reader.side() == TRACE_CLIENT && event.type < sizeof(planErrors) / sizeof(planErrors[0]))
+            return planErrors[event.type];
+        return QString::number(event.type);
+    case FLIGHT_SOCKET_ERROR:
+    {
+        const char *key = QMetaEnum::fromType<QAbstractSocket::SocketError>().valueToKey(event.type);
+        return key ? QString(key) : QString::number(event.type);
+    }
+    default:
+        return QString::number(event.type);
+    }
+}
+
+QString FlightPrinter::frameName(int type)
+{
+    switch (type) {
+    case 0:
+        return "-";
+    case COMMAND:
+        return "COMMAND";
+    case PLAN:
+        return "PLAN";
+    case STATUS:
+        return "STATUS";
+    case HELLO:
+        return "HELLO";
+    case SCHEDULE:
+        return "SCHEDULE";
+    case SYNC:
+        return "SYNC";
+    case REJECT:
+        return "REJECT";
+    case ACK:
+        return "ACK";
+    case ANNOUNCE:
+        return "ANNOUNCE";
+    case NACK:
+        return "NACK";
+    case TRACE_RECEIPT:
+        return "RECEIPT";
+    default:
+        return QString::number(type);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef FLIGHTPRINTER_H
+#define FLIGHTPRINTER_H
+
+#include <QString>
+#include <QTextStream>
+
+#include "flightrecorder.h"
+
+//  Turns the events of a dump into one line each, with the time since the
+//  recorder started and since the previous line, peers and codes by name.
+class FlightPrinter
+{
+public:
+    FlightPrinter(const FlightReader &reader);
+
+    inline void setPeer(QString peer) { m_peer = peer; }    // Only the events of this peer
+    inline void setContext(int context) { m_context = context; }    // Only the N events before each error, -1 for all
+    inline void setCsv(bool csv) { m_csv = csv; }
+
+    void print(QTextStream &out);
+
+private:
+    const FlightReader &m_reader;
+    QString m_peer;
+    int m_context;
+    bool m_csv;
+
+    bool selected(const FlightEvent &event) const;
+    QString peerName(const FlightEvent &event) const;
+    QString kindName(const FlightEvent &event) const;
+    QString typeName(const FlightEvent &event) const;
+    static QString frameName(int type);
+};
+
+#endif // FLIGHTPRINTER_H
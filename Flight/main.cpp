@@ -0,0 +1,46 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QTextStream>
+
+#include "flightprinter.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Flight");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Print the timeline of a flight recorder dump of a Client or Server.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dump", "File written by dumpFlightRecorder() or on an error.");
+    QCommandLineOption peerOption(QStringList() << "p" << "peer",
+                                  "Only the events of this peer.", "name");
+    QCommandLineOption contextOption(QStringList() << "c" << "context",
+                                     "Only the events before each error, this many.", "count");
+    QCommandLineOption csvOption("csv", "Print CSV instead of aligned columns.");
+    parser.addOption(peerOption);
+    parser.addOption(contextOption);
+    parser.addOption(csvOption);
+    parser.process(a);
+
+    if (parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    FlightReader reader;
+    if (!reader.open(parser.positionalArguments().first()))
+    {
+        QTextStream(stderr) << "Not a flight recorder dump: " << parser.positionalArguments().first() << "\n";
+        return 1;
+    }
+
+    FlightPrinter printer(reader);
+    printer.setPeer(parser.value(peerOption));
+    if (parser.isSet(contextOption))
+        printer.setContext(parser.value(contextOption).toInt());
+    printer.setCsv(parser.isSet(csvOption));
+
+    QTextStream out(stdout);
+    printer.print(out);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Observer: read-only console of the statuses a Server republishes
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+TARGET = Observer
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../lib/common
+
+SOURCES += main.cpp \
+        observerconsole.cpp
+
+HEADERS += observerconsole.h
@@ -0,0 +1,42 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QTimer>
+
+#include "observerconsole.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Observer");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Print the statuses a Server republishes to observers. With several "
+                                     "subscriptions only rates and drops are reported, to load the fan-out.");
+    parser.addHelpOption();
+    QCommandLineOption serverOption(QStringList() << "s" << "server",
+                                    "Observer port of the Server.", "ip:port", "127.0.0.1:6669");
+    QCommandLineOption countOption(QStringList() << "n" << "subscriptions",
+                                   "Subscriptions opened from this process.", "count", "1");
+    QCommandLineOption reportOption(QStringList() << "r" << "report-interval",
+                                    "Seconds between reports.", "seconds", "10");
+    parser.addOption(serverOption);
+    parser.addOption(countOption);
+    parser.addOption(reportOption);
+    parser.process(a);
+
+    QStringList server = parser.value(serverOption).split(':');
+    int count = parser.value(countOption).toInt();
+    int reportInterval = parser.value(reportOption).toInt();
+    if (server.size() != 2 || count <= 0 || reportInterval <= 0)
+        parser.showHelp(1);
+
+    ObserverConsole console;
+    console.subscribe(server.at(0), server.at(1).toUShort(), count);
+
+    QTimer reportTimer;
+    QObject::connect(&reportTimer, SIGNAL(timeout()), &console, SLOT(report()));
+    reportTimer.start(reportInterval * 1000);
+
+    return a.exec();
+}
@@ -0,0 +1,145 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDateTime>
+#include <QStringList>
+#include <QTextStream>
+#include <QtEndian>
+
+#include "observerconsole.h"
+
+Q_LOGGING_CATEGORY(OBSERVER, "OBSERVER")
+
+#define FRAME_HEAD_SIZE (2 * sizeof(qint64))    // Header and total bytes
+
+ObserverConsole::ObserverConsole(QObject *parent) : QObject(parent)
+{
+    m_stats.statuses = 0;
+    m_stats.gaps = 0;
+    m_stats.delaySum = 0;
+    m_reported = m_stats;
+    m_reportClock.start();
+}
+
+void ObserverConsole::subscribe(const QString &address, quint16 port, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        Subscription subscription;
+        subscription.sequence = 0;
+        m_subscriptions.insert(socket, subscription);
+
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readFrames()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(closeSubscription()));
+        connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                this, SLOT(displayError(QAbstractSocket::SocketError)));
+        socket->connectToHost(address, port);
+    }
+    qCDebug(OBSERVER()) << OBSERVER().categoryName() << "Subscribing" << count << "times to" << address << port;
+}
+
+// A frame may arrive in several chunks, or several frames in one
+void ObserverConsole::readFrames()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || !m_subscriptions.contains(socket))
+        return;
+
+    Subscription &subscription = m_subscriptions[socket];
+    subscription.buffer.append(socket->readAll());
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    while (subscription.buffer.size() >= int(FRAME_HEAD_SIZE))
+    {
+        const uchar *head = reinterpret_cast<const uchar *>(subscription.buffer.constData());
+        qint64 totalBytes = qFromBigEndian<qint64>(head + sizeof(qint64));
+        if (totalBytes < qint64(FRAME_HEAD_SIZE) || totalBytes > MAX_PUBLISHED_BYTES)
+        {
+            qCWarning(OBSERVER()) << OBSERVER().categoryName() << "Bad frame size" << totalBytes;
+            subscription.buffer.clear();
+            socket->abort();
+            return;
+        }
+        if (subscription.buffer.size() < totalBytes)
+            break;    // Wait for the rest of the frame
+
+        QDataStream in(subscription.buffer.left(int(totalBytes)));
+        in.setVersion(QDataStream::Qt_4_6);
+        subscription.buffer.remove(0, int(totalBytes));
+
+        qint64 type;
+        quint32 flags;
+        QByteArray payload;
+        PublishedStatus published;
+        in >> type;
+        if ((type & HEADER_MASK) != PUBLISH || !decodeFrame(in, totalBytes, flags, payload)
+                || !decodePublished(payload, published))
+        {
+            qCWarning(OBSERVER()) << OBSERVER().categoryName() << "Failed to decode a published status.";
+            continue;
+        }
+
+        if (subscription.sequence != 0 && published.sequence > subscription.sequence + 1)
+            m_stats.gaps += qint64(published.sequence - subscription.sequence - 1);
+        subscription.sequence = published.sequence;
+        m_stats.statuses += 1;
+        m_stats.delaySum += now - published.received;
+
+        if (m_subscriptions.size() == 1)
+            printStatus(published);
+    }
+}
+
+void ObserverConsole::printStatus(const PublishedStatus &published)
+{
+    QStringList fields;
+    QHash<QString, QVariant>::const_iterator i;
+    for (i = published.status.constBegin(); i != published.status.constEnd(); ++i)
+        fields.append(i.key() + "=" + i.value().toString());
+    fields.sort();
+
+    QTextStream out(stdout);
+    out << published.sequence << " " << published.peer << " "
+        << QDateTime::fromMSecsSinceEpoch(published.received).toString("hh:mm:ss.zzz") << " "
+        << fields.join(' ') << "\n";
+}
+
+// Rates since the previous report; the delay only means something with the server on this host
+void ObserverConsole::report()
+{
+    double seconds = m_reportClock.restart() / 1000.0;
+    qint64 statuses = m_stats.statuses - m_reported.statuses;
+    double delay = statuses > 0 ? double(m_stats.delaySum - m_reported.delaySum) / statuses : 0;
+    int subscriptions = qMax(m_subscriptions.size(), 1);
+    qCDebug(OBSERVER()) << OBSERVER().categoryName() << m_subscriptions.size() << "subscriptions,"
+                        << (seconds > 0 ? statuses / seconds / subscriptions : 0) << "statuses/s each,"
+                        << m_stats.gaps - m_reported.gaps << "dropped by the server, mean delay" << delay << "ms";
+    m_reported = m_stats;
+}
+
+void ObserverConsole::closeSubscription()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+    m_subscriptions.remove(socket);
+    socket->deleteLater();
+    if (m_subscriptions.isEmpty())
+    {
+        qCDebug(OBSERVER()) << OBSERVER().categoryName() << "Server closed every subscription.";
+        QCoreApplication::exit(0);
+    }
+}
+
+void ObserverConsole::displayError(QAbstractSocket::SocketError socketError)
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || socketError == QAbstractSocket::RemoteHostClosedError)
+        return;
+    qCWarning(OBSERVER()) << OBSERVER().categoryName() << socket->errorString();
+    if (socket->state() == QAbstractSocket::UnconnectedState && m_subscriptions.remove(socket) > 0)
+    {
+        socket->deleteLater();
+        if (m_subscriptions.isEmpty())
+            QCoreApplication::exit(1);
+    }
+}
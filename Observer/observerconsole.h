@@ -0,0 +1,57 @@
+#ifndef OBSERVERCONSOLE_H
+#define OBSERVERCONSOLE_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QHash>
+#include <QLoggingCategory>
+
+#include "protocol.h"
+
+Q_DECLARE_LOGGING_CATEGORY(OBSERVER)
+
+#define MAX_PUBLISHED_BYTES (16 * 1024 * 1024)
+
+struct ObserverStats
+{
+    qint64 statuses;    // Over all subscriptions
+    qint64 gaps;    // Statuses the server dropped for a subscription that fell behind
+    qint64 delaySum;    // ms from the server receiving a status to it arriving here
+};
+
+//  Subscribes to the statuses a Server republishes on its [Observers] port.
+//  One subscription prints every status; several, all from this process,
+//  load the server's fan-out and only the counts are reported.
+class ObserverConsole : public QObject
+{
+    Q_OBJECT
+
+public:
+    ObserverConsole(QObject *parent = 0);
+
+    void subscribe(const QString &address, quint16 port, int count);
+
+public slots:
+    void report();
+
+private slots:
+    void readFrames();
+    void closeSubscription();
+    void displayError(QAbstractSocket::SocketError socketError);
+
+private:
+    struct Subscription
+    {
+        QByteArray buffer;    // Bytes of an incomplete frame
+        quint64 sequence;    // Of the last status, 0 before the first
+    };
+    QHash<QTcpSocket *, Subscription> m_subscriptions;
+
+    ObserverStats m_stats;
+    ObserverStats m_reported;    // At the previous report
+    QElapsedTimer m_reportClock;
+
+    void printStatus(const PublishedStatus &published);
+};
+
+#endif // OBSERVERCONSOLE_H
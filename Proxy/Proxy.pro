@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Proxy: impairs a loopback TCP link between Server and Client
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+CONFIG   += c++11
+
+TARGET = Proxy
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += main.cpp \
+        impairmentproxy.cpp
+
+HEADERS += impairmentproxy.h
@@ -0,0 +1,241 @@
+#include <QDebug>
+
+#include "impairmentproxy.h"
+
+Q_LOGGING_CATEGORY(PROXY, "PROXY")
+
+ProxyLink::ProxyLink(QTcpSocket *downstream, QString host, quint16 port, const Impairment &impairment,
+                     ProxyStats *stats, QObject *parent) : QObject(parent),
+    m_impairment(impairment), m_stats(stats), m_upstreamReady(false), m_done(false)
+{
+    QTcpSocket *upstream = new QTcpSocket(this);
+    downstream->setParent(this);
+
+    m_up.from = downstream;
+    m_up.to = upstream;
+    m_up.bytes = &m_stats->bytesUp;
+    m_down.from = upstream;
+    m_down.to = downstream;
+    m_down.bytes = &m_stats->bytesDown;
+    m_up.lastDue = m_up.wireFree = m_down.lastDue = m_down.wireFree = 0;
+    m_up.fromClosed = m_up.toClosed = m_down.fromClosed = m_down.toClosed = false;
+
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    connect(downstream, SIGNAL(readyRead()), this, SLOT(readDownstream()));
+    connect(downstream, SIGNAL(disconnected()), this, SLOT(downstreamClosed()));
+    connect(downstream, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(downstreamClosed()));
+    connect(upstream, SIGNAL(connected()), this, SLOT(upstreamConnected()));
+    connect(upstream, SIGNAL(readyRead()), this, SLOT(readUpstream()));
+    connect(upstream, SIGNAL(disconnected()), this, SLOT(upstreamClosed()));
+    connect(upstream, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(upstreamClosed()));
+
+    m_clock.start();
+    upstream->connectToHost(host, port);
+}
+
+void ProxyLink::readDownstream()
+{
+    read(m_up);
+}
+
+void ProxyLink::readUpstream()
+{
+    read(m_down);
+}
+
+//  The peer is gone: forward what it sent before, then close the other side
+void ProxyLink::downstreamClosed()
+{
+    if (m_done || m_up.fromClosed)
+        return;
+    read(m_up);
+    m_up.fromClosed = true;
+    m_down.toClosed = true;
+    m_down.queue.clear();
+    flush();
+}
+
+void ProxyLink::upstreamClosed()
+{
+    if (m_done || m_down.fromClosed)
+        return;
+    read(m_down);
+    m_down.fromClosed = true;
+    m_up.toClosed = true;
+    m_up.queue.clear();
+    flush();
+}
+
+void ProxyLink::upstreamConnected()
+{
+    m_upstreamReady = true;
+    flush();
+}
+
+void ProxyLink::flush()
+{
+    if (m_done)
+        return;
+    qint64 now = m_clock.nsecsElapsed();
+    send(m_up, now);
+    send(m_down, now);
+    finishIfDone();
+    schedule();
+}
+
+//  Cut what arrived into pieces and give each the time it leaves the link
+void ProxyLink::read(Direction &direction)
+{
+    if (m_done || direction.fromClosed)
+        return;
+    QByteArray data = direction.from->readAll();
+    if (data.isEmpty())
+        return;
+    *direction.bytes += data.size();
+
+    qint64 now = m_clock.nsecsElapsed();
+    int pieceSize = (m_impairment.fragment > 0) ? m_impairment.fragment : data.size();
+    for (int offset = 0; offset < data.size(); offset += pieceSize)
+    {
+        if (m_impairment.resetRate > 0 && qrand() / (RAND_MAX + 1.0) < m_impairment.resetRate)
+        {
+            reset();
+            return;
+        }
+
+        Piece piece;
+        piece.data = data.mid(offset, pieceSize);
+        piece.read = now;
+
+        qint64 delay = qint64(m_impairment.latency) * 1000000;
+        if (m_impairment.jitter > 0)
+            delay += qint64((qrand() / (RAND_MAX + 1.0) * 2 - 1) * m_impairment.jitter * 1000000);
+        piece.due = qMax(now + qMax(delay, qint64(0)), direction.lastDue);
+        if (m_impairment.bandwidth > 0)
+        {
+            direction.wireFree = qMax(direction.wireFree, now)
+                    + qint64(piece.data.size()) * 1000000000 / m_impairment.bandwidth;
+            piece.due = qMax(piece.due, direction.wireFree);
+        }
+        direction.lastDue = piece.due;
+        direction.queue.enqueue(piece);
+    }
+    schedule();
+}
+
+void ProxyLink::send(Direction &direction, qint64 now)
+{
+    if (direction.toClosed || (direction.to == m_up.to && !m_upstreamReady))
+        return;
+    while (!direction.queue.isEmpty() && direction.queue.head().due <= now)
+    {
+        Piece piece = direction.queue.dequeue();
+        direction.to->write(piece.data);
+        m_stats->pieces++;
+        m_stats->delaySum += (now - piece.read) / 1000;
+    }
+    if (direction.queue.isEmpty() && direction.fromClosed)
+    {
+        direction.toClosed = true;
+        direction.to->disconnectFromHost();
+    }
+}
+
+//  Drop both sides at once, the way a cable pull or a crashed peer would
+void ProxyLink::reset()
+{
+    m_stats->resets++;
+    qCDebug(PROXY()) << PROXY().categoryName() << "Reset the connection from"
+                     << m_up.from->peerAddress().toString() << m_up.from->peerPort();
+    m_done = true;
+    m_timer.stop();
+    m_up.queue.clear();
+    m_down.queue.clear();
+    m_up.from->abort();
+    m_down.from->abort();
+    emit finished();
+}
+
+void ProxyLink::finishIfDone()
+{
+    if (m_done || !m_up.fromClosed || !m_down.fromClosed)
+        return;
+    if (!m_up.queue.isEmpty() || !m_down.queue.isEmpty())
+        return;
+    m_done = true;
+    m_timer.stop();
+    emit finished();
+}
+
+//  Wake up when the earliest piece that can be written is due
+void ProxyLink::schedule()
+{
+    if (m_done)
+        return;
+    qint64 next = -1;
+    if (!m_up.queue.isEmpty() && m_upstreamReady && !m_up.toClosed)
+        next = m_up.queue.head().due;
+    if (!m_down.queue.isEmpty() && !m_down.toClosed)
+        next = (next < 0) ? m_down.queue.head().due : qMin(next, m_down.queue.head().due);
+    if (next < 0)
+    {
+        m_timer.stop();
+        return;
+    }
+    qint64 wait = (next - m_clock.nsecsElapsed() + 999999) / 1000000;
+    m_timer.start(int(qMax(wait, qint64(0))));
+}
+
+ImpairmentProxy::ImpairmentProxy(QObject *parent) : QObject(parent),
+    m_targetPort(0)
+{
+    m_impairment.latency = 0;
+    m_impairment.jitter = 0;
+    m_impairment.bandwidth = 0;
+    m_impairment.fragment = 0;
+    m_impairment.resetRate = 0;
+    m_stats.connections = 0;
+    m_stats.resets = 0;
+    m_stats.bytesUp = 0;
+    m_stats.bytesDown = 0;
+    m_stats.pieces = 0;
+    m_stats.delaySum = 0;
+
+    connect(&m_server, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+}
+
+bool ImpairmentProxy::listen(quint16 port, QString targetHost, quint16 targetPort)
+{
+    m_targetHost = targetHost;
+    m_targetPort = targetPort;
+    if (!m_server.listen(QHostAddress::Any, port))
+    {
+        qCDebug(PROXY()) << PROXY().categoryName() << "Cannot listen on" << port << m_server.errorString();
+        return false;
+    }
+    qCDebug(PROXY()) << PROXY().categoryName() << "Forwarding" << port << "to" << targetHost << targetPort;
+    return true;
+}
+
+void ImpairmentProxy::acceptConnection()
+{
+    while (m_server.hasPendingConnections())
+    {
+        QTcpSocket *socket = m_server.nextPendingConnection();
+        ProxyLink *link = new ProxyLink(socket, m_targetHost, m_targetPort, m_impairment, &m_stats, this);
+        connect(link, SIGNAL(finished()), link, SLOT(deleteLater()));
+        m_stats.connections++;
+    }
+}
+
+void ImpairmentProxy::report()
+{
+    double delay = m_stats.pieces > 0 ? double(m_stats.delaySum) / m_stats.pieces : 0;
+    qCDebug(PROXY()) << PROXY().categoryName() << m_stats.connections << "connections,"
+                     << m_stats.bytesUp << "bytes up," << m_stats.bytesDown << "bytes down,"
+                     << m_stats.pieces << "pieces, mean delay" << delay << "us,"
+                     << m_stats.resets << "resets";
+}
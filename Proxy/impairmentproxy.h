@@ -0,0 +1,118 @@
+#ifndef IMPAIRMENTPROXY_H
+#define IMPAIRMENTPROXY_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(PROXY)
+
+//  What the link does to the bytes, applied the same way in both directions
+struct Impairment
+{
+    int latency;    // ms added to every piece
+    int jitter;    // ms, the delay varies uniformly by up to this much either way
+    qint64 bandwidth;    // Bytes per second per direction, 0 for no cap
+    int fragment;    // Largest piece delivered at once, 0 forwards what was read
+    double resetRate;    // Chance for each piece read that the connection is dropped
+};
+
+//  Totals over every connection the proxy carried
+struct ProxyStats
+{
+    int connections;
+    int resets;
+    qint64 bytesUp;    // Towards the target
+    qint64 bytesDown;
+    qint64 pieces;
+    qint64 delaySum;    // us added to the pieces, queueing included
+};
+
+//  One accepted connection and its connection to the target. Bytes read on
+//  one side are cut into pieces, each given a due time from the latency,
+//  jitter and bandwidth of its direction, and written out in order when due.
+//  A side that closes is closed on the other once its queue has drained.
+class ProxyLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    ProxyLink(QTcpSocket *downstream, QString host, quint16 port, const Impairment &impairment,
+              ProxyStats *stats, QObject *parent = 0);
+
+signals:
+    void finished();
+
+private slots:
+    void readDownstream();
+    void readUpstream();
+    void downstreamClosed();
+    void upstreamClosed();
+    void upstreamConnected();
+    void flush();
+
+private:
+    struct Piece
+    {
+        qint64 due;    // ns on m_clock
+        qint64 read;
+        QByteArray data;
+    };
+
+    struct Direction
+    {
+        QTcpSocket *from;
+        QTcpSocket *to;
+        QQueue<Piece> queue;
+        qint64 lastDue;    // Pieces never overtake each other
+        qint64 wireFree;    // When the capped link has sent what is queued
+        bool fromClosed;
+        bool toClosed;
+        qint64 *bytes;
+    };
+
+    Impairment m_impairment;
+    ProxyStats *m_stats;
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+    bool m_upstreamReady;
+    bool m_done;
+
+    Direction m_up, m_down;
+
+    void read(Direction &direction);
+    void send(Direction &direction, qint64 now);
+    void reset();
+    void finishIfDone();
+    void schedule();
+};
+
+class ImpairmentProxy : public QObject
+{
+    Q_OBJECT
+
+public:
+    ImpairmentProxy(QObject *parent = 0);
+
+    bool listen(quint16 port, QString targetHost, quint16 targetPort);
+    inline void setImpairment(const Impairment &impairment) { m_impairment = impairment; }
+    inline ProxyStats stats() const { return m_stats; }
+
+public slots:
+    void report();
+
+private slots:
+    void acceptConnection();
+
+private:
+    QTcpServer m_server;
+    QString m_targetHost;
+    quint16 m_targetPort;
+    Impairment m_impairment;
+    ProxyStats m_stats;
+};
+
+#endif // IMPAIRMENTPROXY_H
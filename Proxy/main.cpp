@@ -0,0 +1,64 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QDateTime>
+#include <QTimer>
+
+#include "impairmentproxy.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Proxy");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Forward a TCP port with added latency, jitter, bandwidth cap, fragmentation "
+                                     "and resets. Run one instance for the plan port and one for the status port.");
+    parser.addHelpOption();
+    QCommandLineOption listenOption(QStringList() << "l" << "listen",
+                                    "Port to accept connections on.", "port", "7666");
+    QCommandLineOption targetOption(QStringList() << "t" << "target",
+                                    "Address the connections are forwarded to.", "ip:port", "127.0.0.1:6666");
+    QCommandLineOption latencyOption("latency", "Delay added in each direction, in ms.", "ms", "0");
+    QCommandLineOption jitterOption("jitter", "Largest deviation from the delay, in ms.", "ms", "0");
+    QCommandLineOption bandwidthOption("bandwidth", "Bytes per second in each direction, 0 for no cap.", "bytes", "0");
+    QCommandLineOption fragmentOption("fragment", "Largest piece written at once, 0 to keep reads whole.", "bytes", "0");
+    QCommandLineOption resetOption("reset-rate", "Chance that a piece drops the connection.", "probability", "0");
+    QCommandLineOption seedOption("seed", "Seed of the random delays and resets.", "seed");
+    QCommandLineOption reportOption(QStringList() << "r" << "report-interval",
+                                    "Seconds between reports.", "seconds", "10");
+    parser.addOption(listenOption);
+    parser.addOption(targetOption);
+    parser.addOption(latencyOption);
+    parser.addOption(jitterOption);
+    parser.addOption(bandwidthOption);
+    parser.addOption(fragmentOption);
+    parser.addOption(resetOption);
+    parser.addOption(seedOption);
+    parser.addOption(reportOption);
+    parser.process(a);
+
+    QStringList target = parser.value(targetOption).split(':');
+    int reportInterval = parser.value(reportOption).toInt();
+    if (target.size() != 2 || reportInterval <= 0)
+        parser.showHelp(1);
+
+    Impairment impairment;
+    impairment.latency = parser.value(latencyOption).toInt();
+    impairment.jitter = parser.value(jitterOption).toInt();
+    impairment.bandwidth = parser.value(bandwidthOption).toLongLong();
+    impairment.fragment = parser.value(fragmentOption).toInt();
+    impairment.resetRate = parser.value(resetOption).toDouble();
+    qsrand(parser.isSet(seedOption) ? parser.value(seedOption).toUInt() : uint(QDateTime::currentMSecsSinceEpoch()));
+
+    ImpairmentProxy proxy;
+    proxy.setImpairment(impairment);
+    if (!proxy.listen(parser.value(listenOption).toUShort(), target.at(0), target.at(1).toUShort()))
+        return 1;
+
+    QTimer reportTimer;
+    QObject::connect(&reportTimer, SIGNAL(timeout()), &proxy, SLOT(report()));
+    reportTimer.start(reportInterval * 1000);
+
+    return a.exec();
+}
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Replay tool: drives a Client or Server from a captured trace
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+TARGET = Replay
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../lib/common
+
+SOURCES += main.cpp \
+        replayer.cpp
+
+HEADERS += replayer.h
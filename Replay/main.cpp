@@ -0,0 +1,50 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+
+#include "replayer.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay a captured HIFU network session against a Client or Server.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "Trace file written by startCapture().");
+    QCommandLineOption targetOption(QStringList() << "t" << "target",
+                                    "Address of the peer to drive.", "ip:port", "127.0.0.1:6666");
+    QCommandLineOption roleOption(QStringList() << "r" << "role",
+                                  "Side played by the replay: server or client.", "role", "server");
+    QCommandLineOption fastOption(QStringList() << "f" << "fast",
+                                  "Send as fast as possible instead of at original speed.");
+    QCommandLineOption reportOption(QStringList() << "o" << "report",
+                                    "Write per-frame latency as CSV.", "file");
+    parser.addOption(targetOption);
+    parser.addOption(roleOption);
+    parser.addOption(fastOption);
+    parser.addOption(reportOption);
+    parser.process(a);
+
+    if (parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    QStringList target = parser.value(targetOption).split(':');
+    if (target.size() != 2)
+        parser.showHelp(1);
+
+    Replayer replayer;
+    TraceSide role = (parser.value(roleOption) == "client") ? TRACE_CLIENT : TRACE_SERVER;
+    if (!replayer.load(parser.positionalArguments().first(), role))
+        return 1;
+
+    replayer.setTarget(target.at(0), target.at(1).toUShort());
+    replayer.setRealTime(!parser.isSet(fastOption));
+    replayer.setReportFile(parser.value(reportOption));
+
+    QObject::connect(&replayer, SIGNAL(finished()), &a, SLOT(quit()));
+    QMetaObject::invokeMethod(&replayer, "start", Qt::QueuedConnection);
+
+    return a.exec();
+}
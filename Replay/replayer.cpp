@@ -0,0 +1,199 @@
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+
+#include <algorithm>
+
+#include "replayer.h"
+
+Q_LOGGING_CATEGORY(REPLAY, "REPLAY")
+
+Replayer::Replayer(QObject *parent) : QObject(parent),
+    m_index(0), m_port(0), m_realTime(true), m_socket(0),
+    m_frameDone(true), m_bytesSent(0), m_errorCount(0)
+{
+    m_timeout.setSingleShot(true);
+    m_timeout.setInterval(5000);
+    connect(&m_timeout, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+Replayer::~Replayer()
+{
+}
+
+// Keep the frames the given role sent: its own outgoing frames,
+// or the incoming frames of a trace captured on the other side
+bool Replayer::load(QString fileName, TraceSide role)
+{
+    TraceReader reader;
+    if (!reader.open(fileName))
+    {
+        qCWarning(REPLAY()) << REPLAY().categoryName() << "Failed to open trace" << fileName;
+        return false;
+    }
+
+    TraceDirection direction = (reader.side() == role) ? TRACE_OUT : TRACE_IN;
+    TraceRecord record;
+    while (reader.readNext(record))
+    {
+//  Answers, and the multicast exchange whose chunks are not in the trace, are not replayed
+        if (record.direction == direction && record.type != TRACE_RECEIPT && record.type != ACK
+                && record.type != ANNOUNCE && record.type != NACK)
+            m_records.append(record);
+    }
+
+    qCDebug(REPLAY()) << REPLAY().categoryName() << "Loaded" << m_records.size() << "frames from" << fileName;
+    return !m_records.isEmpty();
+}
+
+void Replayer::start()
+{
+    m_index = 0;
+    m_bytesSent = 0;
+    m_errorCount = 0;
+    m_latencies.clear();
+    m_latencies.reserve(m_records.size());
+    m_clock.start();
+    scheduleNext();
+}
+
+// Wait for the original offset of the next frame, or go immediately when running as fast as possible
+void Replayer::scheduleNext()
+{
+    if (m_index >= m_records.size())
+    {
+        report();
+        emit finished();
+        return;
+    }
+
+    qint64 delay = 0;
+    if (m_realTime)
+    {
+        qint64 offset = m_records.at(m_index).timestamp - m_records.first().timestamp;
+        delay = (offset - m_clock.nsecsElapsed()) / 1000000;
+    }
+    QTimer::singleShot(int(qMax(delay, qint64(0))), Qt::PreciseTimer, this, SLOT(sendFrame()));
+}
+
+void Replayer::sendFrame()
+{
+    m_frameDone = false;
+    m_socket = new QTcpSocket(this);
+    connect(m_socket, SIGNAL(connected()), this, SLOT(connected()));
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readResponse()));
+    connect(m_socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+    connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(displayError(QAbstractSocket::SocketError)));
+
+    m_frameClock.start();
+    m_timeout.start();
+    m_socket->connectToHost(QHostAddress(m_ipAddress), m_port);
+}
+
+void Replayer::connected()
+{
+    const QByteArray &frame = m_records.at(m_index).frame;
+    m_socket->write(frame);
+    m_bytesSent += frame.size();
+}
+
+// A plan is complete when its receipt comes back, a sequenced command when its ack does
+void Replayer::readResponse()
+{
+    m_socket->readAll();
+    if (m_records.at(m_index).type == PLAN || m_records.at(m_index).type == COMMAND)
+        finishFrame(true);
+}
+
+// Commands and status are complete when the peer has read them and closed
+void Replayer::disconnected()
+{
+    finishFrame(m_records.at(m_index).type != PLAN);
+}
+
+void Replayer::timeout()
+{
+    qCWarning(REPLAY()) << REPLAY().categoryName() << "Frame" << m_index << "timed out.";
+    finishFrame(false);
+}
+
+void Replayer::displayError(QAbstractSocket::SocketError socketError)
+{
+    if (socketError == QAbstractSocket::RemoteHostClosedError)
+        return;
+    qCWarning(REPLAY()) << REPLAY().categoryName() << m_socket->errorString();
+    finishFrame(false);
+}
+
+void Replayer::finishFrame(bool ok)
+{
+    if (m_frameDone)
+        return;
+    m_frameDone = true;
+    m_timeout.stop();
+
+    m_latencies.append(ok ? m_frameClock.nsecsElapsed() : -1);
+    if (!ok)
+        m_errorCount += 1;
+
+    m_socket->disconnect(this);
+    m_socket->abort();
+    m_socket->deleteLater();
+    m_socket = 0;
+
+    m_index += 1;
+    scheduleNext();
+}
+
+void Replayer::report()
+{
+    double elapsed = m_clock.nsecsElapsed() / 1e9;
+
+    QVector<qint64> sorted;
+    for (int i = 0; i < m_latencies.size(); i++)
+    {
+        if (m_latencies.at(i) >= 0)
+            sorted.append(m_latencies.at(i));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    QTextStream out(stdout);
+    out << "Frames:      " << m_records.size() << " (" << m_errorCount << " failed)\n";
+    out << "Bytes sent:  " << m_bytesSent << "\n";
+    out << "Elapsed:     " << elapsed << " s\n";
+    if (elapsed > 0)
+    {
+        out << "Throughput:  " << m_bytesSent / elapsed / 1e6 << " MB/s, "
+            << m_records.size() / elapsed << " frames/s\n";
+    }
+    if (!sorted.isEmpty())
+    {
+        qint64 sum = 0;
+        for (int i = 0; i < sorted.size(); i++)
+            sum += sorted.at(i);
+        out << "Latency ms:  min " << sorted.first() / 1e6
+            << ", mean " << sum / sorted.size() / 1e6
+            << ", p50 " << sorted.at(sorted.size() / 2) / 1e6
+            << ", p99 " << sorted.at((sorted.size() - 1) * 99 / 100) / 1e6
+            << ", max " << sorted.last() / 1e6 << "\n";
+    }
+    out.flush();
+
+    if (m_reportFile.isEmpty())
+        return;
+
+    QFile file(m_reportFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qCWarning(REPLAY()) << REPLAY().categoryName() << "Failed to write report" << m_reportFile;
+        return;
+    }
+    QTextStream csv(&file);
+    csv << "index,type,bytes,latency_ns\n";
+    for (int i = 0; i < m_latencies.size(); i++)
+    {
+        csv << i << "," << m_records.at(i).type << ","
+            << m_records.at(i).frame.size() << "," << m_latencies.at(i) << "\n";
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef REPLAYER_H
+#define REPLAYER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QList>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+#include "variable.h"
+#include "tracefile.h"
+
+Q_DECLARE_LOGGING_CATEGORY(REPLAY)
+
+//  Drives a running Client or Server with the frames of a captured trace,
+//  one connection per frame as the libraries do, and reports throughput and latency.
+class Replayer : public QObject
+{
+    Q_OBJECT
+
+public:
+    Replayer(QObject *parent = 0);
+    ~Replayer();
+
+    bool load(QString fileName, TraceSide role);    // role: the side the replay plays
+    inline void setTarget(QString ipAddress, quint16 port) { m_ipAddress = ipAddress; m_port = port; }
+    inline void setRealTime(bool realTime) { m_realTime = realTime; }
+    inline void setTimeout(int msec) { m_timeout.setInterval(msec); }
+    inline void setReportFile(QString fileName) { m_reportFile = fileName; }
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void scheduleNext();
+    void sendFrame();
+    void connected();
+    void readResponse();
+    void disconnected();
+    void timeout();
+    void displayError(QAbstractSocket::SocketError);
+
+private:
+    QList<TraceRecord> m_records;    // Frames to drive into the target, in capture order
+    int m_index;
+
+    QString m_ipAddress;
+    quint16 m_port;
+    bool m_realTime;
+    QString m_reportFile;
+
+    QTcpSocket *m_socket;
+    QTimer m_timeout;
+    QElapsedTimer m_clock, m_frameClock;
+    bool m_frameDone;
+
+    QVector<qint64> m_latencies;    // Nanoseconds per frame, -1 on failure
+    qint64 m_bytesSent;
+    int m_errorCount;
+
+    void finishFrame(bool ok);
+    void report();
+};
+
+#endif // REPLAYER_H
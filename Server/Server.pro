@@ -4,10 +4,12 @@
 #
 #-------------------------------------------------
 
-QT       += network
+QT       += network concurrent
 
 QT       -= gui
 
+CONFIG   += c++11
+
 TARGET = Server
 TEMPLATE = lib
 
@@ -15,10 +17,27 @@ DEFINES += SERVER_LIBRARY
 
 INCLUDEPATH += ../lib/common
 
-SOURCES += server.cpp
+SOURCES += server.cpp \
+        planencoder.cpp \
+        orderoptimizer.cpp \
+        serverpeer.cpp \
+        statusdispatcher.cpp \
+        multicastsender.cpp \
+        scatterframe.cpp \
+        statuspublisher.cpp
 
 HEADERS += server.h\
-        server_global.h
+        server_global.h \
+        planencoder.h \
+        orderoptimizer.h \
+        serverpeer.h \
+        statusdispatcher.h \
+        transaction.h \
+        multicastsender.h \
+        scatterframe.h \
+        statuspublisher.h
+
+win32: LIBS += -lws2_32    # WSASend of ScatterFrame
 
 unix {
     target.path = /usr/lib
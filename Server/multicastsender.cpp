@@ -0,0 +1,188 @@
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include "multicastsender.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SERVER)
+
+MulticastSender::MulticastSender(QObject *parent) : QObject(parent),
+    m_port(0), m_rate(0)
+{
+//  A new range on every start, so a client never takes our chunks for those of an old transfer
+    m_nextTransfer = quint32(QDateTime::currentMSecsSinceEpoch());
+
+    m_stats.transfers = 0;
+    m_stats.datagrams = 0;
+    m_stats.bytesSent = 0;
+    m_stats.repairDatagrams = 0;
+    m_stats.fallbacks = 0;
+    m_stats.failedTransfers = 0;
+    m_stats.fallbackBytes = 0;
+    m_stats.unicastBytes = 0;
+
+    m_timer.setTimerType(Qt::PreciseTimer);
+    m_timer.setInterval(MULTICAST_TICK);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(sendPending()));
+}
+
+bool MulticastSender::open(const QString &group, quint16 port, int ttl, int rate)
+{
+    m_group = QHostAddress(group);
+    m_port = port;
+    m_rate = qMax(rate, 0);
+    if (!m_group.isMulticast() || port == 0)
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Not a multicast group:" << group << port;
+        return false;
+    }
+
+    m_socket.abort();
+    if (!m_socket.bind(QHostAddress(QHostAddress::AnyIPv4), 0))
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << m_socket.errorString();
+        return false;
+    }
+    m_socket.setSocketOption(QAbstractSocket::MulticastTtlOption, qMax(ttl, 1));
+    m_socket.setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);    // Clients on this host receive too
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Multicasting plans to" << group << port;
+    return true;
+}
+
+quint32 MulticastSender::start(const QByteArray &frame, int receivers)
+{
+    if (m_nextTransfer == 0)
+        m_nextTransfer += 1;    // 0 marks a unicast plan
+    Transfer transfer;
+    transfer.id = m_nextTransfer++;
+    transfer.frame = frame;
+    transfer.receivers = receivers;
+    transfer.bytesSent = 0;
+
+    if (m_transfers.size() >= MULTICAST_TRANSFERS)
+        m_transfers.removeFirst();
+    m_transfers.append(transfer);
+
+    m_stats.transfers += 1;
+    m_stats.unicastBytes += qint64(frame.size()) * receivers;
+
+    int count = chunkCount(frame.size());
+    for (int i = 0; i < count; i++)
+        enqueue(transfer.id, quint32(i), false);
+    sendPending();
+    return transfer.id;
+}
+
+bool MulticastSender::repair(quint32 transfer, const QVector<quint32> &chunks)
+{
+    Transfer *kept = findTransfer(transfer);
+    if (!kept)
+        return false;
+
+    quint32 count = quint32(chunkCount(kept->frame.size()));
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        if (chunks.at(i) < count)
+            enqueue(transfer, chunks.at(i), true);
+    }
+    sendPending();
+    return true;
+}
+
+void MulticastSender::countFallback(qint64 frameBytes)
+{
+    m_stats.fallbacks += 1;
+    m_stats.fallbackBytes += frameBytes;
+}
+
+MulticastSender::Transfer *MulticastSender::findTransfer(quint32 transfer)
+{
+    for (int i = 0; i < m_transfers.size(); i++)
+    {
+        if (m_transfers.at(i).id == transfer)
+            return &m_transfers[i];
+    }
+    return 0;
+}
+
+// Its chunks still queued are skipped by sendPending()
+void MulticastSender::dropTransfer(quint32 transfer)
+{
+    for (int i = 0; i < m_transfers.size(); i++)
+    {
+        if (m_transfers.at(i).id == transfer)
+        {
+            m_transfers.removeAt(i);
+            return;
+        }
+    }
+}
+
+void MulticastSender::enqueue(quint32 transfer, quint32 index, bool repair)
+{
+    quint64 key = (quint64(transfer) << 32) | index;
+    if (m_queued.contains(key))
+        return;    // Asked for by another receiver already
+    m_queued.insert(key);
+
+    Chunk chunk = { transfer, index, repair };
+    m_pending.enqueue(chunk);
+}
+
+// Up to the rate's share of MULTICAST_TICK, the rest on the next tick
+void MulticastSender::sendPending()
+{
+    qint64 budget = m_rate > 0 ? qint64(m_rate) * 1000 * MULTICAST_TICK : -1;
+    while (!m_pending.isEmpty() && budget != 0)
+    {
+        Chunk chunk = m_pending.head();
+        Transfer *transfer = findTransfer(chunk.transfer);
+        if (!transfer)
+        {
+//  Dropped for a newer transfer, its receivers fall back to unicast
+            m_queued.remove((quint64(chunk.transfer) << 32) | chunk.index);
+            m_pending.dequeue();
+            continue;
+        }
+
+        QByteArray datagram = encodeChunk(transfer->id, transfer->frame, int(chunk.index));
+        if (m_socket.writeDatagram(datagram, m_group, m_port) < 0)
+        {
+            if (m_socket.error() == QAbstractSocket::TemporaryError)
+                break;    // Socket buffer full, try again on the next tick
+
+//  Anything else will not clear up by waiting: without the transfer kept, its NACKs
+//  find nothing to repair and every receiver takes the frame by unicast
+            qCWarning(SERVER()) << SERVER().categoryName() << "Multicast transfer" << transfer->id << "failed:"
+                                << m_socket.errorString() << ", its receivers take it by unicast.";
+            m_stats.failedTransfers += 1;
+            dropTransfer(transfer->id);
+            continue;
+        }
+        m_pending.dequeue();
+        m_queued.remove((quint64(chunk.transfer) << 32) | chunk.index);
+
+        m_stats.datagrams += 1;
+        m_stats.bytesSent += datagram.size();
+        if (budget > 0)
+            budget = qMax(budget - datagram.size(), qint64(0));
+        if (chunk.repair)
+        {
+            m_stats.repairDatagrams += 1;
+            continue;
+        }
+
+        transfer->bytesSent += datagram.size();
+        if (int(chunk.index) == chunkCount(transfer->frame.size()) - 1)
+        {
+            qCDebug(SERVER()) << SERVER().categoryName() << "Multicast transfer" << transfer->id << "sent,"
+                              << transfer->bytesSent << "bytes for" << transfer->receivers << "receivers, unicast takes"
+                              << qint64(transfer->frame.size()) * transfer->receivers << "bytes";
+        }
+    }
+
+    if (m_pending.isEmpty())
+        m_timer.stop();
+    else if (!m_timer.isActive())
+        m_timer.start();
+}
@@ -0,0 +1,89 @@
+#ifndef MULTICASTSENDER_H
+#define MULTICASTSENDER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QByteArray>
+#include <QList>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+#include "protocol.h"
+
+#define MULTICAST_TICK 1    // ms between paced bursts of datagrams
+
+//  Bytes one plan took on the wire by multicast, against N unicasts of its frame
+struct MulticastStats
+{
+    qint64 transfers;
+    qint64 datagrams;    // Repairs included
+    qint64 bytesSent;    // Datagram headers and repairs included
+    qint64 repairDatagrams;
+    qint64 fallbacks;    // Frames a receiver took over its connection after all
+    qint64 failedTransfers;    // Dropped on a socket error, all their receivers fall back
+    qint64 fallbackBytes;
+    qint64 unicastBytes;    // Frame bytes times receivers, what unicast would have sent
+};
+
+//  Sends plan frames to a multicast group in chunks of MULTICAST_CHUNK, paced
+//  to a rate so a burst does not overrun the receivers' socket buffers. The
+//  last MULTICAST_TRANSFERS frames are kept to send chunks again on a NACK;
+//  a chunk asked for by several receivers goes once.
+class MulticastSender : public QObject
+{
+    Q_OBJECT
+
+public:
+    MulticastSender(QObject *parent = 0);
+
+    // rate in MB/s, 0 sends every chunk at once
+    bool open(const QString &group, quint16 port, int ttl, int rate);
+    inline bool isOpen() const { return m_socket.state() == QAbstractSocket::BoundState; }
+
+    // Id of the transfer for the ANNOUNCE, the chunks go out at once
+    quint32 start(const QByteArray &frame, int receivers);
+    // False when the transfer is no longer kept, the receiver then takes the frame by unicast
+    bool repair(quint32 transfer, const QVector<quint32> &chunks);
+    void countFallback(qint64 frameBytes);
+
+    inline MulticastStats stats() const { return m_stats; }
+
+private slots:
+    void sendPending();
+
+private:
+    QUdpSocket m_socket;
+    QHostAddress m_group;
+    quint16 m_port;
+    int m_rate;
+    QTimer m_timer;
+
+    struct Transfer
+    {
+        quint32 id;
+        QByteArray frame;
+        int receivers;
+        qint64 bytesSent;    // First pass only, for the log
+    };
+    QList<Transfer> m_transfers;    // Oldest first
+    quint32 m_nextTransfer;
+
+    struct Chunk
+    {
+        quint32 transfer;
+        quint32 index;
+        bool repair;
+    };
+    QQueue<Chunk> m_pending;
+    QSet<quint64> m_queued;    // transfer << 32 | index of the chunks in m_pending
+
+    MulticastStats m_stats;
+
+    Transfer *findTransfer(quint32 transfer);
+    void dropTransfer(quint32 transfer);
+    void enqueue(quint32 transfer, quint32 index, bool repair);
+};
+
+#endif // MULTICASTSENDER_H
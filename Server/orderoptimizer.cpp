@@ -0,0 +1,275 @@
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QtMath>
+
+#include <algorithm>
+
+#include "orderoptimizer.h"
+#include "constant.h"
+#include "parallel.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SERVER)
+
+#define GAIN_EPSILON 1e-9    // Smallest length gain worth a move
+
+static inline double distance(const Spot3DCoordinate &a, const Spot3DCoordinate &b)
+{
+    double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+    return qSqrt(dx * dx + dy * dy + dz * dz);
+}
+
+OrderOptimizer::OrderOptimizer() : m_minSpacing(0), m_speed(0), m_maxPasses(20)
+{
+}
+
+LayerIndex<QList<int> > OrderOptimizer::optimize(const LayerIndex<QList<Spot3DCoordinate> > &spot3D,
+                                                 const LayerIndex<QList<int> > &spotOrder,
+                                                 QThreadPool *pool, OrderReport &report) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int layerCount = spot3D.size();
+    QVector<LayerResult> results(layerCount);
+    parallelFor(pool, layerCount, [&](int i) {
+        results[i] = optimizeLayer(spot3D.at(i), spotOrder.value(spot3D.depthAt(i)));
+    });
+
+    LayerIndex<QList<int> > newOrder = spotOrder;
+    report.lengthBefore = 0;
+    report.lengthAfter = 0;
+    report.violationsBefore = 0;
+    report.violationsAfter = 0;
+    report.layerCount = layerCount;
+    for (int i = 0; i < layerCount; i++)
+    {
+        const LayerResult &result = results.at(i);
+        if (!result.order.isEmpty())
+            newOrder.insert(spot3D.depthAt(i), result.order);
+        report.lengthBefore += result.lengthBefore;
+        report.lengthAfter += result.lengthAfter;
+        report.violationsBefore += result.violationsBefore;
+        report.violationsAfter += result.violationsAfter;
+    }
+    report.timeSaved = m_speed > 0 ? (report.lengthBefore - report.lengthAfter) / m_speed * MS_UNIT : 0;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Reordered" << layerCount << "layers in"
+                      << timer.nsecsElapsed() / 1000 << "us, path" << report.lengthBefore << "->" << report.lengthAfter
+                      << ", spacing violations" << report.violationsBefore << "->" << report.violationsAfter;
+    return newOrder;
+}
+
+OrderOptimizer::LayerResult OrderOptimizer::optimizeLayer(const QList<Spot3DCoordinate> &spots, const QList<int> &order) const
+{
+    LayerResult result;
+    result.order = order;
+    result.lengthBefore = result.lengthAfter = 0;
+    result.violationsBefore = result.violationsAfter = 0;
+
+//  The spots to visit are those of the current order, every spot when there is none
+    QVector<int> visit;
+    if (order.isEmpty())
+    {
+        visit.resize(spots.size());
+        for (int i = 0; i < spots.size(); i++)
+            visit[i] = i;
+    }
+    else
+    {
+        visit = order.toVector();
+        for (int i = 0; i < visit.size(); i++)
+        {
+            if (visit.at(i) < 0 || visit.at(i) >= spots.size())
+                return result;    // Left for the client to reject
+        }
+    }
+
+    QVector<Spot3DCoordinate> points(visit.size());
+    QVector<int> current(visit.size());
+    for (int i = 0; i < visit.size(); i++)
+    {
+        points[i] = spots.at(visit.at(i));
+        current[i] = i;
+    }
+    result.lengthBefore = result.lengthAfter = pathLength(points, current);
+    result.violationsBefore = result.violationsAfter = violations(points, current);
+    if (points.size() < 3)
+        return result;
+
+    QVector<int> path;
+    nearestNeighbour(points, path);
+    for (int pass = 0; pass < m_maxPasses; pass++)
+    {
+        bool improved = twoOpt(points, path);
+        improved = orOpt(points, path) || improved;
+        if (!improved)
+            break;
+    }
+
+    double length = pathLength(points, path);
+    int violationCount = violations(points, path);
+    if (violationCount < result.violationsBefore ||
+            (violationCount == result.violationsBefore && length < result.lengthBefore))
+    {
+        result.order.clear();
+        result.order.reserve(path.size());
+        for (int i = 0; i < path.size(); i++)
+            result.order.append(visit.at(path.at(i)));
+        result.lengthAfter = length;
+        result.violationsAfter = violationCount;
+    }
+    return result;
+}
+
+// Greedy path from the current first spot, the nearest spot far enough away comes next
+void OrderOptimizer::nearestNeighbour(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const
+{
+    int count = points.size();
+    QVector<bool> visited(count, false);
+    path.clear();
+    path.reserve(count);
+
+    int last = 0;
+    visited[0] = true;
+    path.append(0);
+    for (int step = 1; step < count; step++)
+    {
+        int best = -1, fallback = -1;
+        double bestDistance = 0, fallbackDistance = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (visited.at(i))
+                continue;
+            double d = distance(points.at(last), points.at(i));
+            if (spaced(d) && (best < 0 || d < bestDistance))
+            {
+                best = i;
+                bestDistance = d;
+            }
+            if (fallback < 0 || d < fallbackDistance)
+            {
+                fallback = i;
+                fallbackDistance = d;
+            }
+        }
+        last = best >= 0 ? best : fallback;    // No spot is far enough, take the nearest
+        visited[last] = true;
+        path.append(last);
+    }
+}
+
+// Reverse path[i + 1 .. k] when it shortens the path; the first spot stays
+bool OrderOptimizer::twoOpt(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const
+{
+    int count = path.size();
+    bool improved = false;
+    for (int i = 0; i < count - 2; i++)
+    {
+        for (int k = i + 2; k < count; k++)
+        {
+            const Spot3DCoordinate &a = points.at(path.at(i));
+            const Spot3DCoordinate &b = points.at(path.at(i + 1));
+            const Spot3DCoordinate &c = points.at(path.at(k));
+            double ac = distance(a, c);
+            double gain = distance(a, b) - ac;
+            double bd = 0;
+            if (k + 1 < count)
+            {
+                const Spot3DCoordinate &d = points.at(path.at(k + 1));
+                bd = distance(b, d);
+                gain += distance(c, d) - bd;
+            }
+            if (gain > GAIN_EPSILON && spaced(ac) && (k + 1 >= count || spaced(bd)))
+            {
+                std::reverse(path.begin() + i + 1, path.begin() + k + 1);
+                improved = true;
+            }
+        }
+    }
+    return improved;
+}
+
+// Move a run of one to three spots, possibly reversed, to the edge where it costs least
+bool OrderOptimizer::orOpt(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const
+{
+    int count = path.size();
+    bool improved = false;
+    for (int length = 1; length <= 3; length++)
+    {
+        for (int i = 1; i + length <= count; i++)
+        {
+            const Spot3DCoordinate &first = points.at(path.at(i));
+            const Spot3DCoordinate &last = points.at(path.at(i + length - 1));
+            const Spot3DCoordinate &previous = points.at(path.at(i - 1));
+            bool hasNext = (i + length < count);
+
+            double removeGain = distance(previous, first);
+            if (hasNext)
+            {
+                const Spot3DCoordinate &next = points.at(path.at(i + length));
+                double bridge = distance(previous, next);
+                if (!spaced(bridge))
+                    continue;
+                removeGain += distance(last, next) - bridge;
+            }
+
+            int bestEdge = -1;
+            bool bestReversed = false;
+            double bestGain = GAIN_EPSILON;
+            for (int j = 0; j < count; j++)
+            {
+                if (j >= i - 1 && j <= i + length - 1)
+                    continue;    // Edges touching the run itself
+                const Spot3DCoordinate &a = points.at(path.at(j));
+                bool hasB = (j + 1 < count);
+                double base = hasB ? distance(a, points.at(path.at(j + 1))) : 0;
+
+                for (int reversed = 0; reversed < 2; reversed++)
+                {
+                    const Spot3DCoordinate &head = reversed ? last : first;
+                    const Spot3DCoordinate &tail = reversed ? first : last;
+                    double in = distance(a, head);
+                    double out = hasB ? distance(tail, points.at(path.at(j + 1))) : 0;
+                    double gain = removeGain - (in + out - base);
+                    if (gain > bestGain && spaced(in) && (!hasB || spaced(out)))
+                    {
+                        bestGain = gain;
+                        bestEdge = j;
+                        bestReversed = reversed;
+                    }
+                }
+            }
+            if (bestEdge < 0)
+                continue;
+
+            QVector<int> run = path.mid(i, length);
+            if (bestReversed)
+                std::reverse(run.begin(), run.end());
+            path.remove(i, length);
+            int position = (bestEdge < i ? bestEdge : bestEdge - length) + 1;
+            for (int k = 0; k < length; k++)
+                path.insert(position + k, run.at(k));
+            improved = true;
+        }
+    }
+    return improved;
+}
+
+double OrderOptimizer::pathLength(const QVector<Spot3DCoordinate> &points, const QVector<int> &path) const
+{
+    double length = 0;
+    for (int i = 1; i < path.size(); i++)
+        length += distance(points.at(path.at(i - 1)), points.at(path.at(i)));
+    return length;
+}
+
+int OrderOptimizer::violations(const QVector<Spot3DCoordinate> &points, const QVector<int> &path) const
+{
+    int count = 0;
+    for (int i = 1; i < path.size(); i++)
+    {
+        if (!spaced(distance(points.at(path.at(i - 1)), points.at(path.at(i)))))
+            count += 1;
+    }
+    return count;
+}
@@ -0,0 +1,62 @@
+#ifndef ORDEROPTIMIZER_H
+#define ORDEROPTIMIZER_H
+
+#include <QList>
+#include <QVector>
+#include <QThreadPool>
+
+#include "variable.h"
+#include "layerindex.h"
+
+//  Path length of a plan before and after reordering, lengths in coordinate units
+struct OrderReport
+{
+    double lengthBefore;
+    double lengthAfter;
+    double timeSaved;    // ms of transducer transit at the configured speed
+    int violationsBefore;    // Consecutive spots closer than the minimum spacing
+    int violationsAfter;
+    int layerCount;
+};
+
+//  Reorders the spots of every layer to shorten the transit between them:
+//  a nearest-neighbour path from the first spot of the current order, then
+//  2-opt and Or-opt moves until no move helps. Consecutive spots are kept at
+//  least the minimum spacing apart so a spot cools before its neighbour is
+//  heated. Layers are independent and run in parallel. A layer keeps its
+//  current order unless the new one is better.
+class OrderOptimizer
+{
+public:
+    OrderOptimizer();
+
+    inline void setMinSpacing(double minSpacing) { m_minSpacing = minSpacing; }
+    inline void setSpeed(double speed) { m_speed = speed; }    // Coordinate units per second, 0 skips the time estimate
+    inline void setMaxPasses(int maxPasses) { m_maxPasses = maxPasses; }
+
+    LayerIndex<QList<int> > optimize(const LayerIndex<QList<Spot3DCoordinate> > &spot3D,
+                                     const LayerIndex<QList<int> > &spotOrder,
+                                     QThreadPool *pool, OrderReport &report) const;
+
+private:
+    double m_minSpacing;
+    double m_speed;
+    int m_maxPasses;
+
+    struct LayerResult
+    {
+        QList<int> order;
+        double lengthBefore, lengthAfter;
+        int violationsBefore, violationsAfter;
+    };
+    LayerResult optimizeLayer(const QList<Spot3DCoordinate> &spots, const QList<int> &order) const;
+
+    void nearestNeighbour(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const;
+    bool twoOpt(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const;
+    bool orOpt(const QVector<Spot3DCoordinate> &points, QVector<int> &path) const;
+    double pathLength(const QVector<Spot3DCoordinate> &points, const QVector<int> &path) const;
+    int violations(const QVector<Spot3DCoordinate> &points, const QVector<int> &path) const;
+    inline bool spaced(double distance) const { return m_minSpacing <= 0 || distance >= m_minSpacing; }
+};
+
+#endif // ORDEROPTIMIZER_H
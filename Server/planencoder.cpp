@@ -0,0 +1,263 @@
+#include <QDebug>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+#include "planencoder.h"
+#include "protocol.h"
+#include "parallel.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SERVER)
+
+ScatterFrame PlanEncoder::encode(const TreatmentPlan &plan, const QString &receipt,
+                                 int peerVersion, quint32 capabilities, QThreadPool *pool, bool scatter)
+{
+    QByteArray baBlock;
+
+    if (peerVersion >= PROTOCOL_VERSION)
+    {
+        if (scatter && (capabilities & CAP_SOA_PLAN))
+            return encodePieces(plan, receipt, capabilities, pool);
+
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+
+        quint32 flags = 0;
+        if (capabilities & CAP_SOA_PLAN)
+        {
+            writeSoA(out, plan, receipt, pool);
+            flags |= FRAME_SOA;
+        }
+        else
+        {
+            writeBody(out, plan, receipt, pool);
+        }
+        return ScatterFrame(encodeFrame(PLAN, payload, flags, capabilities));
+    }
+
+    QDataStream out(&baBlock, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+
+    out << qint64(0)
+        << qint64(0);
+    writeBody(out, plan, receipt, pool);
+
+    qint64 totalBytes = baBlock.size();
+    out.device()->seek(0);
+    out << qint64(PLAN) << totalBytes;    // Find the head of array and write the haed information
+    return ScatterFrame(baBlock);
+}
+
+// Layers of the SoA plan: both indices are in depth order, an order without spots still gets its layer
+QVector<float> PlanEncoder::layerDepths(const TreatmentPlan &plan)
+{
+    QVector<float> keys = plan.spot3D.depths();
+    bool merged = false;
+    for (int i = 0; i < plan.spotOrder.size(); i++)
+    {
+        if (!plan.spot3D.contains(plan.spotOrder.depthAt(i)))
+        {
+            keys.append(plan.spotOrder.depthAt(i));
+            merged = true;
+        }
+    }
+    if (merged)
+        std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+// Plan body of the legacy format: the coordinates split into X, Y and Z hashes, one layer per task
+void PlanEncoder::writeBody(QDataStream &out, const TreatmentPlan &plan, const QString &receipt, QThreadPool *pool)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int layerCount = plan.spot3D.size();
+    QVector<QList<Coordinate> > newListX(layerCount), newListY(layerCount), newListZ(layerCount);
+    parallelFor(pool, layerCount, [&](int i) {
+        const QList<Spot3DCoordinate> &currentList = plan.spot3D.at(i);
+        int listSize = currentList.size();
+        newListX[i].reserve(listSize);
+        newListY[i].reserve(listSize);
+        newListZ[i].reserve(listSize);
+        for (int j = 0; j < listSize; j++)
+        {
+            const Spot3DCoordinate &currentStruct = currentList.at(j);
+            newListX[i].append(currentStruct.x);
+            newListY[i].append(currentStruct.y);
+            newListZ[i].append(currentStruct.z);
+        }
+    });
+
+    QHash<float, QList<Coordinate> > hashX, hashY, hashZ;
+    for (int i = 0; i < layerCount; i++)
+    {
+        hashX.insert(plan.spot3D.depthAt(i), newListX.at(i));
+        hashY.insert(plan.spot3D.depthAt(i), newListY.at(i));
+        hashZ.insert(plan.spot3D.depthAt(i), newListZ.at(i));
+    }
+
+    out << hashX
+        << hashY
+        << hashZ
+        << plan.spotOrder.toHash()
+        << plan.parameter
+        << receipt;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Encoded" << layerCount << "layers on"
+                      << pool->maxThreadCount() << "threads in" << timer.nsecsElapsed() / 1000 << "us";
+}
+
+// Structure-of-arrays plan: per layer the depth, raw X, Y and Z arrays and the raw spot order,
+// so the client can decode it without building any QHash or QList
+void PlanEncoder::writeSoA(QDataStream &out, const TreatmentPlan &plan, const QString &receipt, QThreadPool *pool)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<float> keys = layerDepths(plan);
+    int layerCount = keys.size();
+    QVector<QVector<Coordinate> > x(layerCount), y(layerCount), z(layerCount);
+    parallelFor(pool, layerCount, [&](int i) {
+        const QList<Spot3DCoordinate> currentList = plan.spot3D.value(keys.at(i));
+        int listSize = currentList.size();
+        x[i].resize(listSize);
+        y[i].resize(listSize);
+        z[i].resize(listSize);
+        for (int j = 0; j < listSize; j++)
+        {
+            const Spot3DCoordinate &currentStruct = currentList.at(j);
+            x[i][j] = currentStruct.x;
+            y[i][j] = currentStruct.y;
+            z[i][j] = currentStruct.z;
+        }
+    });
+
+    out << quint32(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        out << keys.at(i);
+        writeCoordinates(out, x.at(i));
+        writeCoordinates(out, y.at(i));
+        writeCoordinates(out, z.at(i));
+        writeOrder(out, plan.spotOrder.value(keys.at(i)));
+    }
+
+    out << plan.parameter
+        << receipt;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Encoded" << layerCount << "layers on"
+                      << pool->maxThreadCount() << "threads in" << timer.nsecsElapsed() / 1000 << "us";
+}
+
+// The SoA frame of writeSoA() in pieces. Every array is written once, straight from the plan into
+// its wire format behind its small header; the payload is checksummed piece by piece and never
+// gathered into one buffer.
+ScatterFrame PlanEncoder::encodePieces(const TreatmentPlan &plan, const QString &receipt, quint32 capabilities,
+                                       QThreadPool *pool)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<float> keys = layerDepths(plan);
+    int layerCount = keys.size();
+
+//  Per layer: depth and the X count and array, then Y, Z and the order, each behind its count
+    QVector<QByteArray> pieces(layerCount * 4);
+    parallelFor(pool, layerCount, [&](int i) {
+        const QList<Spot3DCoordinate> *spotList = plan.spot3D.find(keys.at(i));
+        const QList<int> *orderList = plan.spotOrder.find(keys.at(i));
+        int spotCount = spotList ? spotList->size() : 0;
+        int orderCount = orderList ? orderList->size() : 0;
+
+        uchar *column[4];
+        for (int c = 0; c < 4; c++)
+        {
+            QByteArray &piece = pieces[i * 4 + c];
+            {
+                QDataStream out(&piece, QIODevice::WriteOnly);
+                out.setVersion(QDataStream::Qt_4_6);
+                if (c == 0)
+                    out << keys.at(i);
+                out << quint32(c < 3 ? spotCount : orderCount);
+            }
+            int head = piece.size();
+            piece.resize(head + (c < 3 ? spotCount * int(sizeof(quint64)) : orderCount * int(sizeof(qint32))));
+            column[c] = reinterpret_cast<uchar *>(piece.data()) + head;
+        }
+
+        for (int j = 0; j < spotCount; j++)
+        {
+            const Spot3DCoordinate &spot = spotList->at(j);
+            quint64 raw[3];
+            memcpy(&raw[0], &spot.x, sizeof(quint64));
+            memcpy(&raw[1], &spot.y, sizeof(quint64));
+            memcpy(&raw[2], &spot.z, sizeof(quint64));
+            qToLittleEndian(raw[0], column[0] + j * sizeof(quint64));
+            qToLittleEndian(raw[1], column[1] + j * sizeof(quint64));
+            qToLittleEndian(raw[2], column[2] + j * sizeof(quint64));
+        }
+        for (int j = 0; j < orderCount; j++)
+            qToLittleEndian(qint32(orderList->at(j)), column[3] + j * sizeof(qint32));
+    });
+
+    QByteArray tail;
+    QDataStream tailOut(&tail, QIODevice::WriteOnly);
+    tailOut.setVersion(QDataStream::Qt_4_6);
+    tailOut << plan.parameter
+            << receipt;
+    int tailPayload = tail.size();
+
+    quint32 flags = FRAME_SOA;
+    if (capabilities & CAP_CHECKSUM)
+        flags |= FRAME_CHECKSUM;
+    if (capabilities & CAP_TIMESTAMP)
+        flags |= FRAME_TIMESTAMP;
+
+    QByteArray layerHead;
+    {
+        QDataStream out(&layerHead, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << quint32(layerCount);
+    }
+    qint64 payloadSize = layerHead.size() + tailPayload;
+    quint16 crc = checksumAdd(CHECKSUM_START, layerHead.constData(), layerHead.size());
+    for (int i = 0; i < pieces.size(); i++)
+    {
+        payloadSize += pieces.at(i).size();
+        if (flags & FRAME_CHECKSUM)
+            crc = checksumAdd(crc, pieces.at(i).constData(), pieces.at(i).size());
+    }
+    if (flags & FRAME_CHECKSUM)
+    {
+        crc = checksumAdd(crc, tail.constData(), tailPayload);
+        tailOut << quint16(checksumFinish(crc));
+    }
+    if (flags & FRAME_TIMESTAMP)
+        tailOut << qint64(NO_TIMESTAMP);    // Filled in by ScatterFrame::stamp() just before the write
+
+//  Frame header and the length of the payload, as encodeFrame() writes them for a QByteArray payload
+    QByteArray head;
+    QDataStream headOut(&head, QIODevice::WriteOnly);
+    headOut.setVersion(QDataStream::Qt_4_6);
+    qint64 totalBytes = 2 * qint64(sizeof(qint64)) + sizeof(quint32) + sizeof(quint32)
+            + payloadSize + tail.size() - tailPayload;
+    headOut << qint64(PLAN | HEADER_V2)
+            << totalBytes
+            << flags
+            << quint32(payloadSize);
+    head.append(layerHead);
+
+    ScatterFrame frame;
+    frame.append(head);
+    for (int i = 0; i < pieces.size(); i++)
+        frame.append(pieces.at(i));
+    frame.append(tail);
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Encoded" << layerCount << "layers in" << frame.pieceCount()
+                      << "pieces on" << pool->maxThreadCount() << "threads in" << timer.nsecsElapsed() / 1000 << "us";
+    return frame;
+}
@@ -0,0 +1,42 @@
+#ifndef PLANENCODER_H
+#define PLANENCODER_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QThreadPool>
+
+#include "server_global.h"
+#include "variable.h"
+#include "layerindex.h"
+#include "scatterframe.h"
+
+//  Layers are kept in depth order, so encoding needs no sort and no hash lookup
+struct TreatmentPlan
+{
+    LayerIndex<QList<Spot3DCoordinate> > spot3D;
+    LayerIndex<QList<int> > spotOrder;
+    SpotSonicationParameter parameter;
+};
+
+//  Builds the complete plan frame from a plan snapshot. It touches no Server
+//  state, so it can run on a worker thread while another plan is on the wire.
+class SERVERSHARED_EXPORT PlanEncoder
+{
+public:
+    // With scatter an SoA plan is left in pieces for ScatterFrame::writeTo() and never compressed,
+    // every other frame is one piece
+    static ScatterFrame encode(const TreatmentPlan &plan, const QString &receipt,
+                               int peerVersion, quint32 capabilities, QThreadPool *pool, bool scatter = false);
+
+private:
+    static QVector<float> layerDepths(const TreatmentPlan &plan);
+    static void writeBody(QDataStream &out, const TreatmentPlan &plan, const QString &receipt, QThreadPool *pool);
+    static void writeSoA(QDataStream &out, const TreatmentPlan &plan, const QString &receipt, QThreadPool *pool);
+    static ScatterFrame encodePieces(const TreatmentPlan &plan, const QString &receipt, quint32 capabilities,
+                                     QThreadPool *pool);
+};
+
+#endif // PLANENCODER_H
@@ -0,0 +1,147 @@
+#include <QtGlobal>
+#include <QtEndian>
+
+#if defined(Q_OS_WIN)
+#include <winsock2.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
+#include <cstring>
+
+#include "scatterframe.h"
+#include "protocol.h"
+
+void ScatterFrame::append(const QByteArray &piece)
+{
+    if (piece.isEmpty())
+        return;
+    m_pieces.append(piece);
+    m_size += piece.size();
+}
+
+QByteArray ScatterFrame::toByteArray() const
+{
+    if (m_pieces.size() == 1)
+        return m_pieces.first();
+
+    QByteArray frame(int(m_size), Qt::Uninitialized);
+    char *data = frame.data();
+    for (int i = 0; i < m_pieces.size(); i++)
+    {
+        memcpy(data, m_pieces.at(i).constData(), m_pieces.at(i).size());
+        data += m_pieces.at(i).size();
+    }
+    return frame;
+}
+
+// The flags are in the first piece, the send time is the last 8 bytes of the frame
+void ScatterFrame::stamp(qint64 time)
+{
+    if (m_pieces.isEmpty() || m_size < qint64(2 * sizeof(qint64) + sizeof(quint32) + sizeof(qint64)))
+        return;
+    if (m_pieces.size() == 1)
+    {
+        stampFrame(m_pieces.first(), time);
+        return;
+    }
+    if (m_pieces.first().size() < int(2 * sizeof(qint64) + sizeof(quint32)))
+        return;
+    quint32 flags = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(m_pieces.first().constData())
+                                            + 2 * sizeof(qint64));
+    if (!(flags & FRAME_TIMESTAMP))
+        return;
+
+    uchar stamp[sizeof(qint64)];
+    qToBigEndian(time, stamp);
+    int left = sizeof(stamp);
+    for (int i = m_pieces.size() - 1; i >= 0 && left > 0; i--)
+    {
+        QByteArray &piece = m_pieces[i];
+        int count = qMin(left, piece.size());
+        memcpy(piece.data() + piece.size() - count, stamp + left - count, count);
+        left -= count;
+    }
+}
+
+qint64 ScatterFrame::writeTo(QTcpSocket *socket) const
+{
+//  Only a connected socket with nothing queued may be written behind Qt's back
+    qint64 sent = 0;
+    if (socket->state() == QAbstractSocket::ConnectedState && socket->bytesToWrite() == 0)
+        sent = qMax(writeVector(socket->socketDescriptor()), qint64(0));
+
+    qint64 offset = 0;
+    for (int i = 0; i < m_pieces.size(); i++)
+    {
+        const QByteArray &piece = m_pieces.at(i);
+        qint64 skip = qMax(sent - offset, qint64(0));
+        offset += piece.size();
+        if (skip < piece.size())
+            socket->write(piece.constData() + skip, piece.size() - skip);
+    }
+    return sent;
+}
+
+// Stops at the first call the kernel did not take whole; errors are left for the socket to report
+qint64 ScatterFrame::writeVector(qintptr socketDescriptor) const
+{
+#if defined(Q_OS_UNIX) || defined(Q_OS_WIN)
+    if (socketDescriptor == -1)
+        return 0;
+
+    qint64 sent = 0;
+    for (int first = 0; first < m_pieces.size(); first += SCATTER_BATCH)
+    {
+        int count = qMin(SCATTER_BATCH, m_pieces.size() - first);
+        qint64 batchBytes = 0;
+#ifdef Q_OS_WIN
+        WSABUF vector[SCATTER_BATCH];
+        for (int i = 0; i < count; i++)
+        {
+            const QByteArray &piece = m_pieces.at(first + i);
+            vector[i].buf = const_cast<char *>(piece.constData());
+            vector[i].len = ULONG(piece.size());
+            batchBytes += piece.size();
+        }
+        DWORD result = 0;
+        if (WSASend(SOCKET(socketDescriptor), vector, DWORD(count), &result, 0, 0, 0) == SOCKET_ERROR)
+            return sent;
+#else
+        struct iovec vector[SCATTER_BATCH];
+        for (int i = 0; i < count; i++)
+        {
+            const QByteArray &piece = m_pieces.at(first + i);
+            vector[i].iov_base = const_cast<char *>(piece.constData());
+            vector[i].iov_len = size_t(piece.size());
+            batchBytes += piece.size();
+        }
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vector;
+        message.msg_iovlen = count;
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;    // A closed peer is an error of the socket, not a SIGPIPE
+#endif
+        ssize_t result;
+        do
+        {
+            result = ::sendmsg(int(socketDescriptor), &message, flags);
+        } while (result < 0 && errno == EINTR);
+        if (result < 0)
+            return sent;
+#endif
+        sent += qint64(result);
+        if (qint64(result) < batchBytes)
+            return sent;    // Socket buffer full
+    }
+    return sent;
+#else
+    Q_UNUSED(socketDescriptor);
+    return 0;    // Everything goes through the socket's buffer
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef SCATTERFRAME_H
+#define SCATTERFRAME_H
+
+#include <QByteArray>
+#include <QList>
+#include <QTcpSocket>
+
+#define SCATTER_BATCH 64    // Pieces per system call, well under IOV_MAX
+
+//  A frame kept as the pieces it was built from: small headers written in
+//  place between the coordinate arrays of the plan. The pieces are handed to
+//  the kernel together in one scatter-gather call, so the frame is never
+//  copied into one buffer, nor into the socket's write buffer.
+//  The kernel still copies the pieces into its own buffers. MSG_ZEROCOPY would
+//  avoid that, but it is Linux only and copies on loopback anyway. Its
+//  completions also arrive on the socket's error queue. QTcpSocket never
+//  reads that queue, so its notifier would keep firing, and the pieces would
+//  have to stay untouched until each completion came in.
+class ScatterFrame
+{
+public:
+    ScatterFrame() : m_size(0) {}
+    explicit ScatterFrame(const QByteArray &frame) : m_size(0) { append(frame); }
+
+    void append(const QByteArray &piece);
+    inline bool isEmpty() const { return m_size == 0; }
+    inline qint64 size() const { return m_size; }
+    inline int pieceCount() const { return m_pieces.size(); }
+    inline QByteArray &piece(int i) { return m_pieces[i]; }
+
+    QByteArray toByteArray() const;    // One contiguous copy, a frame of one piece is shared
+    void stamp(qint64 time);    // stampFrame() across the pieces
+
+    // The kernel takes what it can straight from the pieces, the rest goes through the socket's
+    // write buffer. Returns the bytes the kernel took, they raise no bytesWritten().
+    qint64 writeTo(QTcpSocket *socket) const;
+
+private:
+    QList<QByteArray> m_pieces;
+    qint64 m_size;
+
+    qint64 writeVector(qintptr socketDescriptor) const;
+};
+
+#endif // SCATTERFRAME_H
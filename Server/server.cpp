@@ -7,33 +7,29 @@
 Q_LOGGING_CATEGORY(SERVER, "SERVER")
 
 Server::Server(QObject *parent) : QObject(parent),
-      m_totalBytes(0), m_sendTimeNum(1)
+      m_nextPlanId(1), m_optimizeOrder(false), m_sendTimeNum(1),
+      m_commandWindow(8), m_commandTimeout(1000), m_commandRetries(3), m_storeCapacity(0), m_scatterGather(true),
+      m_recorder(TRACE_SERVER)
 {
 // Variables initialization and build connections
-    m_server = new QTcpServer(this);
-    m_sendSocket = new QTcpSocket(this);
-    m_receiveSocket = new QTcpSocket(this);
+    m_server = new StatusDispatcher(this);
+    connect(m_server, SIGNAL(statusQueued()), this, SLOT(receive()));
+    m_multicast = new MulticastSender(this);
+    m_publisher = new StatusPublisher(this);
 
     setCmdString();
     setErrorString();
 
     readSettings();
-    connect(m_sendSocket, SIGNAL(readyRead()), this, SLOT(readReceipt()));
-    connect(m_sendSocket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SLOT(displayError(QAbstractSocket::SocketError)));
+    addPeer(DEFAULT_PEER, m_sendIpAddress, m_sendPort);
 
     connect(this,SIGNAL(error(QString)),this,SLOT(handleError(QString)));
-}
 
-Server::~Server()
-{
+    m_preparePool.setMaxThreadCount(QThread::idealThreadCount());
 }
 
-// Connect to client and start session for sending plan and command
-void Server::connectServer()
+Server::~Server()
 {
-    QHostAddress ipAddress(m_sendIpAddress);    // Set the IP address of another computer
-    m_sendSocket->connectToHost(ipAddress, m_sendPort);    // Connect
 }
 
 void Server::readSettings()
@@ -43,7 +39,54 @@ void Server::readSettings()
     m_receivePort = settings->value("Receive/Port").toString().toUShort(0,10);
     m_sendIpAddress = settings->value("Send/IpAddress").toString();
     m_sendPort = settings->value("Send/Port").toString().toUShort(0,10);
+    m_scatterGather = settings->value("Send/ScatterGather", true).toBool();
+    QString captureFile = settings->value("Capture/File").toString();
+    m_statusInterval = settings->value("Receive/StatusInterval").toString().toUShort(0,10);
+    m_syncInterval = settings->value("Sync/Interval", 10000).toInt();
+    m_commandWindow = qMax(settings->value("Commands/Window", 8).toInt(), 1);
+    m_commandTimeout = qMax(settings->value("Commands/Timeout", 1000).toInt(), 1);
+    m_commandRetries = settings->value("Commands/Retries", 3).toInt();
+    m_server->setWorkerCount(settings->value("Receive/Workers").toInt());
+    m_server->setBalance(settings->value("Receive/Balance").toString() == "LeastLoaded" ?
+                             StatusDispatcher::LeastLoaded : StatusDispatcher::RoundRobin);
+    m_optimizeOrder = settings->value("Order/Enabled", false).toBool();
+    m_optimizer.setMinSpacing(settings->value("Order/MinSpacing", 0).toDouble());
+    m_optimizer.setSpeed(settings->value("Order/Speed", 10).toDouble());
+    m_optimizer.setMaxPasses(settings->value("Order/MaxPasses", 20).toInt());
+    m_storeDirectory = settings->value("Store/Directory").toString();
+    m_storeCapacity = settings->value("Store/Capacity", 4).toInt();
+    m_recorder.setCapacity(settings->value("Recorder/Capacity", FLIGHT_CAPACITY).toInt());
+    m_flightDirectory = settings->value("Recorder/Directory", "..").toString();
+    if (settings->value("Multicast/Enabled", false).toBool())
+        m_multicast->open(settings->value("Multicast/Group", "239.255.43.21").toString(),
+                          settings->value("Multicast/Port", 6668).toString().toUShort(0,10),
+                          settings->value("Multicast/Ttl", 1).toInt(),
+                          settings->value("Multicast/Rate", 20).toInt());
+    if (settings->value("Observers/Enabled", false).toBool())
+    {
+//  Observers are served where the clients reach us, never on every interface unasked
+        QString observerAddress = settings->value("Observers/IpAddress").toString();
+        if (observerAddress.isEmpty())
+            observerAddress = m_receiveIpAddress.isEmpty() ? getLocalIP() : m_receiveIpAddress;
+        m_publisher->listen(observerAddress,
+                            settings->value("Observers/Port", 6669).toString().toUShort(0,10),
+                            settings->value("Observers/QueueDepth", OBSERVER_QUEUE).toInt());
+    }
+
+//  Further clients as name=IpAddress:Port
+    settings->beginGroup("Peers");
+    QStringList names = settings->childKeys();
+    for (int i = 0; i < names.size(); i++)
+    {
+        QStringList address = settings->value(names.at(i)).toString().split(':');
+        if (address.size() == 2)
+            addPeer(names.at(i), address.at(0), address.at(1).toUShort(0,10));
+    }
+    settings->endGroup();
     delete settings;
+
+    if (!captureFile.isEmpty())
+        startCapture(captureFile);
 }
 
 void Server::updateSettings()
@@ -65,20 +108,16 @@ void Server::setCmdString()
               << "SEND COMMAND RESUME";
 }
 
-// Display error report
-void Server::displayError(QAbstractSocket::SocketError)
-{
-    qCWarning(SERVER()) << SERVER().categoryName() << m_sendSocket->errorString();
-    m_sendSocket->close();
-    qCDebug(SERVER()) << SERVER().categoryName() << "Send socket was closed.";
-}
-
 void Server::setErrorString()
 {
     m_errorList << "Successfully done."
                 << "Failed to send enough bytes."
                 << "Failed to check the receipt."
-                << "Failed to receive enough bytes.";
+                << "Failed to receive enough bytes."
+                << "Failed to negotiate the protocol with the client."
+                << "The client rejected the plan."
+                << "The client did not acknowledge the command."
+                << "The peer was removed.";
 }
 
 void Server::handleError(QString errorString)
@@ -86,106 +125,344 @@ void Server::handleError(QString errorString)
     qCWarning(SERVER()) << SERVER().categoryName() << errorString;
 }
 
-// Send treatment plan
+void Server::addPeer(QString name, QString ipAddress, quint16 port)
+{
+    removePeer(name);
+
+    ServerPeer *peer = new ServerPeer(this, name, ipAddress, port);
+    if (!m_storeDirectory.isEmpty())
+        peer->openStore(QDir(m_storeDirectory).filePath(name), m_storeCapacity);
+    connect(peer, SIGNAL(negotiated(int,quint32)), this, SLOT(peerNegotiated(int,quint32)));
+    connect(peer, SIGNAL(planCompleted(int)), this, SLOT(peerPlanCompleted(int)));
+    connect(peer, SIGNAL(planFailed(int,int,QString)), this, SLOT(peerPlanFailed(int,int,QString)));
+    connect(peer, SIGNAL(commandSent(int)), this, SLOT(peerCommandSent(int)));
+    connect(peer, SIGNAL(commandAcknowledged(quint32,int,int,qint64)),
+            this, SLOT(peerCommandAcknowledged(quint32,int,int,qint64)));
+    connect(peer, SIGNAL(commandFailed(quint32,int)), this, SLOT(peerCommandFailed(quint32,int)));
+    connect(peer, SIGNAL(scheduleCancelled(int)), this, SLOT(peerScheduleCancelled(int)));
+    connect(peer, SIGNAL(scheduleRejected(QString)), this, SLOT(peerScheduleRejected(QString)));
+    connect(peer, SIGNAL(error(int)), this, SLOT(peerError(int)));
+    m_peers.insert(name, peer);
+}
+
+// Plans, commands and a schedule still queued on the peer fail before it goes
+void Server::removePeer(QString name)
+{
+    ServerPeer *peer = m_peers.take(name);
+    if (!peer)
+        return;
+    peer->abandon();
+    peer->disconnect(this);
+    peer->deleteLater();
+}
+
+QHash<QString, QVariant> Server::getStatus(QString peer)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    return serverPeer ? serverPeer->getStatus() : QHash<QString, QVariant>();
+}
+
+int Server::getPeerVersion()
+{
+    ServerPeer *serverPeer = m_peers.value(DEFAULT_PEER);
+    return serverPeer ? serverPeer->getPeerVersion() : 0;
+}
+
+quint32 Server::getPeerCapabilities()
+{
+    ServerPeer *serverPeer = m_peers.value(DEFAULT_PEER);
+    return serverPeer ? serverPeer->getPeerCapabilities() : 0;
+}
+
+int Server::getQueuedPlanCount()
+{
+    ServerPeer *serverPeer = m_peers.value(DEFAULT_PEER);
+    return serverPeer ? serverPeer->getQueuedPlanCount() : 0;
+}
+
+qint64 Server::getClockOffset(QString peer)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    return serverPeer ? serverPeer->getClockSync().offsetAt(sessionTime()) : 0;
+}
+
+qint64 Server::getStatusLatency(QString peer)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    return serverPeer ? serverPeer->getStatusLatency() : 0;
+}
+
+// Send treatment plan set by setCoordinate(), setSpotOrder() and setParameter()
 void Server::sendPlan()
 {
-    connectServer();
+    sendPlan(DEFAULT_PEER);
+}
 
-//  Check if the data has been all well written
-    connect(m_sendSocket, SIGNAL(bytesWritten(qint64)),
-            this, SLOT(writtenBytes(qint64)));
+void Server::sendPlan(QString peer)
+{
+    queuePlan(peer, m_spot3D, m_spotOrder, m_parameter);
+    m_spot3D.clear();
+    m_spotOrder.clear();
+}
 
-    qCDebug(SERVER()) << SERVER().categoryName() << "Sending plan...";
+int Server::queuePlan(QHash<float, QList<Spot3DCoordinate> > spot3D, QHash<float, QList<int> > spotOrder,
+                      SpotSonicationParameter parameter)
+{
+    return queuePlan(DEFAULT_PEER, spot3D, spotOrder, parameter);
+}
 
-    encodePlan(&m_baOut);
-    m_sendSocket->write(m_baOut);
+int Server::queuePlan(QString peer, QHash<float, QList<Spot3DCoordinate> > spot3D, QHash<float, QList<int> > spotOrder,
+                      SpotSonicationParameter parameter)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    if (!serverPeer)
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Unknown peer" << peer;
+        return -1;
+    }
 
-    disconnect(m_sendSocket, SIGNAL(bytesWritten(qint64)),
-               this, SLOT(writtenBytes(qint64)));
+    int planId = m_nextPlanId++;
+    TreatmentPlan plan = buildPlan(QList<int>() << planId, spot3D, spotOrder, parameter);
+    serverPeer->queuePlan(planId, plan);
+    return planId;
 }
 
-void Server::encodePlan(QByteArray *baBlock)
+// Plan snapshot for the pipeline, its spots reordered once for all the plans it becomes
+TreatmentPlan Server::buildPlan(const QList<int> &planIds, const QHash<float, QList<Spot3DCoordinate> > &spot3D,
+                                const QHash<float, QList<int> > &spotOrder, SpotSonicationParameter parameter)
 {
-    QDataStream out(baBlock, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_4_6);
+    TreatmentPlan plan;
+    plan.spot3D = LayerIndex<QList<Spot3DCoordinate> >(spot3D);
+    plan.spotOrder = LayerIndex<QList<int> >(spotOrder);
+    plan.parameter = parameter;
 
-    genReceipt(m_receipt);
-    encodeSpot();
-
-    out << qint64(0)
-        << qint64(0)
-        << m_hashX
-        << m_hashY
-        << m_hashZ
-        << m_spotOrder
-        << m_parameter.volt
-        << m_parameter.totalTime
-        << m_parameter.period
-        << m_parameter.dutyCycle
-        << m_parameter.coolingTime
-        << m_receipt;
-
-    qDebug() << "Spot order:" << m_spotOrder;
-    qDebug() << "Volt:" << m_parameter.volt
-             << "Total time:" << m_parameter.totalTime
-             << "Period:" << m_parameter.period
-             << "Duty cycle:" << m_parameter.dutyCycle
-             << "Cooling time:" << m_parameter.coolingTime;
-    qDebug() << "receipt:" << m_receipt;
-
-    m_totalBytes = baBlock->size();
-    qDebug() << "m_totalBytes:" << m_totalBytes;
-    out.device()->seek(0);
-    out << qint64(PLAN) << m_totalBytes;    // Find the head of array and write the haed information
-}
-
-//  load the list of 3D coordinates from the hash
-void Server::encodeSpot()
-{
-    QHash<float, QList<Spot3DCoordinate> >::iterator i;
-    for (i = m_spot3D.begin(); i != m_spot3D.end(); ++i)
+    if (m_optimizeOrder)
     {
-        float currentKey = i.key();
-        QList<Spot3DCoordinate> currentList = i.value();
-        QList<Coordinate> newListX, newListY, newListZ;
-        int listSize = currentList.size();
-        Spot3DCoordinate currentStruct;
-        for (int j = 0; j < listSize; j++)
+        OrderReport report;
+        plan.spotOrder = m_optimizer.optimize(plan.spot3D, plan.spotOrder, &m_pool, report);
+        qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << planIds << "path" << report.lengthBefore
+                          << "->" << report.lengthAfter << ", saves" << report.timeSaved << "ms";
+        for (int i = 0; i < planIds.size(); i++)
+            emit orderOptimized(planIds.at(i), report.lengthBefore, report.lengthAfter, report.timeSaved);
+    }
+    return plan;
+}
+
+QList<int> Server::multicastPlan(QStringList peers, QHash<float, QList<Spot3DCoordinate> > spot3D,
+                                 QHash<float, QList<int> > spotOrder, SpotSonicationParameter parameter)
+{
+    QList<int> planIds;
+    QList<ServerPeer *> serverPeers;
+    for (int i = 0; i < peers.size(); i++)
+    {
+        ServerPeer *serverPeer = m_peers.value(peers.at(i));
+        if (!serverPeer)
+            qCWarning(SERVER()) << SERVER().categoryName() << "Unknown peer" << peers.at(i);
+        planIds.append(serverPeer ? m_nextPlanId++ : -1);
+        serverPeers.append(serverPeer);
+    }
+
+    QList<int> queuedIds = planIds;
+    queuedIds.removeAll(-1);
+    if (queuedIds.isEmpty())
+        return planIds;
+    TreatmentPlan plan = buildPlan(queuedIds, spot3D, spotOrder, parameter);
+
+//  Every receiver decodes the same frame, so it carries the same receipt
+    QString receipt;
+    QByteArray frame;
+    quint32 transfer = 0;
+    if (m_multicast->isOpen())
+    {
+        genReceipt(receipt, "multicast");
+        frame = PlanEncoder::encode(plan, receipt, PROTOCOL_VERSION, MULTICAST_CAPABILITIES, &m_pool).toByteArray();
+        stampFrame(frame, sessionTime());
+        if (frame.size() > MULTICAST_MAX_FRAME)
+        {
+            qCWarning(SERVER()) << SERVER().categoryName() << "Plan" << queuedIds << "of" << frame.size()
+                                << "bytes is too large to multicast, sent by unicast.";
+        }
+        else
         {
-            currentStruct = currentList.at(j);
-            newListX.append(currentStruct.x);
-            newListY.append(currentStruct.y);
-            newListZ.append(currentStruct.z);
+            transfer = m_multicast->start(frame, queuedIds.size());
+            qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << queuedIds << "multicast as transfer" << transfer
+                              << "," << frame.size() << "bytes.";
         }
-        m_hashX[currentKey] = newListX;
-        m_hashY[currentKey] = newListY;
-        m_hashZ[currentKey] = newListZ;
     }
-    qDebug() << "X:" << m_hashX;
-    qDebug() << "Y:" << m_hashY;
-    qDebug() << "Z:" << m_hashZ;
+
+    for (int i = 0; i < serverPeers.size(); i++)
+    {
+        if (!serverPeers.at(i))
+            continue;
+        if (transfer != 0)
+            serverPeers.at(i)->queueMulticastPlan(planIds.at(i), plan, receipt, transfer, frame);
+        else
+            serverPeers.at(i)->queuePlan(planIds.at(i), plan);
+    }
+    return planIds;
 }
 
-void Server::sendCommand(cmdType iType)
+int Server::resendPlan(QString peer)
 {
-    connectServer();
+    ServerPeer *serverPeer = m_peers.value(peer);
+    TreatmentPlan plan;
+    if (!serverPeer || !serverPeer->restorePlan(plan))
+        return -1;
+
+    int planId = m_nextPlanId++;
+    serverPeer->queuePlan(planId, plan);
+    return planId;
+}
 
-    encodeCmd(&m_baOut,iType);
+PlanTransaction Server::sendPlanAsync(QString peer, QHash<float, QList<Spot3DCoordinate> > spot3D,
+                                      QHash<float, QList<int> > spotOrder, SpotSonicationParameter parameter)
+{
+    PlanTransaction transaction(this);
+    int planId = queuePlan(peer, spot3D, spotOrder, parameter);
+    if (planId < 0)
+    {
+        PlanOutcome outcome = { planId, false, "Unknown peer " + peer };
+        transaction.finish(outcome);
+        return transaction;
+    }
 
-    qCDebug(SERVER()) << SERVER().categoryName() << "Start sending command ...";
+    connect(this, &Server::planCompleted, transaction.context(), [=](int id) mutable {
+        if (id != planId)
+            return;
+        PlanOutcome outcome = { id, true, QString() };
+        transaction.finish(outcome);
+    });
+    connect(this, &Server::planFailed, transaction.context(), [=](int id, QString errorString) mutable {
+        if (id != planId)
+            return;
+        PlanOutcome outcome = { id, false, errorString };
+        transaction.finish(outcome);
+    });
+    return transaction;
+}
 
-    m_sendSocket->write(m_baOut);
+CommandTransaction Server::sendCommandAsync(QString peer, cmdType iType)
+{
+    CommandTransaction transaction(this);
+    quint32 sequence = sendCommand(peer, iType);
+    if (sequence == 0)
+    {
+        CommandOutcome outcome = { 0, false, COMMAND_UNKNOWN, NO_TIMESTAMP };
+        transaction.finish(outcome);
+        return transaction;
+    }
 
-    m_baOut.clear();
+    connect(this, &Server::commandAcknowledged, transaction.context(),
+            [=](QString name, quint32 id, int, int result, qint64 latency) mutable {
+        if (name != peer || id != sequence)
+            return;
+        CommandOutcome outcome = { id, result == COMMAND_DONE, result, latency };
+        transaction.finish(outcome);
+    });
+    connect(this, &Server::commandFailed, transaction.context(), [=](QString name, quint32 id, int) mutable {
+        if (name != peer || id != sequence)
+            return;
+        CommandOutcome outcome = { id, false, COMMAND_UNKNOWN, NO_TIMESTAMP };
+        transaction.finish(outcome);
+    });
+    return transaction;
+}
 
-    m_sendSocket->close();
+quint32 Server::sendCommand(cmdType iType)
+{
+    return sendCommand(DEFAULT_PEER, iType);
+}
 
-//  TODO
-//  Add the receipt
-//    qDebug() << "Send finished";
-    qCDebug(SERVER()) << SERVER().categoryName() << m_cmdList.at(iType - 1);
-//    qDebug() << "**************************************";
-    emit sendingCompleted();
+quint32 Server::sendCommand(QString peer, cmdType iType)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    if (!serverPeer)
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Unknown peer" << peer;
+        return 0;
+    }
+    return serverPeer->sendCommand(iType);
+}
+
+// Every peer gets the command on its own connection, none waits for another
+void Server::broadcastCommand(cmdType iType)
+{
+    QHash<QString, ServerPeer *>::const_iterator i;
+    for (i = m_peers.constBegin(); i != m_peers.constEnd(); ++i)
+        i.value()->sendCommand(iType);
+}
+
+void Server::sendSchedule(QVector<ScheduledCommand> schedule, int startDelay)
+{
+    sendSchedule(DEFAULT_PEER, schedule, startDelay);
+}
+
+void Server::sendSchedule(QString peer, QVector<ScheduledCommand> schedule, int startDelay)
+{
+    ServerPeer *serverPeer = m_peers.value(peer);
+    if (!serverPeer)
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Unknown peer" << peer;
+        return;
+    }
+    serverPeer->sendSchedule(schedule, startDelay);
+}
+
+// Total time in s, period and cooling time in ms, duty cycle in percent.
+// Every spot is sonicated for the total time, then cools down before the next one.
+QVector<ScheduledCommand> Server::buildSchedule(SpotSonicationParameter parameter, int spotCount)
+{
+    QVector<ScheduledCommand> schedule;
+    qint64 period = qMax(parameter.period, 1) * qint64(MS_UNIT);
+    qint64 dutyOn = period * qBound(0, parameter.dutyCycle, PERCENT_UNIT) / PERCENT_UNIT;
+    int periodCount = qMax(parameter.totalTime * MS_UNIT * MS_UNIT / period, qint64(1));
+
+    qint64 time = 0;
+    for (int spot = 0; spot < spotCount; spot++)
+    {
+        for (int i = 0; i < periodCount; i++)
+        {
+            qint64 on = time + i * period;
+            if (i == 0 || dutyOn < period)
+            {
+                ScheduledCommand command = { on, (spot == 0 && i == 0) ? START : RESUME };
+                schedule.append(command);
+            }
+            if (dutyOn < period)
+            {
+                ScheduledCommand command = { on + dutyOn, PAUSE };
+                schedule.append(command);
+            }
+        }
+        time += periodCount * period;
+
+        if (spot == spotCount - 1)
+        {
+            ScheduledCommand command = { time, STOP };
+            schedule.append(command);
+        }
+        else
+        {
+            if (dutyOn == period)
+            {
+                ScheduledCommand command = { time, PAUSE };
+                schedule.append(command);
+            }
+            time += parameter.coolingTime * qint64(MS_UNIT);
+        }
+    }
+    return schedule;
+}
+
+void Server::negotiate()
+{
+    ServerPeer *serverPeer = m_peers.value(DEFAULT_PEER);
+    if (!serverPeer)
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Unknown peer" << DEFAULT_PEER;
+        return;
+    }
+    serverPeer->negotiate();
 }
 
 void Server::encodeCmd(QByteArray *baBlock, cmdType iType)
@@ -198,73 +475,77 @@ void Server::encodeCmd(QByteArray *baBlock, cmdType iType)
 }
 
 // Generate the log information of treatment plan sending
-void Server::genReceipt(QString &receipt)
+void Server::genReceipt(QString &receipt, const QString &client)
 {
     QString date = QDate::currentDate().toString();
     QString time = QTime::currentTime().toString();
     QString server = "ServerName";
-    QString client = "ClientName";
     QString timeNum = "Time: " + QString::number(m_sendTimeNum, 10);
     receipt = "From: " + server + ", " + "To: " + client + ", " + timeNum + ", " + date + ", " + time;
+    m_sendTimeNum += 1;
 }
 
-// Read receipt
-void Server::readReceipt()
-{    
-//  test the signal of readyRead
-//    qDebug() << "readyRead...";
+void Server::peerNegotiated(int version, quint32 capabilities)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    emit negotiated(peer->getName(), version, capabilities);
+}
 
-    QDataStream in(m_sendSocket);
-    in.setVersion(QDataStream::Qt_4_6);
+void Server::peerPlanCompleted(int planId)
+{
+    emit planCompleted(planId);
+    emit sendingCompleted();
+}
 
-    QString receipt;
-//  test
-//    qDebug() << "bytesAvail:" << m_sendSocket->bytesAvailable();
-    in >> receipt;
-    m_sendSocket->close();
-
-//  test
-//    qDebug() << "receipt:" << receipt;
-//  Check the consistency of the send-back data
-//  m_receivedInfo is updated outside the current thread
-//  not thread-safe
-    if(m_receipt == receipt)
-    {
+void Server::peerPlanFailed(int planId, int errorCode, QString detail)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    recordError(peer->getFlightId(), errorCode, planId);
+
+    QString errorString = m_errorList[errorCode];
+    if (!detail.isEmpty())
+        errorString += " " + detail;
+    emit error(errorString);
+    emit planFailed(planId, errorString);
+}
 
-//        qDebug() << "Receipt checked.";
-//        qCDebug(SERVER()) << SERVER().categoryName() << ":" << "SUCESSFULLY SEND TREATMENT PLAN.";
-//        qDebug() << "**************************************";
-// Clear the variables
-        m_receipt.clear();
-        m_sendTimeNum += 1;
-        m_baOut.clear();
-        m_hashX.clear();
-        m_hashY.clear();
-        m_hashZ.clear();
-        m_spot3D.clear();
-        m_spotOrder.clear();
-        emit sendingCompleted();
-    }else
-    {
-        emit error(m_errorList[ErrorReadReceipt]);
-    }
+void Server::peerCommandSent(int iType)
+{
+    qCDebug(SERVER()) << SERVER().categoryName() << m_cmdList.at(iType - 1);
+    emit sendingCompleted();
 }
 
-// Slot function to capture written bytes of socket
-void Server::writtenBytes(qint64 bytesWrite)
+void Server::peerCommandAcknowledged(quint32 sequence, int iType, int result, qint64 latency)
 {
-    qDebug() << "Bytes Written:" << bytesWrite;
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    emit commandAcknowledged(peer->getName(), sequence, iType, result, latency);
+}
 
-    m_writtenBytes = bytesWrite;
+void Server::peerCommandFailed(quint32 sequence, int iType)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    recordError(peer->getFlightId(), ErrorCommand, sequence);
+    emit error(m_errorList[ErrorCommand]);
+    emit commandFailed(peer->getName(), sequence, iType);
+}
 
-    if (m_writtenBytes != m_totalBytes)
-    {
-        emit error(m_errorList[ErrorSend]);
-    }
-    else
-    {
-        emit error(m_errorList[NoError]);
-    }
+void Server::peerScheduleCancelled(int commandsLeft)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    emit scheduleCancelled(peer->getName(), commandsLeft);
+}
+
+void Server::peerScheduleRejected(QString detail)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    emit scheduleRejected(peer->getName(), detail);
+}
+
+void Server::peerError(int errorCode)
+{
+    ServerPeer *peer = qobject_cast<ServerPeer *>(sender());
+    recordError(peer->getFlightId(), errorCode, -1);
+    emit error(m_errorList[errorCode]);
 }
 
 QString Server::getLocalIP()
@@ -304,38 +585,106 @@ void Server::listen()
         }
     }
     qDebug() << "Listen OK";
-    connect(m_server, SIGNAL(newConnection()) ,
-            this, SLOT(acceptConnection()));    // Send newConnection() signal when a new connection is detected
 }
 
-void Server::acceptConnection()
+// Status frames name their peer; legacy clients are matched by address, the rest go to the default peer if any
+ServerPeer *Server::findPeer(const QString &name, const QHostAddress &address)
 {
-    m_receiveSocket = m_server->nextPendingConnection();
-    qDebug() << "m_receiveSocket:" << m_receiveSocket;
-    connect(m_receiveSocket, SIGNAL(readyRead()), this, SLOT(receive()));
-    connect(m_receiveSocket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SLOT(displayError(QAbstractSocket::SocketError)));
+    ServerPeer *peer = m_peers.value(name);
+    if (peer)
+        return peer;
 
-    qDebug() << "Connection OK";
+    QHash<QString, ServerPeer *>::const_iterator i;
+    for (i = m_peers.constBegin(); i != m_peers.constEnd(); ++i)
+    {
+        if (QHostAddress(i.value()->getIpAddress()) == address)
+            return i.value();
+    }
+    return m_peers.value(DEFAULT_PEER);
 }
 
+// Statuses decoded by the listener workers, applied here on the owner thread
 void Server::receive()
 {
-    QDataStream in(m_receiveSocket);
-    in.setVersion(QDataStream::Qt_4_6);
+    StatusUpdate update;
+    while (m_server->nextStatus(update))
+    {
+        ServerPeer *peer = findPeer(update.name, update.address);
+        if (!peer)
+        {
+            qCWarning(SERVER()) << SERVER().categoryName() << "Status from" << update.address.toString()
+                                << update.name << "matches no peer, dropped.";
+            continue;
+        }
+        traceFrame(peer->getFlightId(), TRACE_IN, STATUS, update.frame);
+        peer->applyStatus(update);
+        m_publisher->publish(peer->getName(), peer->getStatus());
+
+        qCDebug(SERVER()) << SERVER().categoryName() << "RECEIVED PROGRESS UPDATE FINISHED.";
+        emit statusReceived(peer->getName());
+        if (update.timestamp != NO_TIMESTAMP)
+            emit statusLatency(peer->getName(), peer->getStatusLatency());
+        emit receivingCompleted();
+    }
+}
+
+// Threads used to encode a plan layer by layer, 1 encodes serially
+void Server::setThreadCount(int threadCount)
+{
+    m_pool.setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
+}
+
+// Start recording every frame in and out with high-resolution timestamps
+void Server::startCapture(QString fileName)
+{
+    if (!m_trace.open(fileName, TRACE_SERVER))
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Failed to open capture file" << fileName;
+        return;
+    }
+    qCDebug(SERVER()) << SERVER().categoryName() << "Capturing frames to" << fileName;
+}
 
-    qCDebug(SERVER()) << SERVER().categoryName() << "Receiving data...";
+void Server::stopCapture()
+{
+    m_trace.close();
+}
 
-    qint64 type;
+bool Server::dumpFlightRecorder(QString fileName)
+{
+    if (!m_recorder.dump(fileName))
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Failed to write flight recorder" << fileName;
+        return false;
+    }
+    qCDebug(SERVER()) << SERVER().categoryName() << "Flight recorder written to" << fileName;
+    return true;
+}
 
-    in >> type
-       >> m_totalBytes
-       >> m_status;
+// Every frame goes into the flight recorder, and into the capture file when one is open
+void Server::traceFrame(quint16 peer, TraceDirection direction, int type, const QByteArray &frame)
+{
+    m_recorder.record(direction == TRACE_IN ? FLIGHT_FRAME_IN : FLIGHT_FRAME_OUT, type, peer, frame.size());
+    m_trace.write(direction, type, frame);
+}
 
-    qDebug() << "m_totalBytes:" << m_totalBytes;
-    qDebug() << "m_status:" << m_status;
+// A frame in pieces is gathered only while capturing
+void Server::traceFrame(quint16 peer, TraceDirection direction, int type, const ScatterFrame &frame)
+{
+    m_recorder.record(direction == TRACE_IN ? FLIGHT_FRAME_IN : FLIGHT_FRAME_OUT, type, peer, frame.size());
+    if (m_trace.isOpen())
+        m_trace.write(direction, type, frame.toByteArray());
+}
 
-    m_receiveSocket->close();
-    qCDebug(SERVER()) << SERVER().categoryName() << "RECEIVED PROGRESS UPDATE FINISHED.";
-    emit receivingCompleted();
+// The events that led to an error are written out at once, at most one file per FLIGHT_DUMP_INTERVAL
+void Server::recordError(quint16 peer, int errorCode, qint64 detail)
+{
+    m_recorder.record(FLIGHT_ERROR, errorCode, peer, 0, detail);
+    if (m_flightDirectory.isEmpty())
+        return;
+    if (m_lastFlightDump.isValid() && m_lastFlightDump.elapsed() < FLIGHT_DUMP_INTERVAL)
+        return;
+    m_lastFlightDump.start();
+    QString fileName = "flight " + QDateTime::currentDateTime().toString("yyyy-MM-dd hh-mm-ss-zzz") + ".bin";
+    dumpFlightRecorder(QDir(m_flightDirectory).filePath(fileName));
 }
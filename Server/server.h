@@ -7,14 +7,27 @@
 #include <QHash>
 #include <QStringList>
 #include <QVariant>
+#include <QThreadPool>
 #include <QLoggingCategory>
 
 #include "server_global.h"
 #include "constant.h"
 #include "variable.h"
+#include "tracefile.h"
+#include "flightrecorder.h"
+#include "protocol.h"
+#include "planencoder.h"
+#include "orderoptimizer.h"
+#include "serverpeer.h"
+#include "statusdispatcher.h"
+#include "multicastsender.h"
+#include "statuspublisher.h"
+#include "transaction.h"
 
 Q_DECLARE_LOGGING_CATEGORY(SERVER)
 
+#define DEFAULT_PEER "default"    // Client configured in the [Send] section
+
 class SERVERSHARED_EXPORT Server : public QObject
 {
     Q_OBJECT
@@ -23,54 +36,128 @@ public:
     Server(QObject *parent = 0);
     ~Server();
 
-    inline QHash<QString, QVariant> getStatus() { return m_status; }
+    enum Error
+    {
+        NoError,
+        ErrorSend,
+        ErrorReadReceipt,
+        ErrorReceive,
+        ErrorNegotiate,
+        ErrorRejected,
+        ErrorCommand,
+        ErrorRemoved
+    };
+
+    inline QHash<QString, QVariant> getStatus() { return getStatus(DEFAULT_PEER); }
+    QHash<QString, QVariant> getStatus(QString peer);
+    // Of the default peer, 0 once it was removed
+    int getPeerVersion();
+    quint32 getPeerCapabilities();
+
+    // Named clients, each with its own connection, plan queue and status
+    void addPeer(QString name, QString ipAddress, quint16 port);
+    void removePeer(QString name);
+    inline QStringList getPeerNames() { return m_peers.keys(); }
+    inline ServerPeer *getPeer(QString name) { return m_peers.value(name); }
+
+    // Queue a plan for the pipeline, returns its id for planCompleted()/planFailed()
+    int queuePlan(QHash<float, QList<Spot3DCoordinate> > spot3D, QHash<float, QList<int> > spotOrder,
+                  SpotSonicationParameter parameter);
+    int queuePlan(QString peer, QHash<float, QList<Spot3DCoordinate> > spot3D, QHash<float, QList<int> > spotOrder,
+                  SpotSonicationParameter parameter);
+    int getQueuedPlanCount();
+    // Queue the newest plan the peer acknowledged again, from the store; -1 if there is none
+    int resendPlan(QString peer);
+    // One plan for several peers, encoded once and sent once to the [Multicast] group; one id per peer,
+    // -1 for an unknown one. Peers without CAP_MULTICAST, or all when multicast is off, get it by unicast.
+    QList<int> multicastPlan(QStringList peers, QHash<float, QList<Spot3DCoordinate> > spot3D,
+                             QHash<float, QList<int> > spotOrder, SpotSonicationParameter parameter);
+    inline bool isMulticastEnabled() { return m_multicast->isOpen(); }
+    inline MulticastStats getMulticastStats() { return m_multicast->stats(); }
+    // Every status received is republished to the read-only observers of [Observers]
+    inline bool isPublishingStatus() { return m_publisher->isListening(); }
+    inline PublisherStats getObserverStats() { return m_publisher->stats(); }
+
+    // Transactions with their own state, started at once and awaitable with co_await:
+    // a plan is done when its receipt or refusal is in, a command when it is acknowledged
+    PlanTransaction sendPlanAsync(QString peer, QHash<float, QList<Spot3DCoordinate> > spot3D,
+                                  QHash<float, QList<int> > spotOrder, SpotSonicationParameter parameter);
+    CommandTransaction sendCommandAsync(QString peer, cmdType iType);
+
+    // Phase transitions of spotCount spots sonicated with parameter, in time order
+    static QVector<ScheduledCommand> buildSchedule(SpotSonicationParameter parameter, int spotCount);
+
+    // Clock offset of a peer (client - server) and one-way latency of its last status, in us; 0 for an unknown peer
+    qint64 getClockOffset(QString peer);
+    qint64 getStatusLatency(QString peer);
+
+    inline int getStatusFrameCount() { return m_server->getFrameCount(); }
 
 public slots:
     inline void setCoordinate(QHash<float, QList<Spot3DCoordinate> > spot3D){ m_spot3D = spot3D; }
     inline void setSpotOrder(QHash<float, QList<int> > spotOrder){ m_spotOrder = spotOrder; }
     inline void setParameter(SpotSonicationParameter parameter){ m_parameter = parameter; }
+    void setThreadCount(int threadCount);    // 0 uses one thread per core
+    inline void setWorkerCount(int workerCount) { m_server->setWorkerCount(workerCount); }    // Status listener threads, 0 one per core
+    inline void setOrderOptimization(bool enabled) { m_optimizeOrder = enabled; }    // Reorder the spots of queued plans
+    inline void setScatterGather(bool enabled) { m_scatterGather = enabled; }    // For plans prepared from now on
 
     void sendPlan();
-    void sendCommand(cmdType);
+    void sendPlan(QString peer);
+    // Sequence number of the command in commandAcknowledged() and commandFailed(), 0 for an unknown peer
+    quint32 sendCommand(cmdType);
+    quint32 sendCommand(QString peer, cmdType iType);
+    void broadcastCommand(cmdType iType);    // Same command to every peer at once
+    void sendSchedule(QVector<ScheduledCommand> schedule, int startDelay);    // Starts startDelay ms after receipt
+    void sendSchedule(QString peer, QVector<ScheduledCommand> schedule, int startDelay);
     void listen();
+    void negotiate();    // Exchange protocol version and capabilities with the client
+
+    void startCapture(QString fileName);    // Record every frame into a binary trace file
+    void stopCapture();
+    bool dumpFlightRecorder(QString fileName);    // Write the recent network events, see flightrecorder.h
 
 private slots:
     void handleError(QString errorString);
-    void connectServer();    // Connect to client
-    void displayError(QAbstractSocket::SocketError);    // Display error
     QString getLocalIP();
 
-    void readReceipt();
-    void writtenBytes(qint64);
-
     void updateSettings();
     void readSettings();
 
-    void acceptConnection();
     void receive();
 
+    void peerNegotiated(int version, quint32 capabilities);
+    void peerPlanCompleted(int planId);
+    void peerPlanFailed(int planId, int errorCode, QString detail);
+    void peerCommandSent(int iType);
+    void peerCommandAcknowledged(quint32 sequence, int iType, int result, qint64 latency);
+    void peerCommandFailed(quint32 sequence, int iType);
+    void peerScheduleCancelled(int commandsLeft);
+    void peerScheduleRejected(QString detail);
+    void peerError(int errorCode);
+
 signals:
     sendingCompleted();
     error(QString errorString);
     receivingCompleted();
+    void negotiated(QString peer, int version, quint32 capabilities);
+    void planCompleted(int planId);
+    void planFailed(int planId, QString errorString);
+    void statusReceived(QString peer);
+    void statusLatency(QString peer, qint64 latency);
+    void orderOptimized(int planId, double lengthBefore, double lengthAfter, double timeSaved);
+    void commandAcknowledged(QString peer, quint32 sequence, int iType, int result, qint64 latency);    // Round trip in us
+    void commandFailed(QString peer, quint32 sequence, int iType);
+    // By a command of the operator, a STOP in it, or a stop or failed negotiation before it was sent
+    void scheduleCancelled(QString peer, int commandsLeft);
+    void scheduleRejected(QString peer, QString detail);
 
 private:
-    QTcpServer *m_server;
-    QTcpSocket *m_sendSocket, *m_receiveSocket;
+    friend class ServerPeer;
 
-    QByteArray m_baOut;
-    void encodePlan(QByteArray* baBlock);
-    void encodeSpot();
-    void encodeCmd(QByteArray* baBlock, cmdType iType);
-//    void decodeStatus(QByteArray* baBlock);
+    StatusDispatcher *m_server;    // Status connections are read on its worker threads
 
-    enum Error
-    {
-        NoError,
-        ErrorSend,
-        ErrorReadReceipt,
-        ErrorReceive
-    };
+    void encodeCmd(QByteArray* baBlock, cmdType iType);
 
     QStringList m_errorList;
     void setErrorString();
@@ -78,22 +165,46 @@ private:
     QStringList m_cmdList;
     void setCmdString();
 
-    qint64 m_totalBytes, m_writtenBytes;    // Total bytes to send for this send progress
-
     QHash<float, QList<Spot3DCoordinate> > m_spot3D;
-    QHash<float, QList<Coordinate> > m_hashX, m_hashY, m_hashZ;
-
     QHash<float, QList<int> > m_spotOrder;
     SpotSonicationParameter m_parameter;
 
+    QThreadPool m_pool;    // Layer-parallel plan encoding
+    QThreadPool m_preparePool;    // Prepare stage of every peer's plan pipeline
+    int m_nextPlanId;
+
+    OrderOptimizer m_optimizer;
+    bool m_optimizeOrder;
+    TreatmentPlan buildPlan(const QList<int> &planIds, const QHash<float, QList<Spot3DCoordinate> > &spot3D,
+                            const QHash<float, QList<int> > &spotOrder, SpotSonicationParameter parameter);
+
+    MulticastSender *m_multicast;    // Open when [Multicast] is enabled
+    StatusPublisher *m_publisher;    // Listening when [Observers] is enabled
+
+    QHash<QString, ServerPeer *> m_peers;
+    ServerPeer *findPeer(const QString &name, const QHostAddress &address);
+
     int m_sendTimeNum;
-    QString m_receipt;
-    void genReceipt(QString& receipt);
+    void genReceipt(QString& receipt, const QString &client);
 
     QString m_receiveIpAddress, m_sendIpAddress;
     quint16 m_receivePort, m_sendPort;
-
-    QHash<QString, QVariant> m_status;
+    quint16 m_statusInterval;    // Advertised to the clients in the hello
+    int m_syncInterval;    // ms between clock exchanges with each peer, 0 only at negotiation
+    int m_commandWindow;    // Commands a peer may have unacknowledged at once
+    int m_commandTimeout;    // ms without an ack before the commands in flight are sent again
+    int m_commandRetries;
+    QString m_storeDirectory;    // Each peer keeps its plans in a directory of its name, empty for none
+    int m_storeCapacity;
+    bool m_scatterGather;    // SoA plans go out uncompressed from their pieces, see ScatterFrame
+
+    TraceWriter m_trace;
+    FlightRecorder m_recorder;    // Always on, dumped into m_flightDirectory on errors
+    QString m_flightDirectory;    // Empty for no automatic dumps
+    QElapsedTimer m_lastFlightDump;
+    void traceFrame(quint16 peer, TraceDirection direction, int type, const QByteArray &frame);
+    void traceFrame(quint16 peer, TraceDirection direction, int type, const ScatterFrame &frame);
+    void recordError(quint16 peer, int errorCode, qint64 detail);
 };
 
 
@@ -0,0 +1,1163 @@
+#include <QDebug>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "serverpeer.h"
+#include "server.h"
+
+ServerPeer::ServerPeer(Server *server, QString name, QString ipAddress, quint16 port) : QObject(server),
+    m_owner(server), m_name(name), m_ipAddress(ipAddress), m_port(port),
+    m_flightId(server->m_recorder.registerPeer(name)),
+    m_transmitting(false), m_preparingId(-1), m_totalBytes(0), m_writtenBytes(0), m_writePending(false),
+    m_peerVersion(0), m_peerCapabilities(0), m_handshaking(false), m_nextSequence(1),
+    m_scheduleNext(0), m_scheduleStart(0), m_pendingScheduleDelay(0),
+    m_statusLatency(NO_TIMESTAMP), m_statusSession(0)
+{
+    m_sendSocket = new QTcpSocket(this);
+    connect(m_sendSocket, SIGNAL(readyRead()), this, SLOT(readReceipt()));
+    connect(m_sendSocket, SIGNAL(connected()), this, SLOT(writePlan()));
+    connect(m_sendSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(displayError(QAbstractSocket::SocketError)));
+
+//  A new session on every start, so a client never takes our sequence numbers for old ones
+    m_commandSession = quint32(QDateTime::currentMSecsSinceEpoch()) ^ qHash(name);
+    m_commandSocket = new QTcpSocket(this);
+    connect(m_commandSocket, SIGNAL(readyRead()), this, SLOT(readAck()));
+    connect(m_commandSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(commandError(QAbstractSocket::SocketError)));
+    m_commandTimer.setSingleShot(true);
+    connect(&m_commandTimer, SIGNAL(timeout()), this, SLOT(retransmitCommands()));
+
+    connect(&m_prepareWatcher, SIGNAL(finished()), this, SLOT(prepareFinished()));
+
+    m_helloTimer.setSingleShot(true);
+    m_helloTimer.setInterval(HELLO_TIMEOUT);
+    connect(&m_helloTimer, SIGNAL(timeout()), this, SLOT(helloTimeout()));
+
+    connect(&m_syncTimer, SIGNAL(timeout()), this, SLOT(synchronize()));
+
+    m_scheduleTimer.setSingleShot(true);
+    m_scheduleTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_scheduleTimer, SIGNAL(timeout()), this, SLOT(fireSchedule()));
+}
+
+ServerPeer::~ServerPeer()
+{
+    m_prepareWatcher.waitForFinished();
+}
+
+void ServerPeer::abandon()
+{
+    m_helloTimer.stop();
+    m_syncTimer.stop();
+    m_commandTimer.stop();
+    m_handshaking = false;
+    cancelSchedule();
+
+    QList<CommandJob> commands = m_inFlight + m_commandQueue + m_pendingCommands;
+    m_inFlight.clear();
+    m_commandQueue.clear();
+    m_pendingCommands.clear();
+    for (int i = 0; i < commands.size(); i++)
+        emit commandFailed(commands.at(i).sequence, commands.at(i).type);
+
+    QList<PlanJob> plans = m_planQueue;
+    m_planQueue.clear();
+    m_transmitting = false;
+    m_writePending = false;
+    for (int i = 0; i < plans.size(); i++)
+        emit planFailed(plans.at(i).id, Server::ErrorRemoved, QString());
+
+    m_sendSocket->abort();
+    m_commandSocket->abort();
+    if (!plans.isEmpty() || !commands.isEmpty())
+        qCDebug(SERVER()) << SERVER().categoryName() << m_name << "removed with" << plans.size() << "plans and"
+                          << commands.size() << "commands failed.";
+}
+
+// Connect to the client for sending plans
+void ServerPeer::connectServer()
+{
+    m_owner->m_recorder.record(FLIGHT_CONNECT, m_handshaking ? HELLO : PLAN, m_flightId, 0, m_port);
+    m_sendSocket->connectToHost(QHostAddress(m_ipAddress), m_port);
+}
+
+void ServerPeer::displayError(QAbstractSocket::SocketError socketError)
+{
+    m_owner->m_recorder.record(FLIGHT_SOCKET_ERROR, socketError, m_flightId);
+    if (m_handshaking)
+    {
+//  The client may close right after its hello reply
+        if (socketError == QAbstractSocket::RemoteHostClosedError && m_sendSocket->bytesAvailable() > 0)
+        {
+            readHello();
+            return;
+        }
+        m_helloTimer.stop();
+        m_handshaking = false;
+        for (int i = 0; i < m_pendingCommands.size(); i++)
+            emit commandFailed(m_pendingCommands.at(i).sequence, m_pendingCommands.at(i).type);
+        m_pendingCommands.clear();
+        cancelSchedule();
+        emit error(Server::ErrorNegotiate);
+
+//  Nothing can be sent before the client is reachable
+        while (!m_planQueue.isEmpty())
+            emit planFailed(m_planQueue.takeFirst().id, Server::ErrorNegotiate, QString());
+    }
+
+    qCWarning(SERVER()) << SERVER().categoryName() << m_name << m_sendSocket->errorString();
+
+    if (m_transmitting)
+    {
+//  The receipt may still be waiting in the buffer when the client closes
+        if (socketError == QAbstractSocket::RemoteHostClosedError && m_sendSocket->bytesAvailable() > 0)
+            receiveReceipt(true);
+        else
+            finishPlan(false, Server::ErrorSend);
+    }
+
+    m_sendSocket->close();
+}
+
+void ServerPeer::queuePlan(int planId, const TreatmentPlan &plan)
+{
+    PlanJob job;
+    job.id = planId;
+    job.plan = plan;
+    job.version = 0;
+    job.capabilities = 0;
+    job.transfer = 0;
+    m_owner->genReceipt(job.receipt, m_name);
+    m_planQueue.append(job);
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << planId << "queued for" << m_name << ","
+                      << m_planQueue.size() << "in queue.";
+
+    preparePlans();
+    transmitPlan();
+}
+
+void ServerPeer::queueMulticastPlan(int planId, const TreatmentPlan &plan, const QString &receipt, quint32 transfer,
+                                    const QByteArray &frame)
+{
+    PlanJob job;
+    job.id = planId;
+    job.plan = plan;
+    job.receipt = receipt;
+    job.frame = ScatterFrame(frame);
+    job.version = PROTOCOL_VERSION;
+    job.capabilities = MULTICAST_CAPABILITIES;
+    job.transfer = transfer;
+    m_planQueue.append(job);
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << planId << "queued for" << m_name << "as transfer"
+                      << transfer << "," << m_planQueue.size() << "in queue.";
+
+    preparePlans();
+    transmitPlan();
+}
+
+// Prepare stage: encode, compress and checksum the next unprepared plan on a worker thread.
+// Only the plan on the wire and the one behind it are held encoded.
+void ServerPeer::preparePlans()
+{
+    if (m_peerVersion == 0 || m_preparingId >= 0)
+        return;
+
+    int depth = qMin(m_planQueue.size(), 2);
+    for (int i = 0; i < depth; i++)
+    {
+        PlanJob &job = m_planQueue[i];
+        if (m_transmitting && i == 0)
+            continue;
+        if (job.transfer != 0)
+        {
+            if (m_peerCapabilities & CAP_MULTICAST)
+                continue;
+//  The peer cannot take the multicast frame, it gets one of its own
+            job.transfer = 0;
+            job.frame = ScatterFrame();
+            m_owner->genReceipt(job.receipt, m_name);
+        }
+        if (!job.frame.isEmpty() && job.version == m_peerVersion && job.capabilities == m_peerCapabilities)
+            continue;
+
+        job.version = m_peerVersion;
+        job.capabilities = m_peerCapabilities;
+        m_preparingId = job.id;
+
+        TreatmentPlan plan = job.plan;
+        QString receipt = job.receipt;
+        int version = job.version;
+        quint32 capabilities = job.capabilities;
+        QThreadPool *pool = &m_owner->m_pool;
+        bool scatter = m_owner->m_scatterGather;
+        m_prepareWatcher.setFuture(QtConcurrent::run(&m_owner->m_preparePool, [=]() {
+            return PlanEncoder::encode(plan, receipt, version, capabilities, pool, scatter);
+        }));
+        return;
+    }
+}
+
+void ServerPeer::prepareFinished()
+{
+    for (int i = 0; i < m_planQueue.size(); i++)
+    {
+        if (m_planQueue.at(i).id == m_preparingId)
+        {
+            m_planQueue[i].frame = m_prepareWatcher.result();
+            qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << m_preparingId << "prepared,"
+                              << m_planQueue.at(i).frame.size() << "bytes in" << m_planQueue.at(i).frame.pieceCount()
+                              << "pieces.";
+            break;
+        }
+    }
+    m_preparingId = -1;
+
+    preparePlans();
+    transmitPlan();
+}
+
+// Transmit stage: send the head of the queue once it is prepared for the negotiated protocol
+void ServerPeer::transmitPlan()
+{
+    if (m_transmitting || m_planQueue.isEmpty())
+        return;
+    if (m_peerVersion == 0)
+    {
+        negotiate();
+        return;
+    }
+
+    PlanJob &job = m_planQueue.first();
+    if (job.transfer != 0)
+    {
+        if (!(m_peerCapabilities & CAP_MULTICAST))
+            return;    // Waits to be prepared for unicast
+    }
+    else if (job.frame.isEmpty() || job.version != m_peerVersion || job.capabilities != m_peerCapabilities)
+    {
+        return;
+    }
+
+    m_transmitting = true;
+    m_writtenBytes = 0;
+
+    connectServer();
+
+//  Check if the data has been all well written
+    connect(m_sendSocket, SIGNAL(bytesWritten(qint64)),
+            this, SLOT(writtenBytes(qint64)));
+
+    if (job.transfer != 0)
+    {
+//  The frame is on its way to the group, the client collects it and answers here
+        QByteArray baAnnounce = encodeAnnounce(job.transfer, job.frame.size(), m_peerCapabilities);
+        m_totalBytes = baAnnounce.size();
+        qCDebug(SERVER()) << SERVER().categoryName() << "Announcing plan" << job.id << "to" << m_name
+                          << "as transfer" << job.transfer << "...";
+
+        stampFrame(baAnnounce, sessionTime());
+        m_owner->traceFrame(m_flightId, TRACE_OUT, ANNOUNCE, baAnnounce);
+        m_sendSocket->write(baAnnounce);
+        preparePlans();
+        return;
+    }
+
+    m_totalBytes = job.frame.size();
+    qCDebug(SERVER()) << SERVER().categoryName() << "Sending plan" << job.id << "to" << m_name << "...";
+    qDebug() << "m_totalBytes:" << m_totalBytes;
+
+//  Written from the plan's own arrays once connected, rather than queued in the socket now
+    m_writePending = true;
+    if (m_sendSocket->state() == QAbstractSocket::ConnectedState)
+        writePlan();
+
+//  Plan N+1 is encoded while plan N is on the wire
+    preparePlans();
+}
+
+// The kernel takes the pieces of the frame straight from the plan, only what it cannot take at once
+// is copied into the socket's buffer. Those bytes are counted by writtenBytes(), the rest here.
+void ServerPeer::writePlan()
+{
+    if (!m_writePending || !m_transmitting)
+        return;
+    m_writePending = false;
+
+    PlanJob &job = m_planQueue.first();
+    QElapsedTimer timer;
+    timer.start();
+    job.frame.stamp(sessionTime());
+    m_owner->traceFrame(m_flightId, TRACE_OUT, PLAN, job.frame);
+    qint64 direct = job.frame.writeTo(m_sendSocket);
+    m_writtenBytes += direct;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << job.id << ":" << direct << "of" << job.frame.size()
+                      << "bytes taken by the kernel from" << job.frame.pieceCount() << "pieces in"
+                      << timer.nsecsElapsed() / 1000 << "us";
+}
+
+void ServerPeer::finishPlan(bool ok, int errorCode, const QString &detail)
+{
+    disconnect(m_sendSocket, SIGNAL(bytesWritten(qint64)),
+               this, SLOT(writtenBytes(qint64)));
+    m_writePending = false;
+
+    PlanJob job = m_planQueue.takeFirst();
+    m_transmitting = false;
+
+    if (ok)
+    {
+        qCDebug(SERVER()) << SERVER().categoryName() << "Plan" << job.id << "sent to" << m_name;
+        storePlan(job);
+        emit planCompleted(job.id);
+    }
+    else
+    {
+        emit planFailed(job.id, errorCode, detail);
+    }
+
+    preparePlans();
+    transmitPlan();
+}
+
+bool ServerPeer::openStore(const QString &directory, int capacity)
+{
+    if (m_store.open(directory, capacity))
+        return true;
+    qCWarning(SERVER()) << SERVER().categoryName() << "Plan store" << directory << "could not be opened";
+    return false;
+}
+
+// Acknowledged plan as an image, the layers of the spots and of the order merged in depth order
+void ServerPeer::storePlan(const PlanJob &job)
+{
+    if (!m_store.isOpen())
+        return;
+
+    const TreatmentPlan &plan = job.plan;
+    QVector<float> depths = plan.spot3D.depths();
+    for (int i = 0; i < plan.spotOrder.size(); i++)
+    {
+        if (!plan.spot3D.contains(plan.spotOrder.depthAt(i)))
+            depths.append(plan.spotOrder.depthAt(i));
+    }
+    std::sort(depths.begin(), depths.end());
+
+    qint64 spotCount = 0, orderCount = 0;
+    for (int i = 0; i < plan.spot3D.size(); i++)
+        spotCount += plan.spot3D.at(i).size();
+    for (int i = 0; i < plan.spotOrder.size(); i++)
+        orderCount += plan.spotOrder.at(i).size();
+
+    PlanImageWriter writer(depths.size(), spotCount, orderCount, plan.parameter);
+    for (int i = 0; i < depths.size(); i++)
+    {
+        const QList<Spot3DCoordinate> *spotList = plan.spot3D.find(depths.at(i));
+        const QList<int> *orderList = plan.spotOrder.find(depths.at(i));
+        int layerSpots = spotList ? spotList->size() : 0;
+        int layerOrder = orderList ? orderList->size() : 0;
+
+        Spot3DCoordinate *spots;
+        qint32 *order;
+        writer.addLayer(depths.at(i), layerSpots, layerOrder, spots, order);
+        for (int j = 0; j < layerSpots; j++)
+            spots[j] = spotList->at(j);
+        for (int j = 0; j < layerOrder; j++)
+            order[j] = orderList->at(j);
+    }
+
+    if (m_store.save(writer.image(), job.id) == 0)
+        qCWarning(SERVER()) << SERVER().categoryName() << "Plan" << job.id << "of" << m_name << "could not be stored";
+}
+
+bool ServerPeer::restorePlan(TreatmentPlan &plan)
+{
+    qint64 size, sequence, tag;
+    PlanImageReader reader;
+    if (!reader.open(m_store.mapLatest(size, sequence, tag), size))
+    {
+        m_store.unmap();
+        return false;
+    }
+
+    plan.spot3D.clear();
+    plan.spotOrder.clear();
+    plan.parameter = reader.parameter();
+    for (int i = 0; i < reader.layerCount(); i++)
+    {
+        float depth;
+        Spot3DCoordinate *spots;
+        qint32 *order;
+        int spotCount, orderCount;
+        reader.layer(i, depth, spots, spotCount, order, orderCount);
+
+        QList<Spot3DCoordinate> &spotList = plan.spot3D.layer(depth);
+        spotList.reserve(spotCount);
+        for (int j = 0; j < spotCount; j++)
+            spotList.append(spots[j]);
+        if (orderCount > 0)
+        {
+            QList<int> &orderList = plan.spotOrder.layer(depth);
+            orderList.reserve(orderCount);
+            for (int j = 0; j < orderCount; j++)
+                orderList.append(order[j]);
+        }
+    }
+    m_store.unmap();
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Restored plan" << tag << "of" << m_name
+                      << "stored as" << sequence;
+    return true;
+}
+
+// Slot function to capture written bytes of socket, a large plan arrives in several chunks
+void ServerPeer::writtenBytes(qint64 bytesWrite)
+{
+    qDebug() << "Bytes Written:" << bytesWrite;
+
+    m_writtenBytes += bytesWrite;
+}
+
+// Read receipt
+void ServerPeer::readReceipt()
+{
+    if (m_handshaking)
+    {
+        readHello();
+        return;
+    }
+    receiveReceipt(false);
+}
+
+// The receipt may arrive in pieces; closed means the client is gone and nothing more will come
+void ServerPeer::receiveReceipt(bool closed)
+{
+    QByteArray baBlock = m_sendSocket->peek(m_sendSocket->bytesAvailable());
+    if (!m_transmitting)
+    {
+        m_sendSocket->read(baBlock.size());
+        m_owner->traceFrame(m_flightId, TRACE_IN, TRACE_RECEIPT, baBlock);
+        m_sendSocket->close();
+        return;
+    }
+    if (baBlock.size() < int(sizeof(qint64)) && !closed)
+        return;    // Too short to tell a reject frame from a receipt
+
+//  A client collecting a multicast plan asks for what it missed before it answers
+    while (isNackFrame(baBlock))
+    {
+        if (!receiveNack(closed))
+            return;
+        baBlock = m_sendSocket->peek(m_sendSocket->bytesAvailable());
+        if (baBlock.size() < int(sizeof(qint64)))
+        {
+            if (closed)
+                finishPlan(false, Server::ErrorSend);
+            return;
+        }
+    }
+
+    QDataStream in(baBlock);
+    in.setVersion(QDataStream::Qt_4_6);
+
+//  A client that refused the plan says why instead of sending the receipt
+    if (isRejectFrame(baBlock))
+    {
+        qint64 header, totalBytes;
+        quint32 flags;
+        QByteArray payload;
+        in >> header;
+        bool decoded = decodeFrame(in, totalBytes, flags, payload);
+        if (in.status() == QDataStream::ReadPastEnd && !closed)
+            return;    // Wait for the rest of the frame
+
+        m_sendSocket->read(baBlock.size());
+        m_owner->traceFrame(m_flightId, TRACE_IN, TRACE_RECEIPT, baBlock);
+        m_sendSocket->close();
+
+        QString detail = "Malformed reject frame.";
+        if (decoded)
+        {
+            QDataStream payloadIn(payload);
+            payloadIn.setVersion(QDataStream::Qt_4_6);
+            QString receipt;
+            PlanError error;
+            payloadIn >> receipt >> error.code >> error.layer >> error.index >> error.message;
+            detail = error.message;
+        }
+        qCWarning(SERVER()) << SERVER().categoryName() << m_name << "rejected plan" << m_planQueue.first().id
+                            << ":" << detail;
+        finishPlan(false, Server::ErrorRejected, detail);
+        return;
+    }
+
+    QString receipt;
+    in >> receipt;
+    if (in.status() == QDataStream::ReadPastEnd && !closed)
+        return;    // Wait for the rest of the receipt
+
+    m_sendSocket->read(baBlock.size());
+    m_owner->traceFrame(m_flightId, TRACE_IN, TRACE_RECEIPT, baBlock);
+    m_sendSocket->close();
+
+//  Check the consistency of the send-back data
+    m_owner->m_recorder.record(FLIGHT_RECEIPT, m_planQueue.first().receipt == receipt, m_flightId,
+                               baBlock.size(), m_planQueue.first().id);
+    if (m_planQueue.first().receipt != receipt)
+        finishPlan(false, Server::ErrorReadReceipt);
+    else if (m_writtenBytes != m_totalBytes)
+        finishPlan(false, Server::ErrorSend);
+    else
+        finishPlan(true, Server::NoError);
+}
+
+// Chunks the client missed go to the group again; without a list, or once the transfer is gone,
+// the frame follows the announce on this connection. False while the NACK is not complete.
+bool ServerPeer::receiveNack(bool closed)
+{
+    QByteArray baBlock = m_sendSocket->peek(m_sendSocket->bytesAvailable());
+    QDataStream in(baBlock);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    qint64 header, totalBytes;
+    in >> header >> totalBytes;
+    if (in.status() != QDataStream::Ok || baBlock.size() < totalBytes)
+    {
+        if (closed)
+            finishPlan(false, Server::ErrorSend);
+        return false;    // Wait for the rest of the frame
+    }
+    if (totalBytes < 2 * qint64(sizeof(qint64)))
+    {
+        m_sendSocket->abort();
+        finishPlan(false, Server::ErrorReadReceipt, "Malformed NACK frame.");
+        return false;
+    }
+
+    QByteArray baFrame = m_sendSocket->read(totalBytes);
+    m_owner->traceFrame(m_flightId, TRACE_IN, NACK, baFrame);
+
+    QDataStream frameIn(baFrame);
+    frameIn.setVersion(QDataStream::Qt_4_6);
+    quint32 flags;
+    QByteArray payload;
+    frameIn >> header;
+    quint32 transfer = 0;
+    QVector<quint32> missing;
+    if (decodeFrame(frameIn, totalBytes, flags, payload))
+    {
+        QDataStream payloadIn(payload);
+        payloadIn.setVersion(QDataStream::Qt_4_6);
+        payloadIn >> transfer >> missing;
+    }
+
+    PlanJob &job = m_planQueue.first();
+    if (job.transfer == 0 || transfer != job.transfer)
+        return true;    // The frame is already on this connection
+
+    if (!missing.isEmpty() && m_owner->m_multicast->repair(transfer, missing))
+    {
+        qCDebug(SERVER()) << SERVER().categoryName() << m_name << "missed" << missing.size()
+                          << "chunks of transfer" << transfer;
+        return true;
+    }
+
+    qCDebug(SERVER()) << SERVER().categoryName() << m_name << "takes transfer" << transfer << "by unicast.";
+    m_owner->m_multicast->countFallback(job.frame.size());
+    job.transfer = 0;
+    m_totalBytes += job.frame.size();
+    job.frame.stamp(sessionTime());
+    m_owner->traceFrame(m_flightId, TRACE_OUT, PLAN, job.frame);
+    m_writtenBytes += job.frame.writeTo(m_sendSocket);
+    return true;
+}
+
+// A command of the operator overrides the schedule: left running, it would START or RESUME against a PAUSE or STOP
+quint32 ServerPeer::sendCommand(cmdType iType)
+{
+    cancelSchedule();
+    return issueCommand(iType);
+}
+
+quint32 ServerPeer::issueCommand(cmdType iType)
+{
+    CommandJob job;
+    job.sequence = m_nextSequence++;
+    job.type = iType;
+    job.sent = 0;
+    job.attempts = 0;
+    dispatchCommand(job);
+    return job.sequence;
+}
+
+void ServerPeer::dispatchCommand(const CommandJob &job)
+{
+    if (m_peerVersion == 0 && job.type != STOP)
+    {
+        m_pendingCommands.append(job);
+        negotiate();
+        return;
+    }
+    if (m_peerVersion == 0)
+    {
+//  A stop never waits for the hello, a legacy client may not answer it for HELLO_TIMEOUT.
+//  Every client reads the legacy encoding below; what waited for the hello would
+//  otherwise be sent after the stop, so it fails, the schedule as cancelled.
+        for (int i = 0; i < m_pendingCommands.size(); i++)
+            emit commandFailed(m_pendingCommands.at(i).sequence, m_pendingCommands.at(i).type);
+        m_pendingCommands.clear();
+        cancelSchedule();
+        negotiate();
+    }
+
+    if (m_peerCapabilities & CAP_COMMAND_ACK)
+    {
+        m_commandQueue.append(job);
+        pumpCommands();
+        return;
+    }
+
+    QByteArray baBlock;
+    if (m_peerVersion >= PROTOCOL_VERSION)
+    {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << qint64(job.type);
+        baBlock = encodeFrame(COMMAND, payload, 0, m_peerCapabilities);
+    }
+    else
+    {
+        m_owner->encodeCmd(&baBlock, job.type);
+    }
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Start sending command to" << m_name << "...";
+    QTcpSocket *commandSocket = writeOneShot(COMMAND, baBlock);
+
+//  Nothing comes back from these clients, the command is done once written and closed
+    commandSocket->setProperty("sequence", job.sequence);
+    commandSocket->setProperty("command", int(job.type));
+    commandSocket->setProperty("sent", sessionTime());
+    connect(commandSocket, SIGNAL(disconnected()), this, SLOT(oneShotWritten()));
+    connect(commandSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(oneShotError(QAbstractSocket::SocketError)));
+    emit commandSent(job.type);
+}
+
+void ServerPeer::oneShotWritten()
+{
+    QTcpSocket *commandSocket = qobject_cast<QTcpSocket *>(sender());
+    if (!commandSocket)
+        return;
+    commandSocket->disconnect(this);
+    emit commandAcknowledged(commandSocket->property("sequence").toUInt(), commandSocket->property("command").toInt(),
+                             COMMAND_DONE, sessionTime() - commandSocket->property("sent").toLongLong());
+}
+
+// The client closing first is how a legacy client finishes, anything else lost the command
+void ServerPeer::oneShotError(QAbstractSocket::SocketError socketError)
+{
+    QTcpSocket *commandSocket = qobject_cast<QTcpSocket *>(sender());
+    if (!commandSocket || socketError == QAbstractSocket::RemoteHostClosedError)
+        return;
+    m_owner->m_recorder.record(FLIGHT_SOCKET_ERROR, socketError, m_flightId);
+    commandSocket->disconnect(this);
+    qCWarning(SERVER()) << SERVER().categoryName() << m_name << commandSocket->errorString();
+    emit commandFailed(commandSocket->property("sequence").toUInt(), commandSocket->property("command").toInt());
+}
+
+// Fill the window; frames written while the connection is being made wait in the socket
+void ServerPeer::pumpCommands()
+{
+    if (m_commandQueue.isEmpty())
+        return;
+    if (m_commandSocket->state() == QAbstractSocket::UnconnectedState)
+    {
+        m_owner->m_recorder.record(FLIGHT_CONNECT, COMMAND, m_flightId, 0, m_port);
+        m_commandSocket->connectToHost(QHostAddress(m_ipAddress), m_port);
+    }
+
+    while (!m_commandQueue.isEmpty() && m_inFlight.size() < m_owner->m_commandWindow)
+    {
+        CommandJob job = m_commandQueue.takeFirst();
+        QByteArray baBlock = encodeCommand(m_commandSession, job.sequence, job.type, m_peerCapabilities);
+        job.sent = sessionTime();
+        job.attempts += 1;
+        stampFrame(baBlock, job.sent);
+        m_owner->traceFrame(m_flightId, TRACE_OUT, COMMAND, baBlock);
+        m_commandSocket->write(baBlock);
+        m_inFlight.append(job);
+
+        qCDebug(SERVER()) << SERVER().categoryName() << "Command" << job.sequence << "sent to" << m_name
+                          << ", attempt" << job.attempts;
+    }
+    if (!m_commandTimer.isActive())
+        m_commandTimer.start(m_owner->m_commandTimeout);
+}
+
+// Acks come back in order on the command connection, several may arrive in one read
+void ServerPeer::readAck()
+{
+    forever
+    {
+        QByteArray baBlock = m_commandSocket->peek(m_commandSocket->bytesAvailable());
+        QDataStream in(baBlock);
+        in.setVersion(QDataStream::Qt_4_6);
+
+        qint64 header, totalBytes;
+        in >> header >> totalBytes;
+        if (in.status() != QDataStream::Ok)
+            return;    // Wait for the rest of the header
+        if (!(header & HEADER_V2) || (header & HEADER_MASK) != ACK || totalBytes < 2 * qint64(sizeof(qint64)))
+        {
+            qCWarning(SERVER()) << SERVER().categoryName() << m_name << "sent an unknown frame on the command connection";
+            retransmitCommands();
+            return;
+        }
+        if (baBlock.size() < totalBytes)
+            return;
+
+        QByteArray baFrame = m_commandSocket->read(totalBytes);
+        m_owner->traceFrame(m_flightId, TRACE_IN, ACK, baFrame);
+
+        QDataStream frameIn(baFrame);
+        frameIn.setVersion(QDataStream::Qt_4_6);
+        quint32 flags;
+        QByteArray payload;
+        CommandAck ack;
+        frameIn >> header;
+        if (decodeFrame(frameIn, totalBytes, flags, payload) && decodeAck(payload, ack)
+                && ack.session == m_commandSession)
+            acknowledgeCommand(ack);
+    }
+}
+
+void ServerPeer::acknowledgeCommand(const CommandAck &ack)
+{
+//  A late answer to an attempt already repeated finds nothing and is dropped
+    for (int i = 0; i < m_inFlight.size(); i++)
+    {
+        if (m_inFlight.at(i).sequence != ack.sequence)
+            continue;
+
+        CommandJob job = m_inFlight.takeAt(i);
+        qint64 latency = sessionTime() - job.sent;
+        m_owner->m_recorder.record(FLIGHT_ACK, ack.result, m_flightId, latency, job.sequence);
+        qCDebug(SERVER()) << SERVER().categoryName() << m_name << "acknowledged command" << job.sequence
+                          << "in" << latency << "us, result" << ack.result << (ack.duplicate ? "(repeat)" : "");
+        emit commandAcknowledged(job.sequence, job.type, ack.result, latency);
+        emit commandSent(job.type);
+        break;
+    }
+
+    if (m_inFlight.isEmpty())
+        m_commandTimer.stop();
+    else
+        m_commandTimer.start(m_owner->m_commandTimeout);
+    pumpCommands();
+}
+
+// The commands in flight are sent again when the timer runs out, not at once
+void ServerPeer::commandError(QAbstractSocket::SocketError socketError)
+{
+    m_owner->m_recorder.record(FLIGHT_SOCKET_ERROR, socketError, m_flightId);
+    if (socketError == QAbstractSocket::RemoteHostClosedError && m_commandSocket->bytesAvailable() > 0)
+        readAck();
+    if (!m_inFlight.isEmpty())
+        qCWarning(SERVER()) << SERVER().categoryName() << m_name << m_commandSocket->errorString();
+    m_commandSocket->abort();
+}
+
+// Unanswered commands go again in order on a new connection, the client answers repeats from its history
+void ServerPeer::retransmitCommands()
+{
+    m_commandTimer.stop();
+    m_commandSocket->abort();
+
+    QList<CommandJob> retry;
+    for (int i = 0; i < m_inFlight.size(); i++)
+    {
+        const CommandJob &job = m_inFlight.at(i);
+        if (job.attempts <= m_owner->m_commandRetries)
+        {
+            retry.append(job);
+            continue;
+        }
+        qCWarning(SERVER()) << SERVER().categoryName() << m_name << "did not acknowledge command" << job.sequence;
+        emit commandFailed(job.sequence, job.type);
+    }
+    m_inFlight.clear();
+    m_commandQueue = retry + m_commandQueue;
+    pumpCommands();
+}
+
+// One connection per command, so commands never wait behind a plan on the wire
+QTcpSocket *ServerPeer::writeOneShot(int type, QByteArray baBlock, bool awaitReply)
+{
+    QTcpSocket *commandSocket = new QTcpSocket(this);
+    connect(commandSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            commandSocket, SLOT(deleteLater()));
+    connect(commandSocket, SIGNAL(disconnected()), commandSocket, SLOT(deleteLater()));
+    m_owner->m_recorder.record(FLIGHT_CONNECT, type, m_flightId, 0, m_port);
+    commandSocket->connectToHost(QHostAddress(m_ipAddress), m_port);
+
+    stampFrame(baBlock, sessionTime());
+    m_owner->traceFrame(m_flightId, TRACE_OUT, type, baBlock);
+    commandSocket->write(baBlock);
+
+    if (!awaitReply)
+        commandSocket->disconnectFromHost();
+    return commandSocket;
+}
+
+// The whole schedule goes in one frame and the client times it from its own clock
+void ServerPeer::sendSchedule(const QVector<ScheduledCommand> &schedule, int startDelay)
+{
+    if (m_peerVersion == 0)
+    {
+        m_pendingSchedule = schedule;
+        m_pendingScheduleDelay = startDelay;
+        negotiate();
+        return;
+    }
+
+    if (m_peerVersion < PROTOCOL_VERSION)
+    {
+//  Legacy clients only take single commands, so time them from here; a new schedule replaces the old
+        cancelSchedule();
+        m_schedule = schedule;
+        std::stable_sort(m_schedule.begin(), m_schedule.end(),
+                         [](const ScheduledCommand &a, const ScheduledCommand &b) { return a.offset < b.offset; });
+        m_scheduleNext = 0;
+        m_scheduleClock.start();
+        m_scheduleStart = startDelay;
+        armSchedule();
+        return;
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << qint64(startDelay) * 1000
+        << schedule;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Sending schedule of" << schedule.size()
+                      << "commands to" << m_name << "...";
+    QTcpSocket *scheduleSocket = writeOneShot(SCHEDULE, encodeFrame(SCHEDULE, payload, 0, m_peerCapabilities), true);
+    connect(scheduleSocket, SIGNAL(readyRead()), this, SLOT(readScheduleReply()));
+}
+
+// The client closes without a word when it took the schedule, a REJECT says why it did not
+void ServerPeer::readScheduleReply()
+{
+    QTcpSocket *scheduleSocket = qobject_cast<QTcpSocket *>(sender());
+    if (!scheduleSocket)
+        return;
+
+    QByteArray baBlock = scheduleSocket->peek(scheduleSocket->bytesAvailable());
+    if (!isRejectFrame(baBlock))
+    {
+        if (baBlock.size() >= int(sizeof(qint64)))
+            scheduleSocket->abort();    // Not an answer to a schedule
+        return;
+    }
+
+    QDataStream in(baBlock);
+    in.setVersion(QDataStream::Qt_4_6);
+    qint64 header, totalBytes;
+    quint32 flags;
+    QByteArray payload;
+    in >> header;
+    bool decoded = decodeFrame(in, totalBytes, flags, payload);
+    if (in.status() == QDataStream::ReadPastEnd)
+        return;    // Wait for the rest of the frame
+
+    scheduleSocket->read(baBlock.size());
+    m_owner->traceFrame(m_flightId, TRACE_IN, REJECT, baBlock);
+    scheduleSocket->close();
+
+    QString detail = "Malformed reject frame.";
+    if (decoded)
+    {
+        QDataStream payloadIn(payload);
+        payloadIn.setVersion(QDataStream::Qt_4_6);
+        QString receipt;
+        PlanError error;
+        payloadIn >> receipt >> error.code >> error.layer >> error.index >> error.message;
+        detail = error.message;
+    }
+    qCWarning(SERVER()) << SERVER().categoryName() << m_name << "rejected the schedule:" << detail;
+    emit scheduleRejected(detail);
+}
+
+void ServerPeer::armSchedule()
+{
+    if (!isScheduleRunning())
+    {
+        m_schedule.clear();
+        m_scheduleNext = 0;
+        return;
+    }
+    qint64 due = m_scheduleStart + m_schedule.at(m_scheduleNext).offset / 1000;
+    m_scheduleTimer.start(int(qMax(due - m_scheduleClock.elapsed(), qint64(0))));
+}
+
+// Everything due by now goes out in order, a STOP ends the schedule
+void ServerPeer::fireSchedule()
+{
+    while (isScheduleRunning()
+           && m_scheduleStart + m_schedule.at(m_scheduleNext).offset / 1000 <= m_scheduleClock.elapsed())
+    {
+        cmdType iType = cmdType(m_schedule.at(m_scheduleNext++).command);
+        issueCommand(iType);
+        if (iType == STOP)
+        {
+            cancelSchedule();
+            return;
+        }
+    }
+    armSchedule();
+}
+
+// The schedule running here, or one still waiting for the handshake
+void ServerPeer::cancelSchedule()
+{
+    int commandsLeft = m_schedule.size() - m_scheduleNext + m_pendingSchedule.size();
+    m_scheduleTimer.stop();
+    m_schedule.clear();
+    m_scheduleNext = 0;
+    m_pendingSchedule.clear();
+    if (commandsLeft == 0)
+        return;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Schedule of" << m_name << "cancelled with"
+                      << commandsLeft << "commands left.";
+    emit scheduleCancelled(commandsLeft);
+}
+
+// Full status, or only the keys changed since the previous one. Statuses are decoded on several
+// workers, so a client's may come in out of order: a sequenced status only writes the keys it is
+// newer for, and a late one leaves the newer values in place.
+void ServerPeer::applyStatus(const StatusUpdate &update)
+{
+    if (update.timestamp != NO_TIMESTAMP)
+        m_statusLatency = update.received - update.timestamp;
+
+    if (!update.sequenced)
+    {
+        m_keySequences.clear();
+        if (update.full)
+        {
+            m_status = update.changed;
+            return;
+        }
+        QHash<QString, QVariant>::const_iterator i;
+        for (i = update.changed.constBegin(); i != update.changed.constEnd(); ++i)
+            m_status.insert(i.key(), i.value());
+        for (int j = 0; j < update.removed.size(); j++)
+            m_status.remove(update.removed.at(j));
+        return;
+    }
+
+//  A restarted client numbers from the start again
+    if (update.session != m_statusSession || m_keySequences.isEmpty())
+    {
+        m_statusSession = update.session;
+        m_keySequences.clear();
+        m_status.clear();
+    }
+
+//  A full status removes what it lacks, unless a newer status wrote it
+    if (update.full)
+    {
+        QStringList keys = m_status.keys();
+        for (int j = 0; j < keys.size(); j++)
+        {
+            if (!update.changed.contains(keys.at(j)) && claimKey(keys.at(j), update.sequence))
+                m_status.remove(keys.at(j));
+        }
+    }
+    QHash<QString, QVariant>::const_iterator i;
+    for (i = update.changed.constBegin(); i != update.changed.constEnd(); ++i)
+    {
+        if (claimKey(i.key(), update.sequence))
+            m_status.insert(i.key(), i.value());
+    }
+    for (int j = 0; j < update.removed.size(); j++)
+    {
+        if (claimKey(update.removed.at(j), update.sequence))
+            m_status.remove(update.removed.at(j));
+    }
+}
+
+// Whether a write of key at sequence is newer than the last one, it is the last one from then on
+bool ServerPeer::claimKey(const QString &key, quint32 sequence)
+{
+    QHash<QString, quint32>::iterator i = m_keySequences.find(key);
+    if (i != m_keySequences.end() && qint32(sequence - i.value()) <= 0)
+        return false;
+    m_keySequences.insert(key, sequence);
+    return true;
+}
+
+// Send hello with our protocol version and capabilities, the reply decides the wire format
+void ServerPeer::negotiate()
+{
+    if (m_handshaking || m_transmitting)
+        return;
+    m_handshaking = true;
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Negotiating protocol with" << m_name << "...";
+
+    connectServer();
+    QByteArray baHello = encodeHello(CAP_SUPPORTED, m_name, m_owner->m_statusInterval);
+    m_owner->traceFrame(m_flightId, TRACE_OUT, HELLO, baHello);
+    m_sendSocket->write(baHello);
+    m_helloTimer.start();
+}
+
+void ServerPeer::readHello()
+{
+    QByteArray baBlock = m_sendSocket->peek(m_sendSocket->bytesAvailable());
+    QDataStream in(baBlock);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    qint64 header;
+    Hello hello;
+    in >> header;
+    bool valid = (header == HELLO && decodeHello(in, hello));
+    if (in.status() == QDataStream::ReadPastEnd)
+        return;    // Wait for the rest of the reply
+
+    m_sendSocket->read(baBlock.size());
+    m_owner->traceFrame(m_flightId, TRACE_IN, HELLO, baBlock);
+    m_helloTimer.stop();
+    m_sendSocket->close();
+
+    if (valid)
+    {
+        m_peerVersion = qMin(int(hello.version), PROTOCOL_VERSION);
+        m_peerCapabilities = negotiateCapabilities(hello);
+    }
+    else
+    {
+        m_peerVersion = PROTOCOL_LEGACY;
+        m_peerCapabilities = 0;
+    }
+    finishNegotiation();
+}
+
+// Clients without a handshake ignore the hello, fall back to the legacy format
+void ServerPeer::helloTimeout()
+{
+    m_sendSocket->abort();
+    m_peerVersion = PROTOCOL_LEGACY;
+    m_peerCapabilities = 0;
+    finishNegotiation();
+}
+
+// Start an NTP-style exchange, the request is stamped once the connection is up
+void ServerPeer::synchronize()
+{
+    if (m_peerVersion < PROTOCOL_VERSION || !(m_peerCapabilities & CAP_TIMESTAMP))
+        return;
+
+    QTcpSocket *syncSocket = new QTcpSocket(this);
+    connect(syncSocket, SIGNAL(connected()), this, SLOT(writeSync()));
+    connect(syncSocket, SIGNAL(readyRead()), this, SLOT(readSync()));
+    connect(syncSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            syncSocket, SLOT(deleteLater()));
+    connect(syncSocket, SIGNAL(disconnected()), syncSocket, SLOT(deleteLater()));
+    m_owner->m_recorder.record(FLIGHT_CONNECT, SYNC, m_flightId, 0, m_port);
+    syncSocket->connectToHost(QHostAddress(m_ipAddress), m_port);
+}
+
+// Request: t1, then our estimate of client - server at t1, its drift and delay for the client to use
+void ServerPeer::writeSync()
+{
+    QTcpSocket *syncSocket = qobject_cast<QTcpSocket *>(sender());
+    if (!syncSocket)
+        return;
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    qint64 t1 = sessionTime();
+    out << t1
+        << (m_clock.isValid() ? m_clock.offsetAt(t1) : qint64(NO_TIMESTAMP))
+        << m_clock.drift()
+        << m_clock.delay();
+
+    QByteArray baBlock = encodeFrame(SYNC, payload, 0, 0);
+    m_owner->traceFrame(m_flightId, TRACE_OUT, SYNC, baBlock);
+    syncSocket->write(baBlock);
+}
+
+// Reply: t1 echoed, t2 and t3 on the client clock
+void ServerPeer::readSync()
+{
+    qint64 t4 = sessionTime();
+    QTcpSocket *syncSocket = qobject_cast<QTcpSocket *>(sender());
+    if (!syncSocket)
+        return;
+
+    QByteArray baBlock = syncSocket->peek(syncSocket->bytesAvailable());
+    QDataStream in(baBlock);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    qint64 header, totalBytes;
+    quint32 flags;
+    QByteArray payload;
+    in >> header;
+    bool valid = ((header & HEADER_MASK) == SYNC && decodeFrame(in, totalBytes, flags, payload));
+    if (in.status() == QDataStream::ReadPastEnd)
+        return;    // Wait for the rest of the reply
+
+    syncSocket->read(baBlock.size());
+    m_owner->traceFrame(m_flightId, TRACE_IN, SYNC, baBlock);
+    syncSocket->close();
+    if (!valid)
+        return;
+
+    QDataStream payloadIn(payload);
+    payloadIn.setVersion(QDataStream::Qt_4_6);
+    qint64 t1, t2, t3;
+    payloadIn >> t1 >> t2 >> t3;
+    if (payloadIn.status() != QDataStream::Ok)
+        return;
+
+    m_clock.addExchange(t1, t2, t3, t4);
+    qCDebug(SERVER()) << SERVER().categoryName() << m_name << "clock offset" << m_clock.offsetAt(t4)
+                      << "us, delay" << m_clock.delay() << "us, drift" << m_clock.drift() * 1e6 << "ppm";
+}
+
+void ServerPeer::finishNegotiation()
+{
+    m_handshaking = false;
+    qCDebug(SERVER()) << SERVER().categoryName() << m_name << "protocol version" << m_peerVersion
+                      << "capabilities" << m_peerCapabilities;
+    emit negotiated(m_peerVersion, m_peerCapabilities);
+
+    synchronize();
+    if (m_owner->m_syncInterval > 0 && (m_peerCapabilities & CAP_TIMESTAMP))
+        m_syncTimer.start(m_owner->m_syncInterval);
+
+    preparePlans();
+    transmitPlan();
+
+    QList<CommandJob> pendingCommands = m_pendingCommands;
+    m_pendingCommands.clear();
+    for (int i = 0; i < pendingCommands.size(); i++)
+        dispatchCommand(pendingCommands.at(i));
+
+    if (!m_pendingSchedule.isEmpty())
+    {
+        QVector<ScheduledCommand> pendingSchedule = m_pendingSchedule;
+        m_pendingSchedule.clear();
+        sendSchedule(pendingSchedule, m_pendingScheduleDelay);
+    }
+}
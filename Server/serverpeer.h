@@ -0,0 +1,177 @@
+#ifndef SERVERPEER_H
+#define SERVERPEER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QList>
+#include <QHash>
+#include <QVariant>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+
+#include "variable.h"
+#include "protocol.h"
+#include "planencoder.h"
+#include "statusdispatcher.h"
+#include "clocksync.h"
+#include "planstore.h"
+
+class Server;
+
+//  One client driven by the Server: its own connection, protocol negotiation,
+//  plan pipeline and last status, so several clients run side by side.
+class ServerPeer : public QObject
+{
+    Q_OBJECT
+
+public:
+    ServerPeer(Server *server, QString name, QString ipAddress, quint16 port);
+    ~ServerPeer();
+
+    inline QString getName() const { return m_name; }
+    inline QString getIpAddress() const { return m_ipAddress; }
+    inline quint16 getPort() const { return m_port; }
+    inline QHash<QString, QVariant> getStatus() const { return m_status; }
+    inline int getPeerVersion() const { return m_peerVersion; }
+    inline quint32 getPeerCapabilities() const { return m_peerCapabilities; }
+    inline int getQueuedPlanCount() const { return m_planQueue.size(); }
+    inline const ClockSync &getClockSync() const { return m_clock; }    // Client clock - server clock
+    inline qint64 getStatusLatency() const { return m_statusLatency; }    // One-way, us, of the last stamped status
+    inline quint16 getFlightId() const { return m_flightId; }    // Peer of its events in the flight recorder
+
+    void queuePlan(int planId, const TreatmentPlan &plan);
+    // Plan already multicast as transfer, announced on the plan connection when its turn comes
+    void queueMulticastPlan(int planId, const TreatmentPlan &plan, const QString &receipt, quint32 transfer,
+                            const QByteArray &frame);
+    // Sequence number reported by commandAcknowledged(), clients without CAP_COMMAND_ACK never answer.
+    // Cancels what is left of a schedule this side times for a legacy client.
+    quint32 sendCommand(cmdType iType);
+    void sendSchedule(const QVector<ScheduledCommand> &schedule, int startDelay);
+    inline bool isScheduleRunning() const { return m_scheduleNext < m_schedule.size(); }
+    void negotiate();    // Exchange protocol version and capabilities with the client
+    void abandon();    // Fail everything queued and close the connections, the peer is going away
+    void applyStatus(const StatusUpdate &update);
+
+    // Plans the client acknowledged are kept on disk, the newest can be sent again after a restart
+    bool openStore(const QString &directory, int capacity);
+    bool restorePlan(TreatmentPlan &plan);
+
+signals:
+    void negotiated(int version, quint32 capabilities);
+    void planCompleted(int planId);
+    void planFailed(int planId, int errorCode, QString detail);
+    void commandSent(int iType);
+    // Round trip in us; a client without CAP_COMMAND_ACK cannot answer, its commands are COMMAND_DONE once written
+    void commandAcknowledged(quint32 sequence, int iType, int result, qint64 latency);
+    void commandFailed(quint32 sequence, int iType);
+    void scheduleCancelled(int commandsLeft);    // Commands of the schedule that will not be sent
+    void scheduleRejected(QString detail);    // The client refused the schedule, none of it runs
+    void error(int errorCode);
+
+private slots:
+    void readReceipt();
+    void writePlan();
+    void helloTimeout();
+    void writtenBytes(qint64);
+    void prepareFinished();
+    void displayError(QAbstractSocket::SocketError);
+    void synchronize();
+    void writeSync();
+    void readSync();
+    void readAck();
+    void commandError(QAbstractSocket::SocketError);
+    void retransmitCommands();
+    void oneShotWritten();
+    void oneShotError(QAbstractSocket::SocketError);
+    void fireSchedule();
+    void readScheduleReply();
+
+private:
+    Server *m_owner;
+    QString m_name;
+    QString m_ipAddress;
+    quint16 m_port;
+    quint16 m_flightId;
+
+    QTcpSocket *m_sendSocket;
+    void connectServer();
+    QTcpSocket *writeOneShot(int type, QByteArray baBlock, bool awaitReply = false);    // Else closed once written
+
+    // Plan pipeline: the head of the queue is transmitted while the next one is prepared
+    struct PlanJob
+    {
+        int id;
+        TreatmentPlan plan;
+        QString receipt;
+        ScatterFrame frame;    // Empty until prepared
+        int version;    // Protocol the frame was prepared for
+        quint32 capabilities;
+        quint32 transfer;    // Multicast transfer of the frame, 0 once it goes by unicast
+    };
+    QList<PlanJob> m_planQueue;
+    bool m_transmitting;
+    int m_preparingId;    // -1 when the prepare stage is idle
+    QFutureWatcher<ScatterFrame> m_prepareWatcher;
+    qint64 m_totalBytes, m_writtenBytes;
+    bool m_writePending;    // The head's frame goes out once the connection is up
+    void preparePlans();
+    void transmitPlan();
+    void finishPlan(bool ok, int errorCode, const QString &detail = QString());
+    void receiveReceipt(bool closed);
+    bool receiveNack(bool closed);
+
+    PlanStore m_store;
+    void storePlan(const PlanJob &job);
+
+    int m_peerVersion;    // 0 until negotiated
+    quint32 m_peerCapabilities;
+    bool m_handshaking;
+    QTimer m_helloTimer;
+    // Acknowledged commands go in order on one connection, up to the window of them unanswered
+    struct CommandJob
+    {
+        quint32 sequence;
+        cmdType type;
+        qint64 sent;    // Session time of the last attempt
+        int attempts;
+    };
+    QTcpSocket *m_commandSocket;
+    quint32 m_commandSession;
+    quint32 m_nextSequence;
+    QList<CommandJob> m_commandQueue;    // Waiting for room in the window
+    QList<CommandJob> m_inFlight;
+    QTimer m_commandTimer;
+    void dispatchCommand(const CommandJob &job);
+    void pumpCommands();
+    void acknowledgeCommand(const CommandAck &ack);
+
+    quint32 issueCommand(cmdType iType);
+
+//  Schedule of a legacy client, which only takes single commands: one timer
+//  for the next due command, as ScheduleRunner does on a v2 client
+    QVector<ScheduledCommand> m_schedule;
+    int m_scheduleNext;
+    qint64 m_scheduleStart;    // ms on m_scheduleClock of offset 0
+    QElapsedTimer m_scheduleClock;
+    QTimer m_scheduleTimer;
+    void armSchedule();
+    void cancelSchedule();
+
+    QList<CommandJob> m_pendingCommands;    // Sent once the handshake is over
+    QVector<ScheduledCommand> m_pendingSchedule;
+    int m_pendingScheduleDelay;
+    void readHello();
+    void finishNegotiation();
+
+    QHash<QString, QVariant> m_status;
+    qint64 m_statusLatency;
+    quint32 m_statusSession;    // Of the client's sequenced statuses
+    QHash<QString, quint32> m_keySequences;    // Sequence of the last write of every key, removals included
+    bool claimKey(const QString &key, quint32 sequence);
+
+    ClockSync m_clock;
+    QTimer m_syncTimer;
+};
+
+#endif // SERVERPEER_H
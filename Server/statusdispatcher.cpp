@@ -0,0 +1,310 @@
+#include <QDebug>
+#include <QLoggingCategory>
+#include <QtEndian>
+
+#include "statusdispatcher.h"
+#include "protocol.h"
+#include "clocksync.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SERVER)
+
+#define FRAME_HEAD_SIZE (2 * sizeof(qint64))    // Header and total bytes, in every format
+#define MAX_STATUS_BYTES (16 * 1024 * 1024)
+
+StatusWorker::StatusWorker(StatusDispatcher *dispatcher) : QObject(0),
+    m_dispatcher(dispatcher), m_load(0), m_frameCount(0), m_overruns(0)
+{
+}
+
+void StatusWorker::addConnection(qintptr socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor))
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << socket->errorString();
+        delete socket;
+        m_load.deref();
+        return;
+    }
+    m_buffers.insert(socket, QByteArray());
+
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readFrames()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(displayError(QAbstractSocket::SocketError)));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(closeConnection()));
+}
+
+// A frame may arrive in several chunks, or several frames in one
+void StatusWorker::readFrames()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+
+    QByteArray &buffer = m_buffers[socket];
+    buffer.append(socket->readAll());
+
+    bool queued = false;
+    while (buffer.size() >= int(FRAME_HEAD_SIZE))
+    {
+        qint64 totalBytes = qFromBigEndian<qint64>(reinterpret_cast<const uchar *>(buffer.constData()) + sizeof(qint64));
+        if (totalBytes < qint64(FRAME_HEAD_SIZE) || totalBytes > MAX_STATUS_BYTES)
+        {
+            qCWarning(SERVER()) << SERVER().categoryName() << "Bad status frame size" << totalBytes;
+            buffer.clear();
+            socket->abort();
+            break;
+        }
+        if (buffer.size() < totalBytes)
+            break;    // Wait for the rest of the frame
+
+        StatusUpdate update;
+        update.address = socket->peerAddress();
+        update.received = sessionTime();
+        update.frame = buffer.left(int(totalBytes));
+        buffer.remove(0, int(totalBytes));
+        if (!decodeStatus(update.frame, update))
+        {
+            qCWarning(SERVER()) << SERVER().categoryName() << "Failed to decode status from"
+                                << update.address.toString();
+            continue;
+        }
+
+        if (!queueStatus(update))
+            continue;
+        m_frameCount.ref();
+        queued = true;
+    }
+
+    if (queued)
+        m_dispatcher->notify();
+}
+
+// The owner drains the queue on its own pace, wait for room rather than drop a status.
+// Only a stopping dispatcher, which drains no more until the workers are gone, drops it.
+bool StatusWorker::queueStatus(const StatusUpdate &update)
+{
+    if (m_queue.push(update))
+        return true;
+
+//  Full: the owner may not know yet there is anything to drain
+    m_dispatcher->notify();
+    while (!m_queue.push(update))
+    {
+        if (m_dispatcher->m_stopping.load())
+        {
+            m_overruns.ref();
+            qCWarning(SERVER()) << SERVER().categoryName() << "Status listener stopping, status from"
+                                << update.address.toString() << "dropped.";
+            return false;
+        }
+        QThread::yieldCurrentThread();
+    }
+    return true;
+}
+
+void StatusWorker::closeConnection()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+    m_buffers.remove(socket);
+    socket->deleteLater();
+    m_load.deref();
+}
+
+// Sockets are closed on the thread that owns them before the worker stops
+void StatusWorker::closeConnections()
+{
+    QList<QTcpSocket *> sockets = m_buffers.keys();
+    for (int i = 0; i < sockets.size(); i++)
+    {
+        sockets.at(i)->disconnect(this);
+        delete sockets.at(i);
+    }
+    m_buffers.clear();
+    m_load.store(0);
+}
+
+void StatusWorker::displayError(QAbstractSocket::SocketError socketError)
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || socketError == QAbstractSocket::RemoteHostClosedError)
+        return;
+    qCWarning(SERVER()) << SERVER().categoryName() << socket->errorString();
+}
+
+bool StatusWorker::decodeStatus(const QByteArray &frame, StatusUpdate &update)
+{
+    QDataStream in(frame);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    qint64 type, totalBytes;
+    in >> type;
+    if ((type & HEADER_MASK) != STATUS)
+        return false;
+
+    if (!(type & HEADER_V2))
+    {
+        in >> totalBytes >> update.changed;
+        update.sequenced = false;
+        update.full = true;
+        update.timestamp = NO_TIMESTAMP;
+        return in.status() == QDataStream::Ok;
+    }
+
+    quint32 flags;
+    QByteArray payload;
+    if (!decodeFrame(in, totalBytes, flags, payload, &update.timestamp))
+        return false;
+
+    QDataStream payloadIn(payload);
+    payloadIn.setVersion(QDataStream::Qt_4_6);
+    payloadIn >> update.name;
+
+    update.sequenced = flags & FRAME_SEQUENCE;
+    if (update.sequenced)
+        payloadIn >> update.session >> update.sequence;
+
+//  Full status, or only the keys changed since the previous one
+    if (flags & FRAME_DELTA)
+    {
+        payloadIn >> update.full >> update.changed >> update.removed;
+    }
+    else
+    {
+        payloadIn >> update.changed;
+        update.full = true;
+    }
+    return payloadIn.status() == QDataStream::Ok;
+}
+
+StatusDispatcher::StatusDispatcher(QObject *parent) : QTcpServer(parent),
+    m_balance(RoundRobin), m_nextWorker(0), m_drainWorker(0), m_notified(0), m_stopping(0)
+{
+    qRegisterMetaType<qintptr>("qintptr");
+    setWorkerCount(0);
+}
+
+StatusDispatcher::~StatusDispatcher()
+{
+    close();
+    blockSignals(true);    // The owner may already be half destroyed
+    stopWorkers();
+}
+
+void StatusDispatcher::setWorkerCount(int workerCount)
+{
+    if (workerCount <= 0)
+        workerCount = qMax(QThread::idealThreadCount(), 1);
+
+//  Connections already handed out are closed with their worker
+    stopWorkers();
+    for (int i = 0; i < workerCount; i++)
+    {
+        QThread *thread = new QThread(this);
+        StatusWorker *worker = new StatusWorker(this);
+        worker->moveToThread(thread);
+        thread->start();
+
+        m_threads.append(thread);
+        m_workers.append(worker);
+    }
+    qCDebug(SERVER()) << SERVER().categoryName() << "Status listener runs" << workerCount << "workers.";
+}
+
+void StatusDispatcher::stopWorkers()
+{
+//  A worker waiting for room in its queue gives up, nothing drains it while we wait here
+    m_stopping.store(1);
+    for (int i = 0; i < m_threads.size(); i++)
+    {
+        QMetaObject::invokeMethod(m_workers.at(i), "closeConnections", Qt::BlockingQueuedConnection);
+        m_threads.at(i)->quit();
+        m_threads.at(i)->wait();
+    }
+
+//  Statuses already decoded are delivered before the workers go
+    drain();
+
+//  The event loops are gone, the workers can go from here
+    qDeleteAll(m_workers);
+    qDeleteAll(m_threads);
+    m_threads.clear();
+    m_workers.clear();
+    m_nextWorker = 0;
+    m_drainWorker = 0;
+    m_stopping.store(0);
+}
+
+int StatusDispatcher::getFrameCount() const
+{
+    int frameCount = 0;
+    for (int i = 0; i < m_workers.size(); i++)
+        frameCount += m_workers.at(i)->getFrameCount();
+    return frameCount;
+}
+
+int StatusDispatcher::getOverrunCount() const
+{
+    int overruns = 0;
+    for (int i = 0; i < m_workers.size(); i++)
+        overruns += m_workers.at(i)->getOverrunCount();
+    return overruns;
+}
+
+// Runs on the owner thread
+void StatusDispatcher::incomingConnection(qintptr socketDescriptor)
+{
+    int index = m_nextWorker;
+    if (m_balance == LeastLoaded)
+    {
+        for (int i = 0; i < m_workers.size(); i++)
+        {
+            if (m_workers.at(i)->getLoad() < m_workers.at(index)->getLoad())
+                index = i;
+        }
+    }
+    m_nextWorker = (index + 1) % m_workers.size();
+
+    StatusWorker *worker = m_workers.at(index);
+    worker->m_load.ref();
+    QMetaObject::invokeMethod(worker, "addConnection", Qt::QueuedConnection,
+                              Q_ARG(qintptr, socketDescriptor));
+}
+
+// Called by the workers, at most one drain() is pending at a time
+void StatusDispatcher::notify()
+{
+    if (m_notified.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+void StatusDispatcher::drain()
+{
+//  Cleared first, so a status queued from now on wakes us again
+    m_notified.storeRelease(0);
+    for (int i = 0; i < m_workers.size(); i++)
+    {
+        if (!m_workers.at(i)->m_queue.isEmpty())
+        {
+            emit statusQueued();
+            return;
+        }
+    }
+}
+
+// Take the queues in turn so one busy worker does not starve the others
+bool StatusDispatcher::nextStatus(StatusUpdate &update)
+{
+    for (int i = 0; i < m_workers.size(); i++)
+    {
+        int index = (m_drainWorker + i) % m_workers.size();
+        if (m_workers.at(index)->m_queue.pop(update))
+        {
+            m_drainWorker = (index + 1) % m_workers.size();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,119 @@
+#ifndef STATUSDISPATCHER_H
+#define STATUSDISPATCHER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QList>
+#include <QHash>
+#include <QStringList>
+#include <QVariant>
+#include <QThread>
+#include <QAtomicInt>
+
+#include "spscqueue.h"
+
+//  One status frame decoded off the owner thread. A full status is carried
+//  in changed with full set, a delta is applied on top of the last status.
+struct StatusUpdate
+{
+    QString name;    // Peer name of a v2 frame, empty for legacy clients
+    QHostAddress address;
+    QByteArray frame;    // Frame as received, for the capture
+    qint64 timestamp;    // Synchronized send time, NO_TIMESTAMP when not stamped
+    qint64 received;    // Server session time the frame was complete
+    bool sequenced;    // Set by clients with CAP_STATUS_SEQUENCE
+    quint32 session;
+    quint32 sequence;
+    bool full;
+    QHash<QString, QVariant> changed;
+    QStringList removed;
+};
+
+class StatusDispatcher;
+
+//  Event loop of one worker thread: reads and decodes the status frames of
+//  the connections it was given and queues them for the owner thread.
+class StatusWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    StatusWorker(StatusDispatcher *dispatcher);
+
+    inline int getLoad() const { return m_load.load(); }
+    inline int getFrameCount() const { return m_frameCount.load(); }
+    inline int getOverrunCount() const { return m_overruns.load(); }
+
+private slots:
+    void addConnection(qintptr socketDescriptor);
+    void readFrames();
+    void closeConnection();
+    void closeConnections();
+    void displayError(QAbstractSocket::SocketError);
+
+private:
+    friend class StatusDispatcher;
+
+    StatusDispatcher *m_dispatcher;
+    QHash<QTcpSocket *, QByteArray> m_buffers;    // Bytes of incomplete frames per connection
+    bool decodeStatus(const QByteArray &frame, StatusUpdate &update);
+    bool queueStatus(const StatusUpdate &update);
+
+    SpscQueue<StatusUpdate> m_queue;    // Worker pushes, owner pops
+    QAtomicInt m_load;    // Open connections
+    QAtomicInt m_frameCount;
+    QAtomicInt m_overruns;    // Statuses dropped while the dispatcher was stopping
+};
+
+//  Status listener of the Server. Accepted sockets are handed to a fixed
+//  set of worker threads, round-robin or to the least loaded one, so many
+//  clients are read and decoded in parallel. Decoded statuses come back
+//  through lock-free queues and statusQueued() on the owner thread. One
+//  client's connections may go to different workers, its statuses are put
+//  back in order by their sequence, see ServerPeer::applyStatus().
+class StatusDispatcher : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    enum Balance
+    {
+        RoundRobin,
+        LeastLoaded
+    };
+
+    StatusDispatcher(QObject *parent = 0);
+    ~StatusDispatcher();
+
+    void setWorkerCount(int workerCount);    // 0 uses one worker per core
+    inline int getWorkerCount() const { return m_workers.size(); }
+    inline void setBalance(Balance balance) { m_balance = balance; }
+    int getFrameCount() const;    // Frames decoded by all workers since start
+    int getOverrunCount() const;    // Statuses dropped by all workers while stopping
+
+    bool nextStatus(StatusUpdate &update);    // Owner thread only
+
+signals:
+    void statusQueued();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor);
+
+private slots:
+    void drain();
+
+private:
+    friend class StatusWorker;
+
+    QList<QThread *> m_threads;
+    QList<StatusWorker *> m_workers;
+    Balance m_balance;
+    int m_nextWorker;
+    int m_drainWorker;
+    QAtomicInt m_notified;    // A drain() is already on its way to the owner thread
+    QAtomicInt m_stopping;    // stopWorkers() is waiting for the workers
+    void stopWorkers();
+    void notify();
+};
+
+#endif // STATUSDISPATCHER_H
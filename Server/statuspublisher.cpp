@@ -0,0 +1,231 @@
+#include <QDebug>
+#include <QLoggingCategory>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include "statuspublisher.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SERVER)
+
+PublisherWorker::PublisherWorker(StatusPublisher *publisher) : QObject(0),
+    m_publisher(publisher), m_server(0), m_queueDepth(OBSERVER_QUEUE)
+{
+}
+
+bool PublisherWorker::listen(const QString &address, int port, int queueDepth)
+{
+    m_queueDepth = qMax(queueDepth, 1);
+    if (!m_server)
+    {
+        m_server = new QTcpServer(this);
+        connect(m_server, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+    }
+    m_server->close();
+    if (!m_server->listen(QHostAddress(address), quint16(port)))
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << m_server->errorString();
+        return false;
+    }
+    return true;
+}
+
+void PublisherWorker::acceptConnection()
+{
+    while (m_server->hasPendingConnections())
+    {
+        QTcpSocket *socket = m_server->nextPendingConnection();
+        m_subscribers.insert(socket, QQueue<QByteArray>());
+
+        connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(writeQueued()));
+        connect(socket, SIGNAL(readyRead()), this, SLOT(discardInput()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(closeConnection()));
+
+        qCDebug(SERVER()) << SERVER().categoryName() << "Observer" << socket->peerAddress().toString()
+                          << "subscribed," << m_subscribers.size() << "observers.";
+    }
+    QMutexLocker locker(&m_publisher->m_statsMutex);
+    m_publisher->m_stats.subscribers = m_subscribers.size();
+}
+
+// Called through StatusPublisher::publish(), at most one drain() is pending at a time
+void PublisherWorker::drain()
+{
+//  Cleared first, so a status queued from now on wakes us again
+    m_publisher->m_notified.storeRelease(0);
+    PublishedStatus status;
+    while (m_publisher->m_queue.pop(status))
+        publish(status);
+}
+
+void PublisherWorker::publish(PublishedStatus &status)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+//  One frame shared by every queue, only the socket buffers take copies
+    int dropped = 0, delivered = 0;
+    if (!m_subscribers.isEmpty())
+    {
+        QByteArray frame = encodePublished(status);
+        QHash<QTcpSocket *, QQueue<QByteArray> >::iterator i;
+        for (i = m_subscribers.begin(); i != m_subscribers.end(); ++i)
+        {
+            QQueue<QByteArray> &queue = i.value();
+            if (queue.size() >= m_queueDepth)
+            {
+                queue.dequeue();
+                dropped += 1;
+            }
+            queue.enqueue(frame);
+            int queued = queue.size();
+            pump(i.key(), queue);
+            delivered += queued - queue.size();
+        }
+    }
+    qint64 elapsed = timer.nsecsElapsed() / 1000;
+
+    QMutexLocker locker(&m_publisher->m_statsMutex);
+    PublisherStats &stats = m_publisher->m_stats;
+    stats.published += 1;
+    stats.delivered += delivered;
+    stats.dropped += dropped;
+    stats.fanoutTime += elapsed;
+    if (stats.published % OBSERVER_REPORT == 0)
+    {
+        qCDebug(SERVER()) << SERVER().categoryName() << "Fan-out to" << stats.subscribers << "observers:"
+                          << double(stats.fanoutTime) / stats.published << "us per status,"
+                          << stats.dropped << "frames dropped," << m_publisher->m_overruns.load() << "overruns.";
+    }
+}
+
+// Only so much goes into the socket's buffer, the rest waits in the bounded queue
+void PublisherWorker::pump(QTcpSocket *socket, QQueue<QByteArray> &queue)
+{
+    while (!queue.isEmpty() && socket->state() == QAbstractSocket::ConnectedState
+           && socket->bytesToWrite() < OBSERVER_WRITE_LIMIT)
+        socket->write(queue.dequeue());
+}
+
+void PublisherWorker::writeQueued()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || !m_subscribers.contains(socket))
+        return;
+
+    QQueue<QByteArray> &queue = m_subscribers[socket];
+    int queued = queue.size();
+    pump(socket, queue);
+    if (queued == queue.size())
+        return;
+
+    QMutexLocker locker(&m_publisher->m_statsMutex);
+    m_publisher->m_stats.delivered += queued - queue.size();
+}
+
+// Observers only listen, whatever they send is thrown away
+void PublisherWorker::discardInput()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (socket)
+        socket->readAll();
+}
+
+void PublisherWorker::closeConnection()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+    m_subscribers.remove(socket);
+    socket->deleteLater();
+
+    qCDebug(SERVER()) << SERVER().categoryName() << "Observer" << socket->peerAddress().toString()
+                      << "left," << m_subscribers.size() << "observers.";
+    QMutexLocker locker(&m_publisher->m_statsMutex);
+    m_publisher->m_stats.subscribers = m_subscribers.size();
+}
+
+// Sockets and the listener are closed on the thread that owns them before it stops
+void PublisherWorker::closeConnections()
+{
+    QList<QTcpSocket *> sockets = m_subscribers.keys();
+    for (int i = 0; i < sockets.size(); i++)
+    {
+        sockets.at(i)->disconnect(this);
+        delete sockets.at(i);
+    }
+    m_subscribers.clear();
+    delete m_server;
+    m_server = 0;
+}
+
+StatusPublisher::StatusPublisher(QObject *parent) : QObject(parent),
+    m_queue(OBSERVER_QUEUE * 16), m_sequence(0), m_notified(0), m_listening(0), m_overruns(0)
+{
+    m_stats.subscribers = 0;
+    m_stats.published = 0;
+    m_stats.overruns = 0;
+    m_stats.delivered = 0;
+    m_stats.dropped = 0;
+    m_stats.fanoutTime = 0;
+
+    m_worker = new PublisherWorker(this);
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+StatusPublisher::~StatusPublisher()
+{
+    QMetaObject::invokeMethod(m_worker, "closeConnections", Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+}
+
+bool StatusPublisher::listen(const QString &address, quint16 port, int queueDepth)
+{
+    if (QHostAddress(address).isNull())
+    {
+        qCWarning(SERVER()) << SERVER().categoryName() << "Not an address to publish statuses on:" << address;
+        m_listening.store(0);
+        return false;
+    }
+
+    bool listening = false;
+    QMetaObject::invokeMethod(m_worker, "listen", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, listening),
+                              Q_ARG(QString, address), Q_ARG(int, port), Q_ARG(int, queueDepth));
+    m_listening.store(listening ? 1 : 0);
+    if (listening)
+        qCDebug(SERVER()) << SERVER().categoryName() << "Publishing statuses to observers on" << address << port
+                          << "," << queueDepth << "statuses queued per observer.";
+    return listening;
+}
+
+// Never waits for the publisher thread: with its queue full the status is counted and dropped
+void StatusPublisher::publish(const QString &peer, const QHash<QString, QVariant> &status)
+{
+    if (!isListening())
+        return;
+
+    PublishedStatus published;
+    published.sequence = ++m_sequence;
+    published.peer = peer;
+    published.received = QDateTime::currentMSecsSinceEpoch();    // Observers do not share the session clock
+    published.status = status;
+    if (!m_queue.push(published))
+    {
+        m_overruns.ref();
+        return;
+    }
+
+    if (m_notified.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(m_worker, "drain", Qt::QueuedConnection);
+}
+
+PublisherStats StatusPublisher::stats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    PublisherStats stats = m_stats;
+    stats.overruns = m_overruns.load();
+    return stats;
+}
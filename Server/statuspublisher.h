@@ -0,0 +1,97 @@
+#ifndef STATUSPUBLISHER_H
+#define STATUSPUBLISHER_H
+
+#include <QObject>
+#include <QtNetwork>
+#include <QHash>
+#include <QQueue>
+#include <QVariant>
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+
+#include "spscqueue.h"
+#include "protocol.h"
+
+#define OBSERVER_WRITE_LIMIT (64 * 1024)    // Bytes in a socket's buffer before statuses wait in its queue
+#define OBSERVER_REPORT 1000    // Statuses between fan-out cost reports in the log
+
+struct PublisherStats
+{
+    int subscribers;
+    qint64 published;    // Statuses taken from the server
+    qint64 overruns;    // Statuses the publisher thread had no room for, no observer got them
+    qint64 delivered;    // Frames written to observer sockets
+    qint64 dropped;    // Oldest frames dropped from the queue of a slow observer
+    qint64 fanoutTime;    // us spent encoding and queuing the published statuses
+};
+
+class StatusPublisher;
+
+//  Event loop of the publisher thread: accepts the observers, encodes each
+//  status once and queues the frame to every observer.
+class PublisherWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    PublisherWorker(StatusPublisher *publisher);
+
+private slots:
+    bool listen(const QString &address, int port, int queueDepth);
+    void acceptConnection();
+    void drain();
+    void writeQueued();
+    void discardInput();
+    void closeConnection();
+    void closeConnections();
+
+private:
+    friend class StatusPublisher;
+
+    StatusPublisher *m_publisher;
+    QTcpServer *m_server;
+    QHash<QTcpSocket *, QQueue<QByteArray> > m_subscribers;    // Frames not yet written per observer
+    int m_queueDepth;
+
+    void publish(PublishedStatus &status);
+    void pump(QTcpSocket *socket, QQueue<QByteArray> &queue);
+};
+
+//  Republishes every status the Server received to read-only observer
+//  consoles. The server only pushes to a lock-free queue and never waits;
+//  each observer has a bounded queue of frames on the publisher thread and
+//  loses the oldest when it cannot keep up, so no observer stalls another
+//  one or the status path.
+class StatusPublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    StatusPublisher(QObject *parent = 0);
+    ~StatusPublisher();
+
+    // On one address, an empty one is refused; queueDepth is per observer
+    bool listen(const QString &address, quint16 port, int queueDepth = OBSERVER_QUEUE);
+    inline bool isListening() const { return m_listening.load() != 0; }
+
+    void publish(const QString &peer, const QHash<QString, QVariant> &status);    // Owner thread only
+    PublisherStats stats() const;
+
+private:
+    friend class PublisherWorker;
+
+    QThread m_thread;
+    PublisherWorker *m_worker;
+
+    SpscQueue<PublishedStatus> m_queue;    // Owner pushes, worker pops
+    quint64 m_sequence;
+    QAtomicInt m_notified;    // A drain() is already on its way to the publisher thread
+    QAtomicInt m_listening;
+    QAtomicInt m_overruns;
+
+    mutable QMutex m_statsMutex;
+    PublisherStats m_stats;    // Updated by the worker
+};
+
+#endif // STATUSPUBLISHER_H
@@ -0,0 +1,109 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QTimer>
+
+#include <functional>
+
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#include <exception>
+#endif
+
+//  What a plan transaction ended with, once the receipt or the refusal is in
+struct PlanOutcome
+{
+    int planId;    // -1 when the plan was never queued
+    bool ok;
+    QString errorString;
+};
+
+//  What a command transaction ended with. Clients without acknowledgements
+//  cannot answer, their commands are done once written.
+struct CommandOutcome
+{
+    quint32 sequence;    // 0 when the command was never sent
+    bool ok;
+    int result;    // CommandResult of the client
+    qint64 latency;    // Round trip in us
+};
+
+//  One operation in flight, started when it is created. Each transaction has
+//  its own state, so any number of them can run side by side, and it can be
+//  awaited at any time, also after it finished:
+//      PlanOutcome outcome = co_await server.sendPlanAsync(peer, spot3D, spotOrder, parameter);
+//  The awaiting coroutine is resumed from the event loop, never from inside
+//  the signal that finished the transaction. Awaiting takes C++20; the type
+//  itself builds as C++11, so the library does not need a newer standard.
+template <typename T>
+class Transaction
+{
+public:
+    explicit Transaction(QObject *owner) : m_state(new State)
+    {
+        m_state->done = false;
+        m_state->context = new QObject(owner);    // Receiver of the signals the operation finishes on
+    }
+
+    inline bool isDone() const { return m_state->done; }
+    inline T outcome() const { return m_state->outcome; }
+    inline QObject *context() const { return m_state->context; }
+
+    void finish(const T &outcome)
+    {
+        if (m_state->done)
+            return;
+        m_state->done = true;
+        m_state->outcome = outcome;
+        m_state->context->deleteLater();
+        if (m_state->waiter)
+        {
+            std::function<void()> waiter = m_state->waiter;
+            m_state->waiter = std::function<void()>();
+            QTimer::singleShot(0, waiter);
+        }
+    }
+
+    // Awaiter interface
+    inline bool await_ready() const { return m_state->done; }
+    template <typename Handle>
+    void await_suspend(Handle handle)
+    {
+        m_state->waiter = [handle]() mutable { handle.resume(); };
+    }
+    inline T await_resume() const { return m_state->outcome; }
+
+private:
+    struct State
+    {
+        bool done;
+        T outcome;
+        QObject *context;    // Owned by the owner, deleted when done
+        std::function<void()> waiter;
+    };
+    QSharedPointer<State> m_state;
+};
+
+typedef Transaction<PlanOutcome> PlanTransaction;
+typedef Transaction<CommandOutcome> CommandTransaction;
+
+#ifdef __cpp_impl_coroutine
+//  Return type of a coroutine that awaits transactions. It runs at once up to
+//  its first co_await and frees itself when it returns.
+struct AsyncTask
+{
+    struct promise_type
+    {
+        AsyncTask get_return_object() { return AsyncTask(); }
+        std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
+
+#endif // TRANSACTION_H
@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Simulator: virtual devices built on Client for soak testing a Server
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+CONFIG   += c++11
+
+TARGET = Simulator
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../lib/common \
+        ../Client
+
+LIBS += -L../lib -lClient
+
+SOURCES += main.cpp \
+        simulateddevice.cpp \
+        simulator.cpp
+
+HEADERS += simulateddevice.h \
+        simulator.h
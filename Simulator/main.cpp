@@ -0,0 +1,72 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+
+#include "simulator.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Simulator");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Run simulated HIFU devices against a Server for soak testing.");
+    parser.addHelpOption();
+    QCommandLineOption countOption(QStringList() << "n" << "instances",
+                                   "Number of simulated devices.", "count", "1");
+    QCommandLineOption portOption(QStringList() << "p" << "base-port",
+                                  "Plan port of the first device, the others follow.", "port", "7000");
+    QCommandLineOption serverOption(QStringList() << "s" << "server",
+                                    "Status address of the Server.", "ip:port", "127.0.0.1:6667");
+    QCommandLineOption minOption("min-interval", "Shortest status interval in ms.", "ms", "50");
+    QCommandLineOption maxOption("max-interval", "Longest status interval in ms.", "ms", "1000");
+    QCommandLineOption speedOption("speed", "Virtual sonication time per real time.", "factor", "1");
+    QCommandLineOption reportOption(QStringList() << "r" << "report-interval",
+                                    "Seconds between reports.", "seconds", "60");
+    QCommandLineOption durationOption(QStringList() << "d" << "duration",
+                                      "Seconds to run, 0 until killed.", "seconds", "0");
+    QCommandLineOption fileOption(QStringList() << "o" << "report",
+                                  "Write every report line as CSV.", "file");
+    QCommandLineOption multicastOption(QStringList() << "m" << "multicast",
+                                       "Multicast group the devices take plans from, instead of config.ini.",
+                                       "group:port");
+    parser.addOption(countOption);
+    parser.addOption(portOption);
+    parser.addOption(serverOption);
+    parser.addOption(minOption);
+    parser.addOption(maxOption);
+    parser.addOption(speedOption);
+    parser.addOption(reportOption);
+    parser.addOption(durationOption);
+    parser.addOption(fileOption);
+    parser.addOption(multicastOption);
+    parser.process(a);
+
+    QStringList server = parser.value(serverOption).split(':');
+    int count = parser.value(countOption).toInt();
+    int reportInterval = parser.value(reportOption).toInt();
+    int duration = parser.value(durationOption).toInt();
+    if (server.size() != 2 || count <= 0 || reportInterval <= 0)
+        parser.showHelp(1);
+
+    Simulator simulator;
+    simulator.createDevices(count, parser.value(portOption).toUShort(), server.at(0), server.at(1).toUShort());
+    simulator.setSpeed(parser.value(speedOption).toDouble());
+    simulator.setStatusBounds(parser.value(minOption).toInt(), parser.value(maxOption).toInt());
+    if (parser.isSet(multicastOption))
+    {
+        QStringList group = parser.value(multicastOption).split(':');
+        if (group.size() != 2)
+            parser.showHelp(1);
+        simulator.setMulticastGroup(group.at(0), group.at(1).toUShort());
+    }
+    simulator.setReportInterval((duration > 0) ? qMin(reportInterval, duration) : reportInterval);
+    simulator.setDuration(duration);
+    if (!simulator.setReportFile(parser.value(fileOption)))
+        return 1;
+
+    QObject::connect(&simulator, SIGNAL(finished()), &a, SLOT(quit()));
+    QMetaObject::invokeMethod(&simulator, "start", Qt::QueuedConnection);
+
+    return a.exec();
+}
@@ -0,0 +1,181 @@
+#include <QDebug>
+#include <QtMath>
+
+#include "simulateddevice.h"
+
+Q_LOGGING_CATEGORY(SIMULATOR, "SIMULATOR")
+
+#define TICK_INTERVAL 10    // ms between playback steps
+#define HEATING_RATE 2.0    // Temperature rise per second of sonication
+#define COOLING_CONSTANT 5.0    // s for the rise to fall to 1/e
+
+SimulatedDevice::SimulatedDevice(QString name, quint16 receivePort, QString serverAddress, quint16 serverPort,
+                                 QObject *parent) : QObject(parent),
+    m_name(name), m_state(Idle), m_speed(1), m_offset(0), m_cursor(0), m_lastStep(-1), m_temperature(0)
+{
+    m_client.setReceiveAddress(QHostAddress(QHostAddress::Any).toString(), receivePort);
+    m_client.setSendAddress(serverAddress, serverPort);
+
+    connect(&m_client, SIGNAL(receivingCompleted()), this, SLOT(planAccepted()));
+    connect(&m_client, SIGNAL(planRejected(QString)), this, SLOT(planRejected(QString)));
+    connect(&m_client, SIGNAL(networkError(QString)), this, SLOT(networkError(QString)));
+    connect(&m_client, SIGNAL(frameLatency(int,qint64)), this, SLOT(frameLatency(int,qint64)));
+    connect(&m_client, SIGNAL(commandStart()), this, SLOT(commandStart()));
+    connect(&m_client, SIGNAL(commandStop()), this, SLOT(commandStop()));
+    connect(&m_client, SIGNAL(commandPause()), this, SLOT(commandPause()));
+    connect(&m_client, SIGNAL(commandResume()), this, SLOT(commandResume()));
+
+    m_tick.setTimerType(Qt::PreciseTimer);
+    m_tick.setInterval(TICK_INTERVAL);
+    connect(&m_tick, SIGNAL(timeout()), this, SLOT(tick()));
+
+    takeCounters();
+}
+
+void SimulatedDevice::start()
+{
+    m_client.listen();
+    publish(0, 0);
+    m_client.startStatusUpdates();
+    m_tick.start();
+}
+
+DeviceCounters SimulatedDevice::takeCounters()
+{
+    DeviceCounters counters = m_counters;
+    m_counters.plansAccepted = 0;
+    m_counters.plansRejected = 0;
+    m_counters.commands = 0;
+    m_counters.networkErrors = 0;
+    m_counters.pulses = 0;
+    m_counters.sessionsFinished = 0;
+    m_counters.latencySum = 0;
+    m_counters.latencyCount = 0;
+    return counters;
+}
+
+// A new plan replaces whatever was playing, it waits for START
+void SimulatedDevice::planAccepted()
+{
+    m_counters.plansAccepted += 1;
+    m_state = Idle;
+    m_offset = 0;
+    m_cursor = 0;
+    m_lastStep = -1;
+    qCDebug(SIMULATOR()) << SIMULATOR().categoryName() << m_name << "plan of"
+                         << m_client.getTimeline().size() << "pulses ready";
+}
+
+void SimulatedDevice::planRejected(QString errorString)
+{
+    m_counters.plansRejected += 1;
+    qCWarning(SIMULATOR()) << SIMULATOR().categoryName() << m_name << "rejected a plan:" << errorString;
+}
+
+void SimulatedDevice::networkError(QString errorString)
+{
+    Q_UNUSED(errorString);
+    m_counters.networkErrors += 1;
+}
+
+void SimulatedDevice::frameLatency(int type, qint64 latency)
+{
+    Q_UNUSED(type);
+    m_counters.latencySum += latency;
+    m_counters.latencyCount += 1;
+}
+
+void SimulatedDevice::commandStart()
+{
+    m_counters.commands += 1;
+    if (!m_client.getTimeline().isValid())
+        return;
+    m_offset = 0;
+    m_cursor = 0;
+    m_lastStep = -1;
+    m_clock.start();
+    m_state = Running;
+}
+
+void SimulatedDevice::commandStop()
+{
+    m_counters.commands += 1;
+    m_state = Idle;
+    m_offset = 0;
+    m_cursor = 0;
+}
+
+void SimulatedDevice::commandPause()
+{
+    m_counters.commands += 1;
+    if (m_state != Running)
+        return;
+    m_offset = virtualTime();
+    m_state = Paused;
+}
+
+void SimulatedDevice::commandResume()
+{
+    m_counters.commands += 1;
+    if (m_state != Paused)
+        return;
+    m_clock.start();
+    m_state = Running;
+}
+
+qint64 SimulatedDevice::virtualTime() const
+{
+    if (m_state != Running)
+        return m_offset;
+    return m_offset + qint64(m_clock.nsecsElapsed() / 1000 * m_speed);
+}
+
+void SimulatedDevice::tick()
+{
+    const Timeline &timeline = m_client.getTimeline();
+    qint64 time = virtualTime();
+    const TimelineStep *step = 0;
+    if (m_state == Running)
+    {
+        step = timeline.stepAt(time, m_cursor);
+        if (step && m_cursor != m_lastStep)
+        {
+            m_lastStep = m_cursor;
+            m_counters.pulses += 1;
+        }
+        if (time >= timeline.duration())
+        {
+            m_state = Finished;
+            m_counters.sessionsFinished += 1;
+            qCDebug(SIMULATOR()) << SIMULATOR().categoryName() << m_name << "session finished";
+        }
+    }
+
+//  First-order thermal model: heats while a pulse is on, relaxes towards zero
+    double dt = TICK_INTERVAL / 1000.0 * m_speed;
+    m_temperature += (step ? HEATING_RATE * dt : 0) - m_temperature * (1 - qExp(-dt / COOLING_CONSTANT));
+    publish(step, time);
+}
+
+void SimulatedDevice::publish(const TimelineStep *step, qint64 time)
+{
+    static const char *states[] = { "Idle", "Running", "Paused", "Finished" };
+    const Timeline &timeline = m_client.getTimeline();
+
+    QHash<QString, QVariant> status;
+    status.insert("State", states[m_state]);
+    status.insert("Time", time / MS_UNIT);
+    status.insert("Duration", timeline.duration() / MS_UNIT);
+    status.insert("Step", m_cursor);
+    status.insert("Sonicating", step != 0);
+    status.insert("Temperature", m_temperature);
+    if (step)
+    {
+        status.insert("Layer", step->layer);
+        status.insert("Spot", step->spot);
+        status.insert("X", step->x);
+        status.insert("Y", step->y);
+        status.insert("Z", step->z);
+    }
+    m_client.setStatus(status);
+}
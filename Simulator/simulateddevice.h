@@ -0,0 +1,84 @@
+#ifndef SIMULATEDDEVICE_H
+#define SIMULATEDDEVICE_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+#include "client.h"
+
+Q_DECLARE_LOGGING_CATEGORY(SIMULATOR)
+
+//  Counters of one device since the last report
+struct DeviceCounters
+{
+    int plansAccepted;
+    int plansRejected;
+    int commands;
+    int networkErrors;
+    int pulses;    // Timeline steps played
+    int sessionsFinished;
+    qint64 latencySum;    // us, over the stamped frames received
+    int latencyCount;
+};
+
+//  One treatment device without hardware: a Client that accepts plans, plays
+//  the compiled timeline against a virtual clock on START and streams the
+//  playback position and a simulated focal temperature as its status.
+class SimulatedDevice : public QObject
+{
+    Q_OBJECT
+
+public:
+    SimulatedDevice(QString name, quint16 receivePort, QString serverAddress, quint16 serverPort, QObject *parent = 0);
+
+    inline QString getName() const { return m_name; }
+    inline void setSpeed(double speed) { m_speed = speed; }    // Virtual time per real time
+    inline void setStatusBounds(int minInterval, int maxInterval) { m_client.setStatusBounds(minInterval, maxInterval); }
+    inline Client &getClient() { return m_client; }
+
+    DeviceCounters takeCounters();    // Counters since the last call
+
+public slots:
+    void start();
+
+private slots:
+    void planAccepted();
+    void planRejected(QString errorString);
+    void networkError(QString errorString);
+    void frameLatency(int type, qint64 latency);
+    void commandStart();
+    void commandStop();
+    void commandPause();
+    void commandResume();
+    void tick();
+
+private:
+    enum State
+    {
+        Idle,
+        Running,
+        Paused,
+        Finished
+    };
+
+    QString m_name;
+    Client m_client;
+    QTimer m_tick;
+
+    State m_state;
+    double m_speed;
+    QElapsedTimer m_clock;
+    qint64 m_offset;    // Virtual us played before the last resume
+    int m_cursor;
+    int m_lastStep;
+    double m_temperature;    // Rise above body temperature at the focus
+
+    DeviceCounters m_counters;
+
+    qint64 virtualTime() const;
+    void publish(const TimelineStep *step, qint64 time);
+};
+
+#endif // SIMULATEDDEVICE_H
@@ -0,0 +1,163 @@
+#include <QDebug>
+#include <QTextStream>
+
+#include "simulator.h"
+
+Simulator::Simulator(QObject *parent) : QObject(parent),
+    m_duration(0), m_startMemory(-1), m_baseLatency(-1), m_totalErrors(0)
+{
+    m_reportTimer.setInterval(60000);
+    connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+}
+
+Simulator::~Simulator()
+{
+    qDeleteAll(m_devices);
+}
+
+void Simulator::createDevices(int count, quint16 basePort, QString serverAddress, quint16 serverPort)
+{
+    qDeleteAll(m_devices);
+    m_devices.clear();
+
+//  The server needs one peer per device, printed in the form of its config.ini
+    QString peers = "[Peers]";
+    for (int i = 0; i < count; i++)
+    {
+        QString name = QString("sim%1").arg(i);
+        m_devices.append(new SimulatedDevice(name, quint16(basePort + i), serverAddress, serverPort));
+        peers += QString("\n%1=127.0.0.1:%2").arg(name).arg(basePort + i);
+    }
+    qCDebug(SIMULATOR()) << SIMULATOR().categoryName() << "Server peers for" << count << "devices:";
+    qDebug().noquote() << peers;
+}
+
+void Simulator::setSpeed(double speed)
+{
+    for (int i = 0; i < m_devices.size(); i++)
+        m_devices.at(i)->setSpeed(speed);
+}
+
+void Simulator::setStatusBounds(int minInterval, int maxInterval)
+{
+    for (int i = 0; i < m_devices.size(); i++)
+        m_devices.at(i)->setStatusBounds(minInterval, maxInterval);
+}
+
+void Simulator::setMulticastGroup(QString group, quint16 port)
+{
+    for (int i = 0; i < m_devices.size(); i++)
+        m_devices.at(i)->getClient().setMulticastGroup(group, port);
+}
+
+bool Simulator::setReportFile(QString fileName)
+{
+    m_reportFile.close();
+    if (fileName.isEmpty())
+        return true;
+    m_reportFile.setFileName(fileName);
+    if (!m_reportFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+    QTextStream(&m_reportFile) << "elapsed_s,memory_kb,memory_growth_kb,plans,rejected,commands,pulses,sessions,"
+                                  "status_sent_total,status_skipped_total,network_errors,latency_us,latency_drift_us,"
+                                  "decode_us_per_plan,allocations_per_plan,validate_us_per_mspot\n";
+    return true;
+}
+
+void Simulator::start()
+{
+    for (int i = 0; i < m_devices.size(); i++)
+        m_devices.at(i)->start();
+    m_startMemory = residentMemory();
+    m_clock.start();
+    m_reportTimer.start();
+}
+
+// One line for all devices: counters of the window, memory and latency against the start
+void Simulator::report()
+{
+    DeviceCounters total = {0, 0, 0, 0, 0, 0, 0, 0};
+    int sentCount = 0, skippedCount = 0;
+    PlanStats plans = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < m_devices.size(); i++)
+    {
+        DeviceCounters counters = m_devices.at(i)->takeCounters();
+        total.plansAccepted += counters.plansAccepted;
+        total.plansRejected += counters.plansRejected;
+        total.commands += counters.commands;
+        total.networkErrors += counters.networkErrors;
+        total.pulses += counters.pulses;
+        total.sessionsFinished += counters.sessionsFinished;
+        total.latencySum += counters.latencySum;
+        total.latencyCount += counters.latencyCount;
+
+        StatusRateMetrics metrics = m_devices.at(i)->getClient().getStatusRateMetrics();
+        sentCount += metrics.sentCount;
+        skippedCount += metrics.skippedCount;
+
+        PlanStats planStats = m_devices.at(i)->getClient().getPlanStats();
+        plans.plans += planStats.plans;
+        plans.spots += planStats.spots;
+        plans.decodeTime += planStats.decodeTime;
+        plans.allocations += planStats.allocations;
+        plans.validateTime += planStats.validateTime;
+    }
+
+    qint64 memory = residentMemory();
+    qint64 growth = (memory >= 0 && m_startMemory >= 0) ? memory - m_startMemory : 0;
+    double latency = total.latencyCount > 0 ? double(total.latencySum) / total.latencyCount : -1;
+    if (m_baseLatency < 0 && latency >= 0)
+        m_baseLatency = latency;
+    double drift = (latency >= 0 && m_baseLatency >= 0) ? latency - m_baseLatency : 0;
+    m_totalErrors += total.plansRejected + total.networkErrors;
+
+//  Since start, so a run of large plans reads the decode cost directly
+    double decodeTime = plans.plans > 0 ? double(plans.decodeTime) / plans.plans : -1;
+    double allocations = plans.plans > 0 ? double(plans.allocations) / plans.plans : -1;
+    double validateTime = plans.spots > 0 ? plans.validateTime * 1e6 / plans.spots : -1;
+
+    qint64 elapsed = m_clock.elapsed() / 1000;
+    qCDebug(SIMULATOR()) << SIMULATOR().categoryName() << elapsed << "s:" << m_devices.size() << "devices,"
+                         << "memory" << memory << "kB (+" << growth << "),"
+                         << total.plansAccepted << "plans," << total.pulses << "pulses,"
+                         << "latency" << latency << "us (drift" << drift << "),"
+                         << "decode" << decodeTime << "us and" << allocations << "allocations per plan,"
+                         << "validation" << validateTime << "us per million spots,"
+                         << total.plansRejected << "rejected," << total.networkErrors << "network errors,"
+                         << m_totalErrors << "errors in total";
+
+    if (m_reportFile.isOpen())
+    {
+        QTextStream(&m_reportFile) << elapsed << ',' << memory << ',' << growth << ','
+                                   << total.plansAccepted << ',' << total.plansRejected << ',' << total.commands << ','
+                                   << total.pulses << ',' << total.sessionsFinished << ','
+                                   << sentCount << ',' << skippedCount << ',' << total.networkErrors << ','
+                                   << latency << ',' << drift << ',' << decodeTime << ',' << allocations << ','
+                                   << validateTime << '\n';
+        m_reportFile.flush();
+    }
+
+    if (m_duration > 0 && elapsed >= m_duration)
+    {
+        m_reportTimer.stop();
+        emit finished();
+    }
+}
+
+// Resident set size in kB, from procfs where there is one
+qint64 Simulator::residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&status);
+        for (QString line = in.readLine(); !line.isNull(); line = in.readLine())
+        {
+            if (line.startsWith("VmRSS:"))
+                return line.section(' ', 1, -1, QString::SectionSkipEmpty).section(' ', 0, 0).toLongLong();
+        }
+    }
+#endif
+    return -1;
+}
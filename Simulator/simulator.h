@@ -0,0 +1,55 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "simulateddevice.h"
+
+//  Runs the simulated devices side by side against one Server and reports,
+//  every interval, the process memory, the frame latency of the window and
+//  its drift from the first window, and the error counts.
+class Simulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    Simulator(QObject *parent = 0);
+    ~Simulator();
+
+    // count devices listening on basePort, basePort + 1, ... and sending status to the server
+    void createDevices(int count, quint16 basePort, QString serverAddress, quint16 serverPort);
+    void setSpeed(double speed);
+    void setStatusBounds(int minInterval, int maxInterval);
+    void setMulticastGroup(QString group, quint16 port);    // Every device joins, before start()
+    inline void setReportInterval(int seconds) { m_reportTimer.setInterval(seconds * 1000); }
+    inline void setDuration(int seconds) { m_duration = seconds; }    // 0 runs until killed
+    bool setReportFile(QString fileName);    // CSV of every report line
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void report();
+
+private:
+    QList<SimulatedDevice *> m_devices;
+    QTimer m_reportTimer;
+    QElapsedTimer m_clock;
+    int m_duration;
+
+    QFile m_reportFile;
+    qint64 m_startMemory;    // kB resident at start, -1 where unknown
+    double m_baseLatency;    // Mean of the first window with samples, -1 before
+    qint64 m_totalErrors;
+
+    static qint64 residentMemory();
+};
+
+#endif // SIMULATOR_H
@@ -0,0 +1,519 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QVariant>
+#include <QtEndian>
+
+#include <cstring>
+
+#include "variable.h"
+
+//  Protocol version 1 is the legacy format: a bare qint64 header followed by
+//  Qt_4_6 streams. Version 2 frames set HEADER_V2 in the header and carry
+//  their own flags, so the receiver can decode them without negotiation state:
+//      qint64 header | HEADER_V2, qint64 total bytes, quint32 flags,
+//      QByteArray payload, [quint16 checksum of the payload], [qint64 send time]
+
+#define PROTOCOL_MAGIC 0x48494655    // "HIFU"
+#define PROTOCOL_LEGACY 1
+#define PROTOCOL_VERSION 2
+
+#define HEADER_MASK 0xff
+#define HEADER_V2 0x100
+
+#define HELLO_TIMEOUT 2000    // ms to wait for the hello reply before falling back to legacy
+#define COMPRESSION_THRESHOLD 4096    // Smaller payloads are never compressed
+#define DELTA_STATUS_REFRESH 16    // Send a full status every N status frames
+#define COMMAND_HISTORY 64    // Results a client keeps to answer retransmitted commands
+
+enum Capability
+{
+    CAP_COMPRESSION = 0x01,
+    CAP_SOA_PLAN = 0x02,
+    CAP_CHECKSUM = 0x04,
+    CAP_DELTA_STATUS = 0x08,
+    CAP_STREAMING_LAYERS = 0x10,
+    CAP_TIMESTAMP = 0x20,
+    CAP_COMMAND_ACK = 0x40,
+    CAP_MULTICAST = 0x80,
+    CAP_STATUS_SEQUENCE = 0x100
+};
+
+//  Capabilities implemented by this build
+#define CAP_SUPPORTED (CAP_COMPRESSION | CAP_SOA_PLAN | CAP_CHECKSUM | CAP_DELTA_STATUS | CAP_TIMESTAMP | \
+                       CAP_COMMAND_ACK | CAP_MULTICAST | CAP_STATUS_SEQUENCE)
+
+enum FrameFlag
+{
+    FRAME_COMPRESSED = 0x01,
+    FRAME_SOA = 0x02,
+    FRAME_CHECKSUM = 0x04,
+    FRAME_DELTA = 0x08,
+    FRAME_TIMESTAMP = 0x10,
+    FRAME_SEQUENCE = 0x20    // STATUS: quint32 session and quint32 sequence follow the peer name
+};
+
+#define NO_TIMESTAMP (-1)    // Send time of a frame from a sender not yet synchronized
+
+struct Hello
+{
+    quint32 magic;
+    quint16 version;
+    quint32 capabilities;
+    QString name;    // Name the server gives the client, echoed in its status frames
+    quint16 statusInterval;    // Shortest status interval the server can take in ms, 0 for no limit
+};
+
+inline QByteArray encodeHello(quint32 capabilities, const QString &name = QString(), quint16 statusInterval = 0)
+{
+    QByteArray baBlock;
+    QDataStream out(&baBlock, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << qint64(HELLO)
+        << quint32(PROTOCOL_MAGIC)
+        << quint16(PROTOCOL_VERSION)
+        << capabilities
+        << name
+        << statusInterval;
+    return baBlock;
+}
+
+//  The header has already been read from the stream
+inline bool decodeHello(QDataStream &in, Hello &hello)
+{
+    in >> hello.magic >> hello.version >> hello.capabilities >> hello.name >> hello.statusInterval;
+    return in.status() == QDataStream::Ok && hello.magic == PROTOCOL_MAGIC;
+}
+
+//  Fastest mode both sides support
+inline quint32 negotiateCapabilities(const Hello &hello)
+{
+    if (hello.version < PROTOCOL_VERSION)
+        return 0;
+    return hello.capabilities & CAP_SUPPORTED;
+}
+
+inline QByteArray encodeFrame(int type, QByteArray payload, quint32 flags, quint32 capabilities)
+{
+    if ((capabilities & CAP_COMPRESSION) && payload.size() >= COMPRESSION_THRESHOLD)
+    {
+        QByteArray compressed = qCompress(payload, 1);
+        if (compressed.size() < payload.size())
+        {
+            payload = compressed;
+            flags |= FRAME_COMPRESSED;
+        }
+    }
+    if (capabilities & CAP_CHECKSUM)
+        flags |= FRAME_CHECKSUM;
+    if (capabilities & CAP_TIMESTAMP)
+        flags |= FRAME_TIMESTAMP;
+
+    QByteArray baBlock;
+    QDataStream out(&baBlock, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+
+    out << qint64(type | HEADER_V2)
+        << qint64(0)
+        << flags
+        << payload;
+    if (flags & FRAME_CHECKSUM)
+        out << quint16(qChecksum(payload.constData(), payload.size()));
+    if (flags & FRAME_TIMESTAMP)
+        out << qint64(NO_TIMESTAMP);    // Filled in by stampFrame() just before the write
+
+    out.device()->seek(sizeof(qint64));
+    out << qint64(baBlock.size());
+    return baBlock;
+}
+
+//  Set the send time of a frame with FRAME_TIMESTAMP, in synchronized microseconds
+inline void stampFrame(QByteArray &frame, qint64 time)
+{
+    if (frame.size() < int(2 * sizeof(qint64) + sizeof(quint32) + sizeof(qint64)))
+        return;
+    quint32 flags = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(frame.constData()) + 2 * sizeof(qint64));
+    if (!(flags & FRAME_TIMESTAMP))
+        return;
+    qToBigEndian(time, reinterpret_cast<uchar *>(frame.data()) + frame.size() - sizeof(qint64));
+}
+
+//  qChecksum() of a payload given in pieces: start from CHECKSUM_START, add every
+//  piece in order, then finish
+#define CHECKSUM_START 0xffff
+
+inline quint16 checksumAdd(quint16 crc, const char *data, qint64 size)
+{
+    static const quint16 table[16] = {
+        0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+        0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f
+    };
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    while (size-- > 0)
+    {
+        uchar c = *p++;
+        crc = ((crc >> 4) & 0x0fff) ^ table[(crc ^ c) & 15];
+        c >>= 4;
+        crc = ((crc >> 4) & 0x0fff) ^ table[(crc ^ c) & 15];
+    }
+    return crc;
+}
+
+inline quint16 checksumFinish(quint16 crc)
+{
+    return ~crc & 0xffff;
+}
+
+//  The header has already been read from the stream
+inline bool decodeFrame(QDataStream &in, qint64 &totalBytes, quint32 &flags, QByteArray &payload,
+                        qint64 *timestamp = 0)
+{
+    in >> totalBytes >> flags >> payload;
+    if (flags & FRAME_CHECKSUM)
+    {
+        quint16 checksum;
+        in >> checksum;
+        if (checksum != qChecksum(payload.constData(), payload.size()))
+            return false;
+    }
+    qint64 sendTime = NO_TIMESTAMP;
+    if (flags & FRAME_TIMESTAMP)
+        in >> sendTime;
+    if (timestamp)
+        *timestamp = sendTime;
+    if (in.status() != QDataStream::Ok)
+        return false;
+    if (flags & FRAME_COMPRESSED)
+    {
+        payload = qUncompress(payload);
+        if (payload.isEmpty())
+            return false;
+    }
+    return true;
+}
+
+inline QDataStream &operator<<(QDataStream &out, const SpotSonicationParameter &parameter)
+{
+    out << parameter.volt
+        << parameter.totalTime
+        << parameter.period
+        << parameter.dutyCycle
+        << parameter.coolingTime;
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, SpotSonicationParameter &parameter)
+{
+    in >> parameter.volt
+       >> parameter.totalTime
+       >> parameter.period
+       >> parameter.dutyCycle
+       >> parameter.coolingTime;
+    return in;
+}
+
+//  Coordinate arrays of the SoA plan are written raw in little-endian order
+inline void writeCoordinates(QDataStream &out, const QVector<Coordinate> &values)
+{
+    out << quint32(values.size());
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    QVector<quint64> swapped(values.size());
+    for (int i = 0; i < values.size(); i++)
+    {
+        quint64 raw;
+        memcpy(&raw, &values.at(i), sizeof(raw));
+        swapped[i] = qToLittleEndian(raw);
+    }
+    out.writeRawData(reinterpret_cast<const char *>(swapped.constData()), swapped.size() * sizeof(quint64));
+#else
+    out.writeRawData(reinterpret_cast<const char *>(values.constData()), values.size() * sizeof(Coordinate));
+#endif
+}
+
+//  Spot order of one SoA layer, raw little-endian qint32
+inline void writeOrder(QDataStream &out, const QList<int> &order)
+{
+    QVector<qint32> values(order.size());
+    for (int i = 0; i < order.size(); i++)
+        values[i] = qToLittleEndian(qint32(order.at(i)));
+    out << quint32(values.size());
+    out.writeRawData(reinterpret_cast<const char *>(values.constData()), values.size() * sizeof(qint32));
+}
+
+//  Element access to raw arrays still in the received buffer
+inline Coordinate coordinateAt(const char *data, int index)
+{
+    quint64 raw = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(data) + index * sizeof(quint64));
+    Coordinate value;
+    memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+inline int orderAt(const char *data, int index)
+{
+    return qFromLittleEndian<qint32>(reinterpret_cast<const uchar *>(data) + index * sizeof(qint32));
+}
+
+//  One command of a schedule, due offset microseconds after the schedule starts.
+//  A schedule payload is the qint64 start delay in microseconds after receipt,
+//  then a QVector<ScheduledCommand> in time order. A client refuses any other
+//  schedule with a REJECT frame of PLAN_SCHEDULE and an empty receipt.
+
+#define SCHEDULE_MAX_SPAN Q_INT64_C(86400000000)    // us, longest start delay and offset accepted
+struct ScheduledCommand
+{
+    qint64 offset;
+    qint32 command;    // cmdType
+};
+
+inline QDataStream &operator<<(QDataStream &out, const ScheduledCommand &command)
+{
+    out << command.offset
+        << command.command;
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, ScheduledCommand &command)
+{
+    in >> command.offset
+       >> command.command;
+    return in;
+}
+
+//  With CAP_COMMAND_ACK a COMMAND payload is quint32 session, quint32 sequence
+//  and qint64 command. Commands of a session share one connection, several in
+//  flight, and each is answered on it by an ACK frame: session, sequence,
+//  qint32 result and whether the command had already been run. The session
+//  changes when the server restarts, so its sequence numbers start over.
+enum CommandResult
+{
+    COMMAND_DONE,
+    COMMAND_UNKNOWN
+};
+
+struct CommandAck
+{
+    quint32 session;
+    quint32 sequence;
+    qint32 result;    // CommandResult
+    bool duplicate;    // Retransmission answered from the history, not run again
+};
+
+inline QByteArray encodeCommand(quint32 session, quint32 sequence, qint64 command, quint32 capabilities)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << session
+        << sequence
+        << command;
+    return encodeFrame(COMMAND, payload, 0, capabilities);
+}
+
+inline QByteArray encodeAck(const CommandAck &ack, quint32 capabilities)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << ack.session
+        << ack.sequence
+        << ack.result
+        << ack.duplicate;
+    return encodeFrame(ACK, payload, 0, capabilities);
+}
+
+inline bool decodeAck(const QByteArray &payload, CommandAck &ack)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> ack.session >> ack.sequence >> ack.result >> ack.duplicate;
+    return in.status() == QDataStream::Ok;
+}
+
+//  Multicast plans: the plan frame is encoded once with MULTICAST_CAPABILITIES,
+//  which every client advertising CAP_MULTICAST decodes, and cut into chunks
+//  sent as datagrams to the group:
+//      quint32 magic, quint32 transfer, quint32 index, quint32 chunk count,
+//      quint32 frame bytes, then up to MULTICAST_CHUNK bytes of the frame
+//  Each client learns of the transfer by an ANNOUNCE frame on its plan
+//  connection (quint32 transfer, chunk count, frame bytes) and answers on it
+//  like for a plan sent there. Missing chunks are asked for by a NACK frame
+//  (quint32 transfer, QVector<quint32> indices) and sent to the group again;
+//  a NACK without indices asks for the whole frame on the connection.
+
+#define MULTICAST_MAGIC 0x48494d43    // "HIMC"
+#define MULTICAST_HEADER 20
+#define MULTICAST_CHUNK 1400    // Frame bytes per datagram, under a typical MTU
+#define MULTICAST_NACK_DELAY 30    // ms without a chunk before a client asks for the missing ones
+#define MULTICAST_NACK_ROUNDS 4    // NACKs before a client asks for the frame on the connection
+#define MULTICAST_TRANSFERS 4    // Transfers kept for repair on the server and buffered on a client
+#define MULTICAST_MAX_FRAME (64 * 1024 * 1024)    // Largest plan frame multicast, a larger one goes by unicast
+#define MULTICAST_CAPABILITIES (CAP_COMPRESSION | CAP_SOA_PLAN | CAP_CHECKSUM | CAP_TIMESTAMP)
+
+inline int chunkCount(qint64 frameBytes)
+{
+    return int((frameBytes + MULTICAST_CHUNK - 1) / MULTICAST_CHUNK);
+}
+
+inline QByteArray encodeChunk(quint32 transfer, const QByteArray &frame, int index)
+{
+    int offset = index * MULTICAST_CHUNK;
+    int size = qMin(MULTICAST_CHUNK, frame.size() - offset);
+    QByteArray datagram(MULTICAST_HEADER + size, Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(datagram.data());
+    qToBigEndian(quint32(MULTICAST_MAGIC), header);
+    qToBigEndian(transfer, header + 4);
+    qToBigEndian(quint32(index), header + 8);
+    qToBigEndian(quint32(chunkCount(frame.size())), header + 12);
+    qToBigEndian(quint32(frame.size()), header + 16);
+    memcpy(datagram.data() + MULTICAST_HEADER, frame.constData() + offset, size);
+    return datagram;
+}
+
+struct ChunkHeader
+{
+    quint32 transfer;
+    quint32 index;
+    quint32 count;
+    quint32 frameBytes;
+};
+
+//  The chunk data follows the header, false for anything that is no chunk of a frame
+inline bool decodeChunk(const QByteArray &datagram, ChunkHeader &chunk)
+{
+    if (datagram.size() <= MULTICAST_HEADER)
+        return false;
+    const uchar *header = reinterpret_cast<const uchar *>(datagram.constData());
+    if (qFromBigEndian<quint32>(header) != MULTICAST_MAGIC)
+        return false;
+    chunk.transfer = qFromBigEndian<quint32>(header + 4);
+    chunk.index = qFromBigEndian<quint32>(header + 8);
+    chunk.count = qFromBigEndian<quint32>(header + 12);
+    chunk.frameBytes = qFromBigEndian<quint32>(header + 16);
+    if (chunk.frameBytes > MULTICAST_MAX_FRAME)
+        return false;    // Never allocated for, whoever sent it
+    int expected = qMin(qint64(MULTICAST_CHUNK), qint64(chunk.frameBytes) - qint64(chunk.index) * MULTICAST_CHUNK);
+    return chunk.count == quint32(chunkCount(chunk.frameBytes)) && chunk.index < chunk.count
+            && datagram.size() - MULTICAST_HEADER == expected;
+}
+
+inline QByteArray encodeAnnounce(quint32 transfer, qint64 frameBytes, quint32 capabilities)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << transfer
+        << quint32(chunkCount(frameBytes))
+        << quint32(frameBytes);
+    return encodeFrame(ANNOUNCE, payload, 0, capabilities);
+}
+
+inline QByteArray encodeNack(quint32 transfer, const QVector<quint32> &missing, quint32 capabilities)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << transfer
+        << missing;
+    return encodeFrame(NACK, payload, 0, capabilities);
+}
+
+inline bool isNackFrame(const QByteArray &baBlock)
+{
+    if (baBlock.size() < int(sizeof(qint64)))
+        return false;
+    qint64 header = qFromBigEndian<qint64>(reinterpret_cast<const uchar *>(baBlock.constData()));
+    return (header >> 32) == 0 && (header & HEADER_V2) && (header & HEADER_MASK) == NACK;
+}
+
+//  Statuses the server republishes to observer consoles, which only listen.
+//  Every status received goes out as one PUBLISH frame:
+//      quint64 sequence, QString peer, qint64 received (ms since epoch),
+//      QHash<QString, QVariant> full status of the peer
+//  The sequence counts every status published, a gap is what was dropped
+//  for an observer that could not keep up.
+
+#define OBSERVER_QUEUE 64    // Statuses queued per observer before the oldest is dropped
+#define OBSERVER_CAPABILITIES (CAP_COMPRESSION | CAP_CHECKSUM)
+
+struct PublishedStatus
+{
+    quint64 sequence;
+    QString peer;
+    qint64 received;
+    QHash<QString, QVariant> status;
+};
+
+inline QByteArray encodePublished(const PublishedStatus &published)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << published.sequence
+        << published.peer
+        << published.received
+        << published.status;
+    return encodeFrame(PUBLISH, payload, 0, OBSERVER_CAPABILITIES);
+}
+
+inline bool decodePublished(const QByteArray &payload, PublishedStatus &published)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> published.sequence
+       >> published.peer
+       >> published.received
+       >> published.status;
+    return in.status() == QDataStream::Ok;
+}
+
+//  Why a client refused a plan, sent back instead of the receipt as a REJECT
+//  frame: QString receipt, then the code, layer and index at fault and a message.
+//  Its header has zero high bits, which a receipt string never has.
+enum PlanErrorCode
+{
+    PLAN_OK,
+    PLAN_MALFORMED,
+    PLAN_LENGTH_MISMATCH,
+    PLAN_ORDER_RANGE,
+    PLAN_COORDINATE_RANGE,
+    PLAN_PARAMETER_RANGE,
+    PLAN_SCHEDULE    // A schedule, not a plan: index is the command at fault
+};
+
+struct PlanError
+{
+    quint32 code;
+    qint32 layer;    // Layer index in depth order, -1 when not about a layer
+    qint32 index;    // Spot or order index in the layer, -1 when not about a spot
+    QString message;
+};
+
+inline QByteArray encodeReject(const QString &receipt, const PlanError &error, quint32 capabilities)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << receipt
+        << error.code
+        << error.layer
+        << error.index
+        << error.message;
+    return encodeFrame(REJECT, payload, 0, capabilities);
+}
+
+inline bool isRejectFrame(const QByteArray &baBlock)
+{
+    if (baBlock.size() < int(sizeof(qint64)))
+        return false;
+    qint64 header = qFromBigEndian<qint64>(reinterpret_cast<const uchar *>(baBlock.constData()));
+    return (header >> 32) == 0 && (header & HEADER_V2) && (header & HEADER_MASK) == REJECT;
+}
+
+#endif // PROTOCOL
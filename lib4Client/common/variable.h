@@ -7,7 +7,15 @@ enum Header
 {
     COMMAND = 1,
     PLAN,
-    STATUS
+    STATUS,
+    HELLO,
+    SCHEDULE,
+    SYNC,
+    REJECT,
+    ACK,
+    ANNOUNCE,
+    NACK,
+    PUBLISH
 };
 
 enum cmdType
@@ -0,0 +1,104 @@
+#ifndef CLOCKSYNC
+#define CLOCKSYNC
+
+#include <QElapsedTimer>
+#include <QList>
+
+//  Monotonic clock of this process in microseconds, the base of every frame
+//  stamp. Its origin is arbitrary, ClockSync relates it to the peer's clock.
+
+inline QElapsedTimer startedClock()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock;
+}
+
+inline qint64 sessionTime()
+{
+    static const QElapsedTimer clock = startedClock();
+    return clock.nsecsElapsed() / 1000;
+}
+
+#define SYNC_WINDOW 8    // Exchanges kept for the offset and drift estimate
+
+//  NTP-style estimate of remote clock - local clock. Each exchange gives an
+//  offset and a round-trip delay; the sample with the lowest delay suffered
+//  the least queueing and sets the offset, and the slope of the offsets over
+//  the window gives the drift.
+class ClockSync
+{
+public:
+    ClockSync() : m_offset(0), m_delay(-1), m_drift(0), m_reference(0) {}
+
+    // t1 request sent and t4 reply received on the local clock, t2 and t3 on the remote one
+    void addExchange(qint64 t1, qint64 t2, qint64 t3, qint64 t4)
+    {
+        Sample sample;
+        sample.time = t4;
+        sample.offset = ((t2 - t1) + (t3 - t4)) / 2;
+        sample.delay = (t4 - t1) - (t3 - t2);
+        m_samples.append(sample);
+        if (m_samples.size() > SYNC_WINDOW)
+            m_samples.removeFirst();
+
+        int best = 0;
+        for (int i = 1; i < m_samples.size(); i++)
+        {
+            if (m_samples.at(i).delay < m_samples.at(best).delay)
+                best = i;
+        }
+        m_offset = m_samples.at(best).offset;
+        m_delay = m_samples.at(best).delay;
+        m_reference = m_samples.at(best).time;
+
+        double meanTime = 0, meanOffset = 0;
+        for (int i = 0; i < m_samples.size(); i++)
+        {
+            meanTime += m_samples.at(i).time;
+            meanOffset += m_samples.at(i).offset;
+        }
+        meanTime /= m_samples.size();
+        meanOffset /= m_samples.size();
+
+        double covariance = 0, variance = 0;
+        for (int i = 0; i < m_samples.size(); i++)
+        {
+            covariance += (m_samples.at(i).time - meanTime) * (m_samples.at(i).offset - meanOffset);
+            variance += (m_samples.at(i).time - meanTime) * (m_samples.at(i).time - meanTime);
+        }
+        m_drift = variance > 0 ? covariance / variance : 0;
+    }
+
+    // Estimate made by the peer, already turned into remote - local
+    void setEstimate(qint64 offset, double drift, qint64 reference, qint64 delay)
+    {
+        m_samples.clear();
+        m_offset = offset;
+        m_drift = drift;
+        m_reference = reference;
+        m_delay = delay;
+    }
+
+    inline bool isValid() const { return m_delay >= 0; }
+    inline qint64 offsetAt(qint64 localTime) const { return m_offset + qint64(m_drift * (localTime - m_reference)); }
+    inline qint64 remoteTime(qint64 localTime) const { return localTime + offsetAt(localTime); }
+    inline qint64 delay() const { return m_delay; }    // Round trip of the best exchange
+    inline double drift() const { return m_drift; }    // Microseconds per microsecond
+
+private:
+    struct Sample
+    {
+        qint64 time;
+        qint64 offset;
+        qint64 delay;
+    };
+    QList<Sample> m_samples;
+
+    qint64 m_offset;
+    qint64 m_delay;
+    double m_drift;
+    qint64 m_reference;
+};
+
+#endif // CLOCKSYNC
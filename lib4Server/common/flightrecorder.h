@@ -0,0 +1,257 @@
+#ifndef FLIGHTRECORDER
+#define FLIGHTRECORDER
+
+#include <QAtomicInteger>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+
+//  Always-on record of the last network events, kept in memory and written
+//  out only when something went wrong or on request. Recording an event is
+//  one atomic increment, one clock read and a 24-byte copy into a ring of
+//  power-of-two size, from any thread and without a lock; the oldest events
+//  are overwritten. Each slot carries the ticket it was written with, so a
+//  dump taken while threads record skips the slots being written.
+//  Dump layout:
+//      quint32 magic, quint16 version, quint8 side, qint64 start time (ms since epoch),
+//      QStringList peer names, quint32 count, then per event in record order:
+//      qint64 time (ns since start), quint8 kind, quint8 type, quint16 peer,
+//      quint32 size, qint64 detail
+
+#define FLIGHT_MAGIC 0x48494652    // "HIFR"
+#define FLIGHT_VERSION 1
+#define FLIGHT_CAPACITY 65536    // Events kept unless configured otherwise
+#define FLIGHT_DUMP_INTERVAL 1000    // ms between automatic dumps, an error storm writes one file
+
+enum FlightEventKind
+{
+    FLIGHT_CONNECT = 1,    // detail: port
+    FLIGHT_FRAME_IN,    // type: frame type, size: bytes
+    FLIGHT_FRAME_OUT,
+    FLIGHT_RECEIPT,    // type: 1 when it matched, detail: plan id
+    FLIGHT_ACK,    // type: CommandResult, size: round trip in us, detail: sequence
+    FLIGHT_ERROR,    // type: Server::Error, or PlanErrorCode on a client; detail: plan id, sequence or layer at fault, -1 if none
+    FLIGHT_SOCKET_ERROR,    // type: QAbstractSocket::SocketError
+    FLIGHT_MARK    // type and detail chosen by the caller
+};
+
+struct FlightEvent
+{
+    qint64 time;
+    quint8 kind;
+    quint8 type;
+    quint16 peer;
+    quint32 size;
+    qint64 detail;
+};
+
+inline QDataStream &operator<<(QDataStream &out, const FlightEvent &event)
+{
+    out << event.time
+        << event.kind
+        << event.type
+        << event.peer
+        << event.size
+        << event.detail;
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, FlightEvent &event)
+{
+    in >> event.time
+       >> event.kind
+       >> event.type
+       >> event.peer
+       >> event.size
+       >> event.detail;
+    return in;
+}
+
+class FlightRecorder
+{
+public:
+    explicit FlightRecorder(int side, int capacity = FLIGHT_CAPACITY)
+        : m_side(side), m_slots(0), m_mask(0), m_next(0)
+    {
+        m_startTime = QDateTime::currentMSecsSinceEpoch();
+        m_clock.start();
+        setCapacity(capacity);
+    }
+    ~FlightRecorder() { delete[] m_slots; }
+
+    // Drops what was recorded; call before other threads record
+    void setCapacity(int capacity)
+    {
+        int size = 1;
+        while (size < capacity && size < (1 << 24))
+            size <<= 1;
+        delete[] m_slots;
+        m_slots = new Slot[size];
+        m_mask = quint32(size - 1);
+        m_next.store(0);
+    }
+    inline int capacity() const { return int(m_mask + 1); }
+
+    // Id of a peer in the events, names are written with the dump
+    quint16 registerPeer(const QString &name)
+    {
+        QMutexLocker locker(&m_peerMutex);
+        int index = m_peers.indexOf(name);
+        if (index < 0)
+        {
+            index = m_peers.size();
+            m_peers.append(name);
+        }
+        return quint16(index);
+    }
+
+    inline void record(FlightEventKind kind, int type, quint16 peer, qint64 size = 0, qint64 detail = 0)
+    {
+        quint32 ticket = m_next.fetchAndAddRelaxed(1);
+        Slot &slot = m_slots[ticket & m_mask];
+        slot.stamp.store(0);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.event.time = m_clock.nsecsElapsed();
+        slot.event.kind = quint8(kind);
+        slot.event.type = quint8(type);
+        slot.event.peer = peer;
+        slot.event.size = quint32(qBound(qint64(0), size, qint64(0xffffffff)));
+        slot.event.detail = detail;
+        slot.stamp.storeRelease(ticket + 1);
+    }
+
+    // Events still in the ring, oldest first
+    QVector<FlightEvent> snapshot() const
+    {
+        quint32 next = m_next.loadAcquire();
+        QVector<QPair<quint32, FlightEvent> > taken;
+        taken.reserve(capacity());
+        for (int i = 0; i < capacity(); i++)
+        {
+            const Slot &slot = m_slots[i];
+            quint32 stamp = slot.stamp.loadAcquire();
+            FlightEvent event = slot.event;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (stamp == 0 || stamp != slot.stamp.load())
+                continue;    // Empty, or overwritten while it was copied
+            quint32 age = next - (stamp - 1);
+            if (age == 0 || age > m_mask + 1)
+                continue;    // Written after the snapshot started
+            taken.append(qMakePair(age, event));
+        }
+        std::sort(taken.begin(), taken.end(), olderFirst);
+
+        QVector<FlightEvent> events(taken.size());
+        for (int i = 0; i < taken.size(); i++)
+            events[i] = taken.at(i).second;
+        return events;
+    }
+
+    bool dump(const QString &fileName) const
+    {
+        QVector<FlightEvent> events = snapshot();
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+
+        QStringList peers;
+        {
+            QMutexLocker locker(&m_peerMutex);
+            peers = m_peers;
+        }
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << quint32(FLIGHT_MAGIC)
+            << quint16(FLIGHT_VERSION)
+            << quint8(m_side)
+            << m_startTime
+            << peers
+            << quint32(events.size());
+        for (int i = 0; i < events.size(); i++)
+            out << events.at(i);
+        file.close();
+        return out.status() == QDataStream::Ok;
+    }
+
+private:
+    Q_DISABLE_COPY(FlightRecorder)
+
+    struct Slot
+    {
+        Slot() : stamp(0) {}
+        QAtomicInteger<quint32> stamp;    // Ticket + 1 once written, 0 while being written
+        FlightEvent event;
+    };
+
+    static bool olderFirst(const QPair<quint32, FlightEvent> &a, const QPair<quint32, FlightEvent> &b)
+    {
+        return a.first > b.first;
+    }
+
+    int m_side;
+    qint64 m_startTime;
+    QElapsedTimer m_clock;
+    Slot *m_slots;
+    quint32 m_mask;
+    QAtomicInteger<quint32> m_next;
+
+    mutable QMutex m_peerMutex;
+    QStringList m_peers;
+};
+
+//  Reads a dump back for the decoder
+class FlightReader
+{
+public:
+    FlightReader() : m_side(0), m_startTime(0) {}
+
+    inline int side() const { return m_side; }
+    inline qint64 startTime() const { return m_startTime; }
+    inline const QStringList &peers() const { return m_peers; }
+    inline const QVector<FlightEvent> &events() const { return m_events; }
+
+    bool open(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        QDataStream in(&file);
+        in.setVersion(QDataStream::Qt_4_6);
+
+        quint32 magic, count;
+        quint16 version;
+        quint8 side;
+        in >> magic >> version >> side >> m_startTime >> m_peers >> count;
+        if (in.status() != QDataStream::Ok || magic != FLIGHT_MAGIC || version > FLIGHT_VERSION)
+            return false;
+        m_side = side;
+
+        m_events.clear();
+        m_events.reserve(int(qMin(count, quint32(1 << 24))));
+        for (quint32 i = 0; i < count; i++)
+        {
+            FlightEvent event;
+            in >> event;
+            if (in.status() != QDataStream::Ok)
+                return false;
+            m_events.append(event);
+        }
+        return true;
+    }
+
+private:
+    int m_side;
+    qint64 m_startTime;
+    QStringList m_peers;
+    QVector<FlightEvent> m_events;
+};
+
+#endif // FLIGHTRECORDER
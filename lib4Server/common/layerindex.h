@@ -0,0 +1,119 @@
+#ifndef LAYERINDEX
+#define LAYERINDEX
+
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
+
+#define LAYER_TOLERANCE 1e-4f    // Largest difference between a depth looked up and the layer's
+
+//  Layers of a plan sorted by depth in two contiguous arrays. A depth is looked
+//  up by binary search within a tolerance instead of by bitwise float equality,
+//  the nearest layer winning when several are that close; iteration runs in
+//  depth order, and range() returns every layer in [low, high]. Lookups never
+//  insert; only insert() and layer() add a layer.
+
+template <typename T>
+class LayerIndex
+{
+public:
+    explicit LayerIndex(float tolerance = LAYER_TOLERANCE) : m_tolerance(tolerance) {}
+
+    // Every key stays a layer of its own, however close to another
+    explicit LayerIndex(const QHash<float, T> &hash, float tolerance = LAYER_TOLERANCE) : m_tolerance(tolerance)
+    {
+        QList<float> keys = hash.keys();
+        std::sort(keys.begin(), keys.end());
+        m_depths.reserve(keys.size());
+        m_values.reserve(keys.size());
+        for (int i = 0; i < keys.size(); i++)
+        {
+            m_depths.append(keys.at(i));
+            m_values.append(hash.constFind(keys.at(i)).value());
+        }
+    }
+
+    inline int size() const { return m_depths.size(); }
+    inline bool isEmpty() const { return m_depths.isEmpty(); }
+    inline float tolerance() const { return m_tolerance; }
+    inline void clear() { m_depths.clear(); m_values.clear(); }
+
+    inline float depthAt(int index) const { return m_depths.at(index); }
+    inline const T &at(int index) const { return m_values.at(index); }
+    inline T &operator[](int index) { return m_values[index]; }
+    inline const QVector<float> &depths() const { return m_depths; }
+
+    // Position of the layer nearest to depth within the tolerance, -1 when there is none
+    int indexOf(float depth) const
+    {
+        int first, last;
+        range(depth, depth, first, last);
+        int index = -1;
+        for (int i = first; i < last; i++)
+        {
+            if (index < 0 || qAbs(m_depths.at(i) - depth) < qAbs(m_depths.at(index) - depth))
+                index = i;
+        }
+        return index;
+    }
+
+    inline bool contains(float depth) const { return indexOf(depth) >= 0; }
+
+    inline const T *find(float depth) const
+    {
+        int index = indexOf(depth);
+        return index >= 0 ? &m_values.at(index) : 0;
+    }
+
+    inline T value(float depth, const T &defaultValue = T()) const
+    {
+        int index = indexOf(depth);
+        return index >= 0 ? m_values.at(index) : defaultValue;
+    }
+
+    // Layers [first, last) with a depth in [low, high], both ends within the tolerance
+    inline void range(float low, float high, int &first, int &last) const
+    {
+        first = lowerBound(low - m_tolerance);
+        last = int(std::upper_bound(m_depths.constBegin(), m_depths.constEnd(), high + m_tolerance) - m_depths.constBegin());
+        if (last < first)
+            last = first;
+    }
+
+    // Layer at depth, added in depth order when there is none yet
+    T &layer(float depth)
+    {
+        int index = indexOf(depth);
+        if (index < 0)
+        {
+            index = lowerBound(depth);
+            m_depths.insert(index, depth);
+            m_values.insert(index, T());
+        }
+        return m_values[index];
+    }
+
+    inline void insert(float depth, const T &value) { layer(depth) = value; }
+
+    QHash<float, T> toHash() const
+    {
+        QHash<float, T> hash;
+        hash.reserve(m_depths.size());
+        for (int i = 0; i < m_depths.size(); i++)
+            hash.insert(m_depths.at(i), m_values.at(i));
+        return hash;
+    }
+
+private:
+    QVector<float> m_depths;
+    QVector<T> m_values;
+    float m_tolerance;
+
+    inline int lowerBound(float depth) const
+    {
+        return int(std::lower_bound(m_depths.constBegin(), m_depths.constEnd(), depth) - m_depths.constBegin());
+    }
+};
+
+#endif // LAYERINDEX
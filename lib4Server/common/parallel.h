@@ -0,0 +1,55 @@
+#ifndef PARALLEL
+#define PARALLEL
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+//  Run function(i) for every i in [0, count) on the pool and the calling thread.
+//  Indices are handed out one at a time so uneven layers still balance, and
+//  results written by index keep the output independent of thread timing.
+
+template <typename Function>
+class ParallelTask : public QRunnable
+{
+public:
+    ParallelTask(Function *function, QAtomicInt *next, int count, QSemaphore *done)
+        : m_function(function), m_next(next), m_count(count), m_done(done) {}
+
+    void run()
+    {
+        for (int i = m_next->fetchAndAddRelaxed(1); i < m_count; i = m_next->fetchAndAddRelaxed(1))
+            (*m_function)(i);
+        m_done->release();
+    }
+
+private:
+    Function *m_function;
+    QAtomicInt *m_next;
+    int m_count;
+    QSemaphore *m_done;
+};
+
+template <typename Function>
+inline void parallelFor(QThreadPool *pool, int count, Function function)
+{
+    int helperCount = qMin(pool->maxThreadCount(), count) - 1;
+    if (helperCount <= 0)
+    {
+        for (int i = 0; i < count; i++)
+            function(i);
+        return;
+    }
+
+    QAtomicInt next(0);
+    QSemaphore done;
+    for (int i = 0; i < helperCount; i++)
+        pool->start(new ParallelTask<Function>(&function, &next, count, &done));
+
+    ParallelTask<Function> own(&function, &next, count, &done);
+    own.run();
+    done.acquire(helperCount + 1);
+}
+
+#endif // PARALLEL
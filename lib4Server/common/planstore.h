@@ -0,0 +1,378 @@
+#ifndef PLANSTORE
+#define PLANSTORE
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <string.h>
+
+#include "variable.h"
+
+//  The last plans kept on disk so a restarted process has them back at once.
+//  Every plan is one slot file, written whole through QSaveFile so a crash
+//  leaves the previous content, and read back with QFile::map(): the spot
+//  and order arrays are used where they lie in the mapping, nothing is parsed.
+//  Files are in native byte order, they never leave the machine.
+//  Slot file layout:
+//      PlanSlotHeader, then the plan image
+//  Plan image layout:
+//      PlanImageHeader, PlanImageLayer[layerCount], then per layer the spots
+//      and the order, each 8-byte aligned at the offsets of its table entry
+//  The journal is a small mapped file holding two alternating copies of the
+//  session progress, the newer copy with a good checksum is current. A write
+//  is a memcpy into the mapping, the system keeps it when the process dies.
+
+#define STORE_MAGIC 0x48494650    // "HIFP"
+#define STORE_VERSION 1
+#define JOURNAL_MAGIC 0x4849464A    // "HIFJ"
+#define JOURNAL_NAME "journal.bin"
+
+struct PlanSlotHeader
+{
+    quint32 magic;
+    quint16 version;
+    quint16 reserved;
+    qint64 sequence;    // Grows with every plan saved, 0 is no plan
+    qint64 tag;    // Caller's id of the plan
+    qint64 savedAt;    // ms since epoch
+    qint64 size;    // Bytes of the image
+};
+
+struct PlanImageHeader
+{
+    quint32 layerCount;
+    quint32 reserved;
+    SpotSonicationParameter parameter;
+};
+
+struct PlanImageLayer
+{
+    float depth;
+    qint32 spotCount;
+    qint32 orderCount;
+    qint32 reserved;
+    qint64 spotOffset;    // From the start of the image
+    qint64 orderOffset;
+};
+
+struct JournalRecord
+{
+    quint32 magic;
+    quint16 checksum;    // qChecksum of the record with this field 0
+    quint16 reserved;
+    qint64 count;    // Write counter, picks the current copy
+    qint64 sequence;    // Plan the progress belongs to
+    qint64 updatedAt;    // ms since epoch
+    SessionRecorder recorder;
+};
+
+static inline qint64 imageAlign(qint64 offset)
+{
+    return (offset + 7) & ~qint64(7);
+}
+
+//  Lays a plan out as an image in one allocation sized up front
+class PlanImageWriter
+{
+public:
+    PlanImageWriter(int layerCount, qint64 spotCount, qint64 orderCount, const SpotSonicationParameter &parameter)
+        : m_layerCount(layerCount), m_layer(0)
+    {
+        m_offset = imageAlign(sizeof(PlanImageHeader)) + qint64(layerCount) * sizeof(PlanImageLayer);
+        m_image = QByteArray(int(m_offset + spotCount * sizeof(Spot3DCoordinate) + orderCount * sizeof(qint32)
+                                 + qint64(layerCount) * 16), 0);
+        PlanImageHeader *header = reinterpret_cast<PlanImageHeader *>(m_image.data());
+        header->layerCount = quint32(layerCount);
+        header->parameter = parameter;
+    }
+
+    // Room for the next layer in depth order, the caller fills spots and order
+    void addLayer(float depth, int spotCount, int orderCount, Spot3DCoordinate *&spots, qint32 *&order)
+    {
+        Q_ASSERT(m_layer < m_layerCount);
+        PlanImageLayer *layer = reinterpret_cast<PlanImageLayer *>(m_image.data() + imageAlign(sizeof(PlanImageHeader))) + m_layer++;
+        layer->depth = depth;
+        layer->spotCount = spotCount;
+        layer->orderCount = orderCount;
+        layer->spotOffset = imageAlign(m_offset);
+        layer->orderOffset = imageAlign(layer->spotOffset + qint64(spotCount) * sizeof(Spot3DCoordinate));
+        m_offset = layer->orderOffset + qint64(orderCount) * sizeof(qint32);
+        spots = reinterpret_cast<Spot3DCoordinate *>(m_image.data() + layer->spotOffset);
+        order = reinterpret_cast<qint32 *>(m_image.data() + layer->orderOffset);
+    }
+
+    inline QByteArray image() const { return m_image.left(int(m_offset)); }
+
+private:
+    QByteArray m_image;
+    int m_layerCount;
+    int m_layer;
+    qint64 m_offset;
+};
+
+//  Reads an image in place; open() checks the table against the size once,
+//  so layer() is only pointer arithmetic
+class PlanImageReader
+{
+public:
+    PlanImageReader() : m_image(0), m_size(0), m_header(0) {}
+
+    bool open(uchar *image, qint64 size)
+    {
+        m_image = image;
+        m_size = size;
+        m_header = 0;
+        qint64 tableOffset = imageAlign(sizeof(PlanImageHeader));
+        if (!image || size < tableOffset)
+            return false;
+        const PlanImageHeader *header = reinterpret_cast<const PlanImageHeader *>(image);
+        if (qint64(header->layerCount) * sizeof(PlanImageLayer) > size - tableOffset)
+            return false;
+        for (quint32 i = 0; i < header->layerCount; i++)
+        {
+            const PlanImageLayer &layer = table()[i];
+            if (layer.spotCount < 0 || layer.orderCount < 0 || layer.spotOffset < 0 || layer.orderOffset < 0 ||
+                    layer.spotOffset > size || layer.orderOffset > size ||
+                    (layer.spotOffset & 7) || (layer.orderOffset & 7) ||
+                    layer.spotOffset + qint64(layer.spotCount) * qint64(sizeof(Spot3DCoordinate)) > size ||
+                    layer.orderOffset + qint64(layer.orderCount) * qint64(sizeof(qint32)) > size)
+                return false;
+        }
+        m_header = header;
+        return true;
+    }
+
+    inline int layerCount() const { return m_header ? int(m_header->layerCount) : 0; }
+    inline SpotSonicationParameter parameter() const { return m_header->parameter; }
+
+    inline void layer(int index, float &depth, Spot3DCoordinate *&spots, int &spotCount, qint32 *&order, int &orderCount) const
+    {
+        const PlanImageLayer &entry = table()[index];
+        depth = entry.depth;
+        spots = reinterpret_cast<Spot3DCoordinate *>(m_image + entry.spotOffset);
+        spotCount = entry.spotCount;
+        order = reinterpret_cast<qint32 *>(m_image + entry.orderOffset);
+        orderCount = entry.orderCount;
+    }
+
+private:
+    uchar *m_image;
+    qint64 m_size;
+    const PlanImageHeader *m_header;
+
+    inline const PlanImageLayer *table() const
+    {
+        return reinterpret_cast<const PlanImageLayer *>(m_image + imageAlign(sizeof(PlanImageHeader)));
+    }
+};
+
+class PlanStore
+{
+public:
+    PlanStore() : m_capacity(0), m_sequence(0), m_map(0), m_journal(0), m_journalCount(0) {}
+    ~PlanStore() { close(); }
+
+    inline bool isOpen() const { return m_capacity > 0; }
+    inline qint64 lastSequence() const { return m_sequence; }
+
+    // Keep the last capacity plans in directory, created when missing
+    bool open(const QString &directory, int capacity)
+    {
+        close();
+        if (directory.isEmpty() || capacity <= 0 || !QDir().mkpath(directory))
+            return false;
+        m_directory = QDir(directory);
+        m_capacity = capacity;
+
+        PlanSlotHeader header;
+        m_sequence = 0;
+        for (int i = 0; i < m_capacity; i++)
+        {
+            if (readHeader(i, header) && header.sequence > m_sequence)
+                m_sequence = header.sequence;
+        }
+        openJournal();
+        return true;
+    }
+
+    void close()
+    {
+        unmap();
+        if (m_journal)
+        {
+            m_journalFile.unmap(m_journal);
+            m_journal = 0;
+        }
+        m_journalFile.close();
+        m_capacity = 0;
+    }
+
+    // Overwrites the oldest slot, returns the sequence given to the plan or 0
+    qint64 save(const QByteArray &image, qint64 tag)
+    {
+        if (!isOpen())
+            return 0;
+
+        PlanSlotHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = STORE_MAGIC;
+        header.version = STORE_VERSION;
+        header.sequence = m_sequence + 1;
+        header.tag = tag;
+        header.savedAt = QDateTime::currentMSecsSinceEpoch();
+        header.size = image.size();
+
+        int slot = int(header.sequence % m_capacity);
+        if (m_map && m_mapFile.fileName() == slotName(slot))
+            unmap();    // The slot is replaced under the mapping
+
+        QSaveFile file(slotName(slot));
+        if (!file.open(QIODevice::WriteOnly))
+            return 0;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(image);
+        if (!file.commit())
+            return 0;
+        m_sequence = header.sequence;
+        return m_sequence;
+    }
+
+    // Image of the newest plan, private to this process and valid until unmap()
+    uchar *mapLatest(qint64 &size, qint64 &sequence, qint64 &tag)
+    {
+        unmap();
+        PlanSlotHeader header, latest;
+        int slot = -1;
+        for (int i = 0; i < m_capacity; i++)
+        {
+            if (readHeader(i, header) && (slot < 0 || header.sequence > latest.sequence))
+            {
+                latest = header;
+                slot = i;
+            }
+        }
+        if (slot < 0)
+            return 0;
+
+        m_mapFile.setFileName(slotName(slot));
+        if (!m_mapFile.open(QIODevice::ReadOnly) || m_mapFile.size() < qint64(sizeof(PlanSlotHeader)) + latest.size)
+        {
+            m_mapFile.close();
+            return 0;
+        }
+        m_map = m_mapFile.map(0, sizeof(PlanSlotHeader) + latest.size, QFileDevice::MapPrivateOption);
+        if (!m_map)
+        {
+            m_mapFile.close();
+            return 0;
+        }
+        size = latest.size;
+        sequence = latest.sequence;
+        tag = latest.tag;
+        return m_map + sizeof(PlanSlotHeader);
+    }
+
+    void unmap()
+    {
+        if (m_map)
+        {
+            m_mapFile.unmap(m_map);
+            m_map = 0;
+        }
+        m_mapFile.close();
+    }
+
+    // Progress through plan sequence, written in place
+    void journal(qint64 sequence, const SessionRecorder &recorder)
+    {
+        if (!m_journal)
+            return;
+        JournalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.magic = JOURNAL_MAGIC;
+        record.count = ++m_journalCount;
+        record.sequence = sequence;
+        record.updatedAt = QDateTime::currentMSecsSinceEpoch();
+        record.recorder = recorder;
+        record.checksum = qChecksum(reinterpret_cast<const char *>(&record), sizeof(record));
+        memcpy(m_journal + (record.count & 1) * sizeof(JournalRecord), &record, sizeof(record));
+    }
+
+    bool readJournal(qint64 &sequence, SessionRecorder &recorder) const
+    {
+        JournalRecord record;
+        if (!currentRecord(record))
+            return false;
+        sequence = record.sequence;
+        recorder = record.recorder;
+        return true;
+    }
+
+private:
+    Q_DISABLE_COPY(PlanStore)
+
+    QDir m_directory;
+    int m_capacity;
+    qint64 m_sequence;
+
+    QFile m_mapFile;
+    uchar *m_map;
+
+    QFile m_journalFile;
+    uchar *m_journal;
+    qint64 m_journalCount;
+
+    inline QString slotName(int slot) const { return m_directory.filePath(QString("plan%1.bin").arg(slot)); }
+
+    bool readHeader(int slot, PlanSlotHeader &header) const
+    {
+        QFile file(slotName(slot));
+        if (!file.open(QIODevice::ReadOnly) || file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header))
+            return false;
+        return header.magic == STORE_MAGIC && header.version == STORE_VERSION && header.sequence > 0 &&
+                header.size >= 0 && file.size() >= qint64(sizeof(header)) + header.size;
+    }
+
+    void openJournal()
+    {
+        m_journalFile.setFileName(m_directory.filePath(JOURNAL_NAME));
+        qint64 size = 2 * sizeof(JournalRecord);
+        if (!m_journalFile.open(QIODevice::ReadWrite) ||
+                (m_journalFile.size() != size && !m_journalFile.resize(size)))
+        {
+            m_journalFile.close();
+            return;
+        }
+        m_journal = m_journalFile.map(0, size);
+        JournalRecord record;
+        m_journalCount = currentRecord(record) ? record.count : 0;
+    }
+
+    bool currentRecord(JournalRecord &record) const
+    {
+        if (!m_journal)
+            return false;
+        bool found = false;
+        for (int i = 0; i < 2; i++)
+        {
+            JournalRecord copy;
+            memcpy(&copy, m_journal + i * sizeof(JournalRecord), sizeof(copy));
+            quint16 checksum = copy.checksum;
+            copy.checksum = 0;
+            if (copy.magic != JOURNAL_MAGIC || checksum != qChecksum(reinterpret_cast<const char *>(&copy), sizeof(copy)))
+                continue;
+            if (!found || copy.count > record.count)
+            {
+                copy.checksum = checksum;
+                record = copy;
+                found = true;
+            }
+        }
+        return found;
+    }
+};
+
+#endif // PLANSTORE
@@ -0,0 +1,51 @@
+#ifndef SPSCQUEUE
+#define SPSCQUEUE
+
+#include <QAtomicInt>
+
+//  Bounded ring for exactly one producer thread and one consumer thread.
+//  The producer only moves the tail and the consumer only moves the head,
+//  so push() and pop() never take a lock; push() fails when the ring is full.
+
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(int capacity = 1024)
+        : m_size(capacity + 1), m_buffer(new T[capacity + 1]), m_head(0), m_tail(0) {}
+    ~SpscQueue() { delete[] m_buffer; }
+
+    bool push(const T &item)
+    {
+        int tail = m_tail.load();
+        int next = (tail + 1) % m_size;
+        if (next == m_head.loadAcquire())
+            return false;
+        m_buffer[tail] = item;
+        m_tail.storeRelease(next);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        int head = m_head.load();
+        if (head == m_tail.loadAcquire())
+            return false;
+        item = m_buffer[head];
+        m_buffer[head] = T();    // Shared data is released on the consumer side
+        m_head.storeRelease((head + 1) % m_size);
+        return true;
+    }
+
+    inline bool isEmpty() const { return m_head.loadAcquire() == m_tail.loadAcquire(); }
+
+private:
+    Q_DISABLE_COPY(SpscQueue)
+
+    int m_size;
+    T *m_buffer;
+    QAtomicInt m_head;
+    QAtomicInt m_tail;
+};
+
+#endif // SPSCQUEUE
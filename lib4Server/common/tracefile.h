@@ -0,0 +1,139 @@
+#ifndef TRACEFILE
+#define TRACEFILE
+
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+//  Binary trace of every frame that crosses the wire.
+//  File layout:
+//      quint32 magic, quint16 version, quint8 side, qint64 start time (ms since epoch)
+//      then per record: qint64 timestamp (ns since start), quint8 direction,
+//      quint8 frame type, QByteArray raw frame
+
+#define TRACE_MAGIC 0x48494654    // "HIFT"
+#define TRACE_VERSION 1
+
+enum TraceSide
+{
+    TRACE_SERVER = 0,
+    TRACE_CLIENT
+};
+
+enum TraceDirection
+{
+    TRACE_IN = 0,
+    TRACE_OUT
+};
+
+//  Frame types not carrying a header on the wire
+enum TraceFrame
+{
+    TRACE_RECEIPT = 0x10
+};
+
+struct TraceRecord
+{
+    qint64 timestamp;
+    quint8 direction;
+    quint8 type;
+    QByteArray frame;
+};
+
+class TraceWriter
+{
+public:
+    TraceWriter() : m_stream(&m_file) { m_stream.setVersion(QDataStream::Qt_4_6); }
+    ~TraceWriter() { close(); }
+
+    inline bool isOpen() const { return m_file.isOpen(); }
+
+    bool open(const QString &fileName, TraceSide side)
+    {
+        close();
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        m_stream.setDevice(&m_file);
+        m_stream << quint32(TRACE_MAGIC)
+                 << quint16(TRACE_VERSION)
+                 << quint8(side)
+                 << QDateTime::currentMSecsSinceEpoch();
+        m_clock.start();
+        return true;
+    }
+
+    void write(TraceDirection direction, int type, const QByteArray &frame)
+    {
+        if (!m_file.isOpen())
+            return;
+        m_stream << m_clock.nsecsElapsed()
+                 << quint8(direction)
+                 << quint8(type)
+                 << frame;
+    }
+
+    void close()
+    {
+        if (m_file.isOpen())
+        {
+            m_file.flush();
+            m_file.close();
+        }
+    }
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_clock;
+};
+
+class TraceReader
+{
+public:
+    TraceReader() : m_side(TRACE_SERVER), m_startTime(0) { m_stream.setVersion(QDataStream::Qt_4_6); }
+
+    inline TraceSide side() const { return m_side; }
+    inline qint64 startTime() const { return m_startTime; }
+    inline bool atEnd() const { return m_stream.atEnd(); }
+
+    bool open(const QString &fileName)
+    {
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::ReadOnly))
+            return false;
+        m_stream.setDevice(&m_file);
+
+        quint32 magic;
+        quint16 version;
+        quint8 side;
+        m_stream >> magic >> version >> side >> m_startTime;
+        if (magic != TRACE_MAGIC || version > TRACE_VERSION)
+        {
+            m_file.close();
+            return false;
+        }
+        m_side = TraceSide(side);
+        return true;
+    }
+
+    bool readNext(TraceRecord &record)
+    {
+        if (!m_file.isOpen() || m_stream.atEnd())
+            return false;
+        m_stream >> record.timestamp
+                 >> record.direction
+                 >> record.type
+                 >> record.frame;
+        return m_stream.status() == QDataStream::Ok;
+    }
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    TraceSide m_side;
+    qint64 m_startTime;
+};
+
+#endif // TRACEFILE